@@ -0,0 +1,127 @@
+//
+//  mipmap_bench.cpp
+//  Window
+//
+//  Created by William Goniprow on 2/25/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+//  Times building full mip chains on the CPU with each filter against what stb_image takes to decode
+//  the same file, and reading the chain back from a .mips cache. No GL is touched. Build from Window/Window:
+//    c++ -std=c++14 -O2 ../Benchmarks/mipmap_bench.cpp glad.c -lpthread -o mipmap_bench
+//  and run from the same directory, --workers N sizes the job system the filters run on:
+//    ./mipmap_bench 10 marble.jpg metal.png container.jpg container2.png
+//
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "../Window/stb_image.h"
+#include "../Window/mipmap.h"
+
+struct BenchResult {
+    double best;
+    double average;
+};
+
+template <typename Work>
+BenchResult runBench(int iterations, Work work) {
+    BenchResult result = { 1e30, 0.0 };
+    for(int i = 0; i < iterations; i++) {
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        work();
+        double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+        result.best = min(result.best, ms);
+        result.average += ms / iterations;
+    }
+    return result;
+}
+
+void printResult(const char *name, const BenchResult &result, double megapixels, double decode) {
+    cout << "  " << name << ": best " << result.best << " ms, avg " << result.average << " ms, "
+         << megapixels / (result.best / 1000.0) << " MP/s, " << result.best / decode << "x decode" << endl;
+}
+
+void benchImage(const string &path, int iterations) {
+    int width, height, nrComponents;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
+    if(!data) {
+        cout << path << ": failed to load" << endl;
+        return;
+    }
+    // the chain adds a third to the pixels of level 0
+    const double megapixels = width * height * 4.0 / 3.0 / 1e6;
+    cout << path << ": " << width << "x" << height << ", " << nrComponents << " channels" << endl;
+
+    BenchResult decode = runBench(iterations, [&]() {
+        int w, h, n;
+        stbi_image_free(stbi_load(path.c_str(), &w, &h, &n, 0));
+    });
+    cout << "  decode: best " << decode.best << " ms, avg " << decode.average << " ms" << endl;
+
+    const struct { const char *name; Mip_Filter filter; bool srgb; } filters[] = {
+        { "box linear",  MIP_FILTER_BOX,     false },
+        { "box sRGB",    MIP_FILTER_BOX,     true  },
+        { "kaiser sRGB", MIP_FILTER_KAISER,  true  },
+        { "lanczos sRGB", MIP_FILTER_LANCZOS, true },
+    };
+    MipChain chain;
+    for(unsigned int i = 0; i < sizeof(filters) / sizeof(filters[0]); i++) {
+        MipOptions options;
+        options.filter = filters[i].filter;
+        options.srgb = filters[i].srgb;
+        BenchResult result = runBench(iterations, [&]() {
+            GenerateMipChain(data, width, height, nrComponents, options, chain);
+        });
+        printResult(filters[i].name, result, megapixels, decode.best);
+    }
+
+    // the chain from the last filter, read back the way a later load would
+    MipOptions cached;
+    cached.filter = MIP_FILTER_LANCZOS;
+    if(WriteMipCache(path, cached, chain)) {
+        BenchResult result = runBench(iterations, [&]() {
+            MipChain read;
+            if(!ReadMipCache(path, cached, read))
+                cout << "ERROR::MIPMAP_BENCH::CACHE_READ_FAILED" << endl;
+        });
+        printResult("cache read", result, megapixels, decode.best);
+        remove(MipCachePath(path, cached).c_str());
+    }
+    stbi_image_free(data);
+}
+
+int main(int argc, char **argv) {
+    JobWorkerSetting() = ParseJobWorkers(argc, argv);
+    int iterations = 10;
+    vector<string> paths;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--workers") == 0) {
+            i++;
+            continue;
+        }
+        if(paths.empty() && atoi(argv[i]) > 0 && strspn(argv[i], "0123456789") == strlen(argv[i]))
+            iterations = atoi(argv[i]);
+        else
+            paths.push_back(argv[i]);
+    }
+    if(paths.empty()) {
+        const char *defaults[] = { "marble.jpg", "metal.png", "container.jpg", "container2.png", "container2_specular.png", "awesomeface.png" };
+        paths.assign(defaults, defaults + sizeof(defaults) / sizeof(defaults[0]));
+    }
+
+#if defined(__SSE2__)
+    const char *simd = "SSE2";
+#else
+    const char *simd = "scalar";
+#endif
+    cout << iterations << " iterations, " << Jobs().NumWorkers() << " worker threads, " << simd << " filters" << endl;
+    for(unsigned int i = 0; i < paths.size(); i++) {
+        benchImage(paths[i], iterations);
+    }
+    return 0;
+}
@@ -0,0 +1,79 @@
+//
+//  obj_loader_bench.cpp
+//  Window
+//
+//  Created by William Goniprow on 2/9/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+//  Times the native OBJ loader against the Assimp import path on the same file. Neither path
+//  touches GL, so no window or context is needed. Build from Window/Window:
+//    c++ -std=c++14 -O2 -I/usr/local/include ../Benchmarks/obj_loader_bench.cpp glad.c -lassimp -lpthread -o obj_loader_bench
+//  and run from the same directory:
+//    ./obj_loader_bench nanosuit/nanosuit.obj 20
+//
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+
+#include "../Window/model.h"
+#include "../Window/obj_loader.h"
+
+struct BenchResult {
+    double best;
+    double average;
+    size_t vertices;
+    size_t indices;
+    size_t meshes;
+};
+
+template <typename Import>
+BenchResult runBench(int iterations, Import import) {
+    BenchResult result = { 1e30, 0.0, 0, 0, 0 };
+    for(int i = 0; i < iterations; i++) {
+        vector<MeshData> meshData;
+        chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+        if(!import(meshData)) {
+            cout << "import failed" << endl;
+            exit(1);
+        }
+        double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+        result.best = min(result.best, ms);
+        result.average += ms / iterations;
+        result.vertices = result.indices = 0;
+        result.meshes = meshData.size();
+        for(unsigned int m = 0; m < meshData.size(); m++) {
+            result.vertices += meshData[m].vertices.size();
+            result.indices  += meshData[m].indices.size();
+        }
+    }
+    return result;
+}
+
+void printResult(const char *name, const BenchResult &result) {
+    cout << name << ": best " << result.best << " ms, avg " << result.average << " ms, "
+         << result.meshes << " meshes, " << result.vertices << " vertices, " << result.indices << " indices" << endl;
+}
+
+int main(int argc, char **argv) {
+    string path = argc > 1 ? argv[1] : "nanosuit/nanosuit.obj";
+    int iterations = argc > 2 ? atoi(argv[2]) : 10;
+    if(iterations < 1)
+        iterations = 1;
+    const unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs;
+
+    cout << path << ", " << iterations << " iterations, " << Jobs().NumWorkers() << " worker threads" << endl;
+    BenchResult assimp = runBench(iterations, [&](vector<MeshData> &meshData) {
+        return Model::ImportAssimp(path, importFlags, meshData);
+    });
+    printResult("assimp", assimp);
+    BenchResult native = runBench(iterations, [&](vector<MeshData> &meshData) {
+        ObjLoader loader(true);
+        return loader.Load(path, meshData);
+    });
+    printResult("native", native);
+    cout << "speedup: " << assimp.best / native.best << "x" << endl;
+    return 0;
+}
@@ -0,0 +1,134 @@
+//
+//  obj_loader_test.cpp
+//  Window
+//
+//  Created by William Goniprow on 2/28/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+//  Checks that the native OBJ loader resolves relative (negative) face indices that reach back into
+//  earlier chunks of the file. Each case writes the same geometry with absolute and with relative indices,
+//  big enough to be cut into several 64 KB chunks, and both have to load into identical meshes.
+//  No GL is touched. Build from Window/Window:
+//    c++ -std=c++14 -O2 ../Tests/obj_loader_test.cpp glad.c -lpthread -o obj_loader_test
+//  and run from the same directory, --workers N sizes the job system the chunks are parsed on:
+//    ./obj_loader_test
+//
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+
+#include "../Window/obj_loader.h"
+
+// Triangles with their own three vertices each, written right before the face (v/v/v/f -3 -2 -1)
+string interleavedObj(unsigned int triangles, bool relative) {
+    ostringstream obj;
+    for(unsigned int t = 0; t < triangles; t++) {
+        obj << "v " << t << ".0 0.0 0.0\nv " << t << ".0 1.0 0.0\nv " << t << ".0 0.0 1.0\n";
+        if(relative)
+            obj << "f -3 -2 -1\n";
+        else
+            obj << "f " << t * 3 + 1 << " " << t * 3 + 2 << " " << t * 3 + 3 << "\n";
+    }
+    return obj.str();
+}
+
+// All vertices, texcoords and normals first, then faces whose relative indices reach back over every chunk
+string vertexBlockObj(unsigned int triangles, bool relative) {
+    ostringstream obj;
+    const unsigned int numVertices = triangles + 2;
+    for(unsigned int v = 0; v < numVertices; v++) {
+        obj << "v " << v << ".5 " << v % 7 << ".25 -" << v % 13 << ".0\n";
+        obj << "vt 0." << v % 10 << " 0." << v % 9 << "\n";
+        obj << "vn 0.0 " << (v % 2 ? "1.0" : "-1.0") << " 0.0\n";
+    }
+    obj << "o strip\n";
+    for(unsigned int t = 0; t < triangles; t++) {
+        obj << "f";
+        for(unsigned int c = 0; c < 3; c++) {
+            const int index = relative ? (int)(t + c) - (int)numVertices : (int)(t + c) + 1;
+            obj << " " << index << "/" << index << "/" << index;
+        }
+        obj << "\n";
+    }
+    return obj.str();
+}
+
+bool loadObj(const string &path, const string &contents, vector<MeshData> &meshes, string &error) {
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    out << contents;
+    out.close();
+    ObjLoader loader;
+    bool loaded = loader.Load(path, meshes);
+    error = loader.GetErrorString();
+    remove(path.c_str());
+    return loaded;
+}
+
+bool sameMeshes(const vector<MeshData> &a, const vector<MeshData> &b) {
+    if(a.size() != b.size())
+        return false;
+    for(unsigned int i = 0; i < a.size(); i++) {
+        if(a[i].indices != b[i].indices || a[i].vertices.size() != b[i].vertices.size())
+            return false;
+        if(!a[i].vertices.empty() && memcmp(&a[i].vertices[0], &b[i].vertices[0], a[i].vertices.size() * sizeof(Vertex)) != 0)
+            return false;
+    }
+    return true;
+}
+
+bool runCase(const char *name, string (*write)(unsigned int, bool), unsigned int triangles) {
+    const string absoluteObj = write(triangles, false), relativeObj = write(triangles, true);
+    vector<MeshData> absolute, relative;
+    string error;
+    bool passed = true;
+    if(!loadObj("obj_loader_test_absolute.obj", absoluteObj, absolute, error)) {
+        cout << "  absolute indices failed to load: " << error << endl;
+        passed = false;
+    }
+    if(!loadObj("obj_loader_test_relative.obj", relativeObj, relative, error)) {
+        cout << "  relative indices failed to load: " << error << endl;
+        passed = false;
+    }
+    size_t indices = 0;
+    for(unsigned int i = 0; i < relative.size(); i++) {
+        indices += relative[i].indices.size();
+    }
+    if(passed && (indices != triangles * 3 || !sameMeshes(absolute, relative))) {
+        cout << "  relative indices load different meshes than absolute ones" << endl;
+        passed = false;
+    }
+    cout << (passed ? "PASS " : "FAIL ") << name << ": " << (relativeObj.size() >> 10) << " KB, " << indices << " indices" << endl;
+    return passed;
+}
+
+// A relative index before the first vertex still has to be rejected
+bool runOutOfRangeCase() {
+    vector<MeshData> meshes;
+    string error;
+    const bool passed = !loadObj("obj_loader_test_range.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf -4 -2 -1\n", meshes, error);
+    cout << (passed ? "PASS " : "FAIL ") << "relative index before the start of the file" << endl;
+    return passed;
+}
+
+// Indices that don't fit in an int have to fail the load instead of wrapping around
+bool runOverflowCase() {
+    vector<MeshData> meshes;
+    string error;
+    const bool passed = !loadObj("obj_loader_test_overflow.obj", "v 0 0 0\nv 1 0 0\nv 0 1 0\nf 1 2 99999999999\nf 1 2 -4294967299\n", meshes, error);
+    cout << (passed ? "PASS " : "FAIL ") << "index that overflows an int" << endl;
+    return passed;
+}
+
+int main(int argc, char **argv) {
+    JobWorkerSetting() = ParseJobWorkers(argc, argv);
+    int failed = 0;
+    failed += !runCase("interleaved v/v/v/f -3 -2 -1", interleavedObj, 20000);
+    failed += !runCase("vertex block, faces reaching back over every chunk", vertexBlockObj, 20000);
+    failed += !runOutOfRangeCase();
+    failed += !runOverflowCase();
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,158 @@
+//
+//  ktx2convert.cpp
+//  Window
+//
+//  Created by William Goniprow on 2/27/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+//  Converts PNG/JPG images to .ktx2 files the texture loader maps and uploads without decoding anything.
+//  Mips are filtered and block compressed with the same code the loader runs, no GL is touched. Build from Window/Window:
+//    c++ -std=c++14 -O2 ../Tools/ktx2convert.cpp glad.c -lpthread -o ktx2convert
+//  adding -DKTX2_ZLIB -lz for --zlib. Run from the same directory:
+//    ./ktx2convert --format bc1 --quality high marble.jpg metal.png
+//  which writes marble.ktx2 and metal.ktx2. --format is auto (BC4 for one channel, BC3 with alpha, BC1 otherwise),
+//  rgba (uncompressed, keeps the channel count), bc1, bc3, bc4, bc5 or bc7. --quality fast|normal|high,
+//  --filter box|kaiser|lanczos, --linear for data textures, --no-mipmaps, --zlib to supercompress the levels.
+//
+#define STB_IMAGE_IMPLEMENTATION
+
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "../Window/stb_image.h"
+#include "../Window/ktx2.h"
+
+struct ConvertOptions {
+    string format;
+    Bc_Quality quality;
+    MipOptions mips;
+    bool mipmaps;
+    Ktx2_Supercompression supercompression;
+    ConvertOptions() : format("auto"), quality(BC_QUALITY_NORMAL), mipmaps(true), supercompression(KTX2_SUPERCOMPRESSION_NONE) {}
+};
+
+Bc_Format convertFormat(const string &name, const MipChain &chain) {
+    if(name == "bc1") return BC_FORMAT_BC1;
+    if(name == "bc3") return BC_FORMAT_BC3;
+    if(name == "bc4") return BC_FORMAT_BC4;
+    if(name == "bc5") return BC_FORMAT_BC5;
+    if(name == "bc7") return BC_FORMAT_BC7;
+    if(name == "auto") {
+        if(chain.channels == 1)
+            return BC_FORMAT_BC4;
+        return BcHasAlpha(chain.levels[0], chain.channels) ? BC_FORMAT_BC3 : BC_FORMAT_BC1;
+    }
+    return BC_FORMAT_NONE;
+}
+
+bool convertImage(const string &path, const ConvertOptions &options) {
+    chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+    int width, height, nrComponents;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
+    if(!data) {
+        cout << "ERROR::KTX2CONVERT::FILE_NOT_READ " << path << endl;
+        return false;
+    }
+    MipChain chain;
+    if(options.mipmaps) {
+        GenerateMipChain(data, width, height, nrComponents, options.mips, chain);
+    }
+    else {
+        chain.channels = nrComponents;
+        chain.levels.resize(1);
+        chain.levels[0].width = width;
+        chain.levels[0].height = height;
+        chain.levels[0].pixels.assign(data, data + (size_t)width * height * nrComponents);
+    }
+    stbi_image_free(data);
+
+    const string ktx2Path = path.substr(0, path.find_last_of('.')) + ".ktx2";
+    const Bc_Format format = convertFormat(options.format, chain);
+    BcImage image;
+    bool written;
+    if(format != BC_FORMAT_NONE) {
+        EncodeBc(chain, format, options.quality, image);
+        written = WriteKtx2(ktx2Path, image, options.supercompression);
+    }
+    else {
+        written = WriteKtx2(ktx2Path, chain, options.supercompression);
+    }
+    if(!written) {
+        cout << "ERROR::KTX2CONVERT::WRITE_FAILED " << ktx2Path << endl;
+        return false;
+    }
+
+    double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+    FILE *file = fopen(ktx2Path.c_str(), "rb");
+    long size = 0;
+    if(file) {
+        fseek(file, 0, SEEK_END);
+        size = ftell(file);
+        fclose(file);
+    }
+    cout << path << " -> " << ktx2Path << ": " << (format != BC_FORMAT_NONE ? BcFormatName(format) : "uncompressed") << " "
+         << width << "x" << height << ", " << chain.levels.size() << " levels, " << (size >> 10) << " KB";
+    if(format != BC_FORMAT_NONE)
+        cout << ", PSNR " << image.psnr << " dB";
+    cout << ", " << ms << " ms" << endl;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    JobWorkerSetting() = ParseJobWorkers(argc, argv);
+    ConvertOptions options;
+    vector<string> paths;
+    for(int i = 1; i < argc; i++) {
+        const bool hasValue = i + 1 < argc;
+        if(strcmp(argv[i], "--workers") == 0) {
+            i++;
+        }
+        else if(strcmp(argv[i], "--format") == 0 && hasValue) {
+            options.format = argv[++i];
+        }
+        else if(strcmp(argv[i], "--quality") == 0 && hasValue) {
+            i++;
+            if(strcmp(argv[i], "fast") == 0)
+                options.quality = BC_QUALITY_FAST;
+            else if(strcmp(argv[i], "high") == 0)
+                options.quality = BC_QUALITY_HIGH;
+        }
+        else if(strcmp(argv[i], "--filter") == 0 && hasValue) {
+            i++;
+            if(strcmp(argv[i], "kaiser") == 0)
+                options.mips.filter = MIP_FILTER_KAISER;
+            else if(strcmp(argv[i], "lanczos") == 0)
+                options.mips.filter = MIP_FILTER_LANCZOS;
+        }
+        else if(strcmp(argv[i], "--linear") == 0) {
+            options.mips.srgb = false;
+        }
+        else if(strcmp(argv[i], "--no-mipmaps") == 0) {
+            options.mipmaps = false;
+        }
+        else if(strcmp(argv[i], "--zlib") == 0) {
+            options.supercompression = KTX2_SUPERCOMPRESSION_ZLIB;
+        }
+        else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if(options.format != "auto" && options.format != "rgba" && convertFormat(options.format, MipChain()) == BC_FORMAT_NONE) {
+        cout << "ERROR::KTX2CONVERT::UNKNOWN_FORMAT " << options.format << endl;
+        return 1;
+    }
+    if(paths.empty()) {
+        cout << "usage: ktx2convert [--format auto|rgba|bc1|bc3|bc4|bc5|bc7] [--quality fast|normal|high] "
+                "[--filter box|kaiser|lanczos] [--linear] [--no-mipmaps] [--zlib] image..." << endl;
+        return 1;
+    }
+    int failed = 0;
+    for(unsigned int i = 0; i < paths.size(); i++) {
+        if(!convertImage(paths[i], options))
+            failed++;
+    }
+    return failed > 0 ? 1 : 0;
+}
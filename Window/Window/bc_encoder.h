@@ -0,0 +1,890 @@
+//
+//  bc_encoder.h
+//  Window
+//
+//  Created by William Goniprow on 2/26/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef bc_encoder_h
+#define bc_encoder_h
+
+#include <glad/glad.h>
+
+#include "gl_ext.h"
+#include "job_system.h"
+#include "mapped_file.h"
+#include "mipmap.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+const uint32_t BC_CACHE_MAGIC   = 0x544E4342; // "BCNT"
+const uint32_t BC_CACHE_VERSION = 1;
+// blocks an encode job works through at least
+const unsigned int BC_JOB_BLOCKS = 1024;
+
+enum Bc_Format {
+    BC_FORMAT_NONE,
+    BC_FORMAT_BC1, // RGB, 4 bits per texel
+    BC_FORMAT_BC3, // RGBA, BC1 color plus a BC4 alpha block, 8 bits per texel
+    BC_FORMAT_BC4, // one channel, 4 bits per texel, sampled as grey
+    BC_FORMAT_BC5, // two channels (tangent space normal x and y), 8 bits per texel
+    BC_FORMAT_BC7  // RGBA in mode 6 only, 8 bits per texel, needs GL 4.2 / ARB_texture_compression_bptc
+};
+
+enum Bc_Quality {
+    BC_QUALITY_FAST,   // bounding box endpoints
+    BC_QUALITY_NORMAL, // endpoints along the principal axis of the block
+    BC_QUALITY_HIGH    // principal axis refined by least squares against the chosen indices, every BC7 p-bit pair tried
+};
+
+struct BcLevel {
+    unsigned int width;
+    unsigned int height;
+    vector<unsigned char> blocks; // rows of 4x4 blocks, partial blocks at the right and bottom edges
+};
+
+struct BcImage {
+    Bc_Format format;
+    vector<BcLevel> levels;
+    double psnr; // of level 0 against the source over the channels the format keeps, in dB
+    BcImage() : format(BC_FORMAT_NONE), psnr(0.0) {}
+};
+
+struct TextureCompressionSettings {
+    bool enabled;
+    Bc_Quality quality;
+    bool bc7;    // color textures as BC7 instead of BC1/BC3 where the driver has it
+    bool report; // print size and PSNR per texture when it is uploaded
+    TextureCompressionSettings() : enabled(false), quality(BC_QUALITY_NORMAL), bc7(false), report(false) {}
+};
+
+// Encodes every level of chain on the job system, block rows split across the workers. No GL calls
+void EncodeBc(const MipChain &chain, Bc_Format format, Bc_Quality quality, BcImage &image);
+// Decodes one block to 16 RGBA texels, what the GPU would sample. Only mode 6 of BC7 is understood
+void DecodeBcBlock(Bc_Format format, const unsigned char *block, unsigned char rgba[64]);
+// Peak signal to noise ratio of encoded against source, in dB
+double BcPSNR(const MipLevel &source, unsigned int channels, Bc_Format format, const BcLevel &encoded);
+// Whether the context can sample format, GL thread or after LoadGLExtensions
+bool BcSupported(Bc_Format format);
+// Uploads every level into the bound GL_TEXTURE_2D
+void UploadBcImage(const BcImage &image);
+size_t BcImageBytes(const BcImage &image);
+// Whether any texel of level is less than opaque, BC1 would lose it
+bool BcHasAlpha(const MipLevel &level, unsigned int channels);
+const char *BcFormatName(Bc_Format format);
+// The image stored next to sourcePath ("<texture>.<settings>.bc"). settings is whatever the caller derived it from
+// (load options, quality), each gets its own file and one written for another version of the file is ignored
+bool ReadBcCache(const string &sourcePath, uint32_t settings, BcImage &image);
+bool WriteBcCache(const string &sourcePath, uint32_t settings, const BcImage &image);
+
+// Off unless --compress-textures is given
+TextureCompressionSettings &TextureCompression() {
+    static TextureCompressionSettings settings;
+    return settings;
+}
+
+// --compress-textures [fast|normal|high] --bc7 --bc-report
+TextureCompressionSettings ParseTextureCompression(int argc, char **argv) {
+    TextureCompressionSettings settings;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--compress-textures") == 0) {
+            settings.enabled = true;
+            if(i + 1 < argc && strcmp(argv[i + 1], "fast") == 0)
+                settings.quality = BC_QUALITY_FAST;
+            else if(i + 1 < argc && strcmp(argv[i + 1], "high") == 0)
+                settings.quality = BC_QUALITY_HIGH;
+        }
+        else if(strcmp(argv[i], "--bc7") == 0)
+            settings.bc7 = true;
+        else if(strcmp(argv[i], "--bc-report") == 0)
+            settings.report = true;
+    }
+    return settings;
+}
+
+struct BcCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t settings;
+    uint32_t format;
+    int64_t  sourceMTime;
+    uint64_t sourceSize;
+    uint32_t width;
+    uint32_t height;
+    uint32_t numLevels;
+    float    psnr;
+};
+
+// One 4x4 block as floats in 0..255, channels per texel
+struct BcTexels {
+    unsigned int channels;
+    float texel[16][4];
+};
+
+// Endpoints as a format stores them and the palette they decode to
+struct BcEndpoints {
+    int e0[4];
+    int e1[4];
+    int p0, p1;           // BC7 p-bits
+    unsigned int count;   // palette entries
+    float palette[16][4];
+};
+
+// quantizes float endpoints to the format, pbits picks the BC7 p-bit pair (0-3) or the closest when -1
+typedef void (*BcQuantize)(const float lo[4], const float hi[4], unsigned int channels, int pbits, BcEndpoints &endpoints);
+
+// What a block format needs for fitting: where each palette entry sits between the endpoints, and its quantizer
+struct BcCodec {
+    unsigned int count;
+    float weight[16];
+    BcQuantize quantize;
+    int pbitVariants; // p-bit pairs worth trying at high quality, 0 without p-bits
+};
+
+unsigned int BcBlockBytes(Bc_Format format) {
+    return format == BC_FORMAT_BC1 || format == BC_FORMAT_BC4 ? 8 : 16;
+}
+
+size_t bcLevelBytes(Bc_Format format, unsigned int width, unsigned int height) {
+    return (size_t)((width + 3) / 4) * ((height + 3) / 4) * BcBlockBytes(format);
+}
+
+const char *BcFormatName(Bc_Format format) {
+    switch(format) {
+        case BC_FORMAT_BC1: return "BC1";
+        case BC_FORMAT_BC3: return "BC3";
+        case BC_FORMAT_BC4: return "BC4";
+        case BC_FORMAT_BC5: return "BC5";
+        case BC_FORMAT_BC7: return "BC7";
+        default:            return "uncompressed";
+    }
+}
+
+GLenum bcGLFormat(Bc_Format format) {
+    switch(format) {
+        case BC_FORMAT_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case BC_FORMAT_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case BC_FORMAT_BC4: return GL_COMPRESSED_RED_RGTC1;
+        case BC_FORMAT_BC5: return GL_COMPRESSED_RG_RGTC2;
+        case BC_FORMAT_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default:            return GL_NONE;
+    }
+}
+
+bool BcSupported(Bc_Format format) {
+    switch(format) {
+        case BC_FORMAT_BC1:
+        case BC_FORMAT_BC3: return GLExt().textureS3TC;
+        case BC_FORMAT_BC4:
+        case BC_FORMAT_BC5: return true; // RGTC is core since 3.0
+        case BC_FORMAT_BC7: return GLExt().textureBPTC;
+        default:            return false;
+    }
+}
+
+// The values a format keeps for one source texel: RGBA for the color formats, luma for BC4, x and y for BC5
+void bcSourceTexel(const unsigned char *p, unsigned int channels, Bc_Format format, float out[4]) {
+    float rgba[4];
+    if(channels <= 2) {
+        rgba[0] = rgba[1] = rgba[2] = p[0];
+        rgba[3] = channels == 2 ? p[1] : 255.0f;
+    }
+    else {
+        rgba[0] = p[0];
+        rgba[1] = p[1];
+        rgba[2] = p[2];
+        rgba[3] = channels == 4 ? p[3] : 255.0f;
+    }
+    if(format == BC_FORMAT_BC4) {
+        out[0] = channels <= 2 ? rgba[0] : floorf((rgba[0] * 77.0f + rgba[1] * 150.0f + rgba[2] * 29.0f + 128.0f) / 256.0f);
+        out[1] = out[2] = 0.0f;
+        out[3] = 255.0f;
+    }
+    else if(format == BC_FORMAT_BC5) {
+        out[0] = rgba[0];
+        out[1] = channels <= 2 ? rgba[0] : rgba[1];
+        out[2] = 0.0f;
+        out[3] = 255.0f;
+    }
+    else {
+        memcpy(out, rgba, sizeof(rgba));
+    }
+}
+
+// texels past the edges of the level repeat the last row and column
+void bcFetchBlock(const MipLevel &level, unsigned int channels, Bc_Format format, unsigned int bx, unsigned int by, float out[16][4]) {
+    for(unsigned int y = 0; y < 4; y++) {
+        unsigned int sy = min(by * 4 + y, level.height - 1);
+        for(unsigned int x = 0; x < 4; x++) {
+            unsigned int sx = min(bx * 4 + x, level.width - 1);
+            bcSourceTexel(&level.pixels[((size_t)sy * level.width + sx) * channels], channels, format, out[y * 4 + x]);
+        }
+    }
+}
+
+void bcBoundingBox(const BcTexels &block, float lo[4], float hi[4]) {
+    const unsigned int n = block.channels;
+    float mean[4] = { 0, 0, 0, 0 };
+    for(unsigned int c = 0; c < n; c++) {
+        lo[c] = 255.0f;
+        hi[c] = 0.0f;
+        for(unsigned int i = 0; i < 16; i++) {
+            lo[c] = min(lo[c], block.texel[i][c]);
+            hi[c] = max(hi[c], block.texel[i][c]);
+            mean[c] += block.texel[i][c] / 16.0f;
+        }
+    }
+    // the box diagonal runs the wrong way for channels that fall while the widest one rises
+    unsigned int widest = 0;
+    for(unsigned int c = 1; c < n; c++) {
+        if(hi[c] - lo[c] > hi[widest] - lo[widest])
+            widest = c;
+    }
+    for(unsigned int c = 0; c < n; c++) {
+        float covariance = 0.0f;
+        for(unsigned int i = 0; i < 16; i++) {
+            covariance += (block.texel[i][c] - mean[c]) * (block.texel[i][widest] - mean[widest]);
+        }
+        if(covariance < 0.0f)
+            swap(lo[c], hi[c]);
+    }
+}
+
+void bcPrincipalAxis(const BcTexels &block, float lo[4], float hi[4]) {
+    const unsigned int n = block.channels;
+    float mean[4] = { 0, 0, 0, 0 };
+    for(unsigned int i = 0; i < 16; i++) {
+        for(unsigned int c = 0; c < n; c++) {
+            mean[c] += block.texel[i][c] / 16.0f;
+        }
+    }
+    float covariance[4][4] = {{ 0 }};
+    for(unsigned int i = 0; i < 16; i++) {
+        for(unsigned int a = 0; a < n; a++) {
+            for(unsigned int b = 0; b < n; b++) {
+                covariance[a][b] += (block.texel[i][a] - mean[a]) * (block.texel[i][b] - mean[b]);
+            }
+        }
+    }
+    // power iteration from the bounding box diagonal converges in a handful of steps for 16 points
+    float axis[4];
+    bcBoundingBox(block, lo, hi);
+    for(unsigned int c = 0; c < n; c++) {
+        axis[c] = hi[c] - lo[c];
+    }
+    for(int step = 0; step < 8; step++) {
+        float next[4] = { 0, 0, 0, 0 };
+        float length = 0.0f;
+        for(unsigned int a = 0; a < n; a++) {
+            for(unsigned int b = 0; b < n; b++) {
+                next[a] += covariance[a][b] * axis[b];
+            }
+            length += next[a] * next[a];
+        }
+        if(length < 1e-12f)
+            break;
+        length = 1.0f / sqrtf(length);
+        for(unsigned int c = 0; c < n; c++) {
+            axis[c] = next[c] * length;
+        }
+    }
+    float length = 0.0f;
+    for(unsigned int c = 0; c < n; c++) {
+        length += axis[c] * axis[c];
+    }
+    if(length < 1e-12f) {
+        // flat block
+        for(unsigned int c = 0; c < n; c++) {
+            lo[c] = hi[c] = mean[c];
+        }
+        return;
+    }
+    length = 1.0f / sqrtf(length);
+    float minimum = 1e30f, maximum = -1e30f;
+    for(unsigned int i = 0; i < 16; i++) {
+        float t = 0.0f;
+        for(unsigned int c = 0; c < n; c++) {
+            t += (block.texel[i][c] - mean[c]) * axis[c] * length;
+        }
+        minimum = min(minimum, t);
+        maximum = max(maximum, t);
+    }
+    for(unsigned int c = 0; c < n; c++) {
+        lo[c] = min(max(mean[c] + axis[c] * length * minimum, 0.0f), 255.0f);
+        hi[c] = min(max(mean[c] + axis[c] * length * maximum, 0.0f), 255.0f);
+    }
+}
+
+// nearest palette entry for every texel, returns the summed squared error
+float bcAssign(const BcTexels &block, const BcEndpoints &endpoints, unsigned char index[16]) {
+    float total = 0.0f;
+    for(unsigned int i = 0; i < 16; i++) {
+        float best = 1e30f;
+        for(unsigned int p = 0; p < endpoints.count; p++) {
+            float error = 0.0f;
+            for(unsigned int c = 0; c < block.channels; c++) {
+                float d = block.texel[i][c] - endpoints.palette[p][c];
+                error += d * d;
+            }
+            if(error < best) {
+                best = error;
+                index[i] = (unsigned char)p;
+            }
+        }
+        total += best;
+    }
+    return total;
+}
+
+// endpoints that minimize the squared error for fixed indices, false if the indices don't pin them down
+bool bcLeastSquares(const BcTexels &block, const BcCodec &codec, const unsigned char index[16], float lo[4], float hi[4]) {
+    float a = 0.0f, b = 0.0f, c = 0.0f, x[4] = { 0, 0, 0, 0 }, y[4] = { 0, 0, 0, 0 };
+    for(unsigned int i = 0; i < 16; i++) {
+        float t = codec.weight[index[i]];
+        a += (1.0f - t) * (1.0f - t);
+        b += t * (1.0f - t);
+        c += t * t;
+        for(unsigned int ch = 0; ch < block.channels; ch++) {
+            x[ch] += (1.0f - t) * block.texel[i][ch];
+            y[ch] += t * block.texel[i][ch];
+        }
+    }
+    float det = a * c - b * b;
+    if(fabsf(det) < 1e-6f)
+        return false;
+    for(unsigned int ch = 0; ch < block.channels; ch++) {
+        lo[ch] = min(max((c * x[ch] - b * y[ch]) / det, 0.0f), 255.0f);
+        hi[ch] = min(max((a * y[ch] - b * x[ch]) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+// Endpoints and indices for one block, the fit gets more thorough with quality
+float bcFit(const BcTexels &block, const BcCodec &codec, Bc_Quality quality, BcEndpoints &best, unsigned char index[16]) {
+    float lo[4] = { 0, 0, 0, 0 }, hi[4] = { 0, 0, 0, 0 };
+    if(quality == BC_QUALITY_FAST)
+        bcBoundingBox(block, lo, hi);
+    else
+        bcPrincipalAxis(block, lo, hi);
+    // pull the endpoints in a little, the extremes are rarely worth a whole palette entry each
+    for(unsigned int c = 0; c < block.channels; c++) {
+        float inset = (hi[c] - lo[c]) / (4.0f * codec.count);
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+    codec.quantize(lo, hi, block.channels, -1, best);
+    float bestError = bcAssign(block, best, index);
+    if(quality != BC_QUALITY_HIGH || bestError == 0.0f)
+        return bestError;
+
+    BcEndpoints candidate;
+    unsigned char candidateIndex[16];
+    for(int step = 0; step < 2; step++) {
+        if(!bcLeastSquares(block, codec, index, lo, hi))
+            break;
+        codec.quantize(lo, hi, block.channels, -1, candidate);
+        float error = bcAssign(block, candidate, candidateIndex);
+        if(error >= bestError)
+            break;
+        bestError = error;
+        best = candidate;
+        memcpy(index, candidateIndex, 16);
+    }
+    for(int pbits = 0; pbits < codec.pbitVariants; pbits++) {
+        codec.quantize(lo, hi, block.channels, pbits, candidate);
+        float error = bcAssign(block, candidate, candidateIndex);
+        if(error < bestError) {
+            bestError = error;
+            best = candidate;
+            memcpy(index, candidateIndex, 16);
+        }
+    }
+    return bestError;
+}
+
+/* BC1 color */
+
+int bcPack565(const float color[4]) {
+    int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+    int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (r << 11) | (g << 5) | b;
+}
+
+void bcUnpack565(int packed, float color[4]) {
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (float)((r << 3) | (r >> 2));
+    color[1] = (float)((g << 2) | (g >> 4));
+    color[2] = (float)((b << 3) | (b >> 2));
+    color[3] = 255.0f;
+}
+
+void bcQuantizeColor(const float lo[4], const float hi[4], unsigned int, int, BcEndpoints &endpoints) {
+    endpoints.count = 4;
+    endpoints.e0[0] = bcPack565(lo);
+    endpoints.e1[0] = bcPack565(hi);
+    bcUnpack565(endpoints.e0[0], endpoints.palette[0]);
+    bcUnpack565(endpoints.e1[0], endpoints.palette[1]);
+    for(unsigned int c = 0; c < 4; c++) {
+        endpoints.palette[2][c] = (2.0f * endpoints.palette[0][c] + endpoints.palette[1][c]) / 3.0f;
+        endpoints.palette[3][c] = (endpoints.palette[0][c] + 2.0f * endpoints.palette[1][c]) / 3.0f;
+    }
+}
+
+const BcCodec BC_COLOR_CODEC = { 4, { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f }, bcQuantizeColor, 0 };
+
+void bcEncodeColorBlock(float texels[16][4], Bc_Quality quality, unsigned char *out) {
+    BcTexels block;
+    block.channels = 3;
+    memcpy(block.texel, texels, sizeof(block.texel));
+    BcEndpoints endpoints;
+    unsigned char index[16];
+    bcFit(block, BC_COLOR_CODEC, quality, endpoints, index);
+    int c0 = endpoints.e0[0], c1 = endpoints.e1[0];
+    // four color mode needs c0 > c1, swapping the endpoints swaps entries 0/1 and 2/3
+    if(c0 < c1) {
+        swap(c0, c1);
+        for(unsigned int i = 0; i < 16; i++) {
+            index[i] ^= 1;
+        }
+    }
+    else if(c0 == c1) {
+        // reads as three color mode, where entry 3 would be transparent
+        memset(index, 0, sizeof(index));
+    }
+    uint32_t bits = 0;
+    for(unsigned int i = 0; i < 16; i++) {
+        bits |= (uint32_t)index[i] << (i * 2);
+    }
+    out[0] = c0 & 0xFF;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF;
+    out[3] = c1 >> 8;
+    memcpy(out + 4, &bits, 4); // little endian
+}
+
+/* BC4 single channel, also the alpha of BC3 and both halves of BC5 */
+
+// a0 > a1 interpolates six values between them, otherwise four with 0 and 255 added at the end
+void bcChannelPalette(int a0, int a1, float palette[16][4]) {
+    palette[0][0] = (float)a0;
+    palette[1][0] = (float)a1;
+    if(a0 > a1) {
+        for(int i = 2; i < 8; i++) {
+            palette[i][0] = (float)(((8 - i) * a0 + (i - 1) * a1) / 7);
+        }
+    }
+    else {
+        for(int i = 2; i < 6; i++) {
+            palette[i][0] = (float)(((6 - i) * a0 + (i - 1) * a1) / 5);
+        }
+        palette[6][0] = 0.0f;
+        palette[7][0] = 255.0f;
+    }
+}
+
+void bcQuantizeChannel(const float lo[4], const float hi[4], unsigned int, int, BcEndpoints &endpoints) {
+    // the encoder always wants the eight value mode, equal endpoints fall into the other one harmlessly
+    endpoints.e0[0] = (int)(max(hi[0], lo[0]) + 0.5f);
+    endpoints.e1[0] = (int)(min(hi[0], lo[0]) + 0.5f);
+    endpoints.count = 8;
+    bcChannelPalette(endpoints.e0[0], endpoints.e1[0], endpoints.palette);
+}
+
+const BcCodec BC_CHANNEL_CODEC = { 8, { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f }, bcQuantizeChannel, 0 };
+
+void bcEncodeChannelBlock(float texels[16][4], unsigned int channel, Bc_Quality quality, unsigned char *out) {
+    BcTexels block;
+    block.channels = 1;
+    for(unsigned int i = 0; i < 16; i++) {
+        block.texel[i][0] = texels[i][channel];
+    }
+    BcEndpoints endpoints;
+    unsigned char index[16];
+    bcFit(block, BC_CHANNEL_CODEC, quality, endpoints, index);
+    out[0] = (unsigned char)endpoints.e0[0];
+    out[1] = (unsigned char)endpoints.e1[0];
+    uint64_t bits = 0;
+    for(unsigned int i = 0; i < 16; i++) {
+        bits |= (uint64_t)index[i] << (i * 3);
+    }
+    for(unsigned int i = 0; i < 6; i++) {
+        out[2 + i] = (unsigned char)(bits >> (i * 8));
+    }
+}
+
+/* BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a p-bit each, 4 bit indices */
+
+const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// the 7 bit value and p-bit closest to v for a given p-bit, as the 8 bit value they expand to
+int bc7Quantize(float v, int pbit, int &value) {
+    value = min(max((int)((v - pbit) / 2.0f + 0.5f), 0), 127);
+    return (value << 1) | pbit;
+}
+
+// The 7 bit endpoint for color and the 8 bit values it expands to with pbit, or with whichever p-bit
+// lands closer over all four channels when pbit is -1. Returns the p-bit used
+int bc7Endpoint(const float color[4], int pbit, int e[4], int expanded[4]) {
+    if(pbit < 0) {
+        float error[2] = { 0.0f, 0.0f };
+        for(int p = 0; p < 2; p++) {
+            for(int c = 0; c < 4; c++) {
+                int value;
+                float d = bc7Quantize(color[c], p, value) - color[c];
+                error[p] += d * d;
+            }
+        }
+        pbit = error[1] < error[0] ? 1 : 0;
+    }
+    for(int c = 0; c < 4; c++) {
+        expanded[c] = bc7Quantize(color[c], pbit, e[c]);
+    }
+    return pbit;
+}
+
+void bcQuantizeBC7(const float lo[4], const float hi[4], unsigned int, int pbits, BcEndpoints &endpoints) {
+    int expanded0[4], expanded1[4];
+    endpoints.p0 = bc7Endpoint(lo, pbits < 0 ? -1 : (pbits & 1), endpoints.e0, expanded0);
+    endpoints.p1 = bc7Endpoint(hi, pbits < 0 ? -1 : (pbits >> 1), endpoints.e1, expanded1);
+    endpoints.count = 16;
+    for(int i = 0; i < 16; i++) {
+        for(int c = 0; c < 4; c++) {
+            endpoints.palette[i][c] = (float)(((64 - BC7_WEIGHTS[i]) * expanded0[c] + BC7_WEIGHTS[i] * expanded1[c] + 32) >> 6);
+        }
+    }
+}
+
+const BcCodec BC7_CODEC = {
+    16,
+    { 0.0f, 4 / 64.0f, 9 / 64.0f, 13 / 64.0f, 17 / 64.0f, 21 / 64.0f, 26 / 64.0f, 30 / 64.0f,
+      34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f, 51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 1.0f },
+    bcQuantizeBC7,
+    4
+};
+
+// 128 bits written from the lowest up
+struct BcBitWriter {
+    unsigned char *out;
+    unsigned int bit;
+    void Put(uint32_t value, unsigned int bits) {
+        for(unsigned int i = 0; i < bits; i++, bit++) {
+            if(value & (1u << i))
+                out[bit >> 3] |= (unsigned char)(1 << (bit & 7));
+        }
+    }
+};
+
+void bcEncodeBC7Block(float texels[16][4], Bc_Quality quality, unsigned char *out) {
+    BcTexels block;
+    block.channels = 4;
+    memcpy(block.texel, texels, sizeof(block.texel));
+    BcEndpoints endpoints;
+    unsigned char index[16];
+    bcFit(block, BC7_CODEC, quality, endpoints, index);
+    // the first texel's index is stored without its top bit, which has to be 0
+    if(index[0] & 8) {
+        swap(endpoints.e0, endpoints.e1);
+        swap(endpoints.p0, endpoints.p1);
+        for(unsigned int i = 0; i < 16; i++) {
+            index[i] = 15 - index[i];
+        }
+    }
+    memset(out, 0, 16);
+    BcBitWriter writer = { out, 0 };
+    writer.Put(1 << 6, 7); // mode 6
+    for(int c = 0; c < 4; c++) {
+        writer.Put(endpoints.e0[c], 7);
+        writer.Put(endpoints.e1[c], 7);
+    }
+    writer.Put(endpoints.p0, 1);
+    writer.Put(endpoints.p1, 1);
+    writer.Put(index[0], 3);
+    for(unsigned int i = 1; i < 16; i++) {
+        writer.Put(index[i], 4);
+    }
+}
+
+void bcEncodeBlock(Bc_Format format, float texels[16][4], Bc_Quality quality, unsigned char *out) {
+    switch(format) {
+        case BC_FORMAT_BC1:
+            bcEncodeColorBlock(texels, quality, out);
+            break;
+        case BC_FORMAT_BC3:
+            bcEncodeChannelBlock(texels, 3, quality, out);
+            bcEncodeColorBlock(texels, quality, out + 8);
+            break;
+        case BC_FORMAT_BC4:
+            bcEncodeChannelBlock(texels, 0, quality, out);
+            break;
+        case BC_FORMAT_BC5:
+            bcEncodeChannelBlock(texels, 0, quality, out);
+            bcEncodeChannelBlock(texels, 1, quality, out + 8);
+            break;
+        case BC_FORMAT_BC7:
+            bcEncodeBC7Block(texels, quality, out);
+            break;
+        default:
+            break;
+    }
+}
+
+void bcEncodeLevel(const MipLevel &level, unsigned int channels, Bc_Format format, Bc_Quality quality, BcLevel &encoded) {
+    const unsigned int blocksWide = (level.width + 3) / 4, blocksHigh = (level.height + 3) / 4;
+    const unsigned int blockBytes = BcBlockBytes(format);
+    encoded.width = level.width;
+    encoded.height = level.height;
+    encoded.blocks.resize((size_t)blocksWide * blocksHigh * blockBytes);
+    Jobs().ParallelFor(blocksHigh, max(1u, BC_JOB_BLOCKS / blocksWide), [&](unsigned int begin, unsigned int end) {
+        float texels[16][4];
+        for(unsigned int by = begin; by < end; by++) {
+            for(unsigned int bx = 0; bx < blocksWide; bx++) {
+                bcFetchBlock(level, channels, format, bx, by, texels);
+                bcEncodeBlock(format, texels, quality, &encoded.blocks[((size_t)by * blocksWide + bx) * blockBytes]);
+            }
+        }
+    });
+}
+
+void EncodeBc(const MipChain &chain, Bc_Format format, Bc_Quality quality, BcImage &image) {
+    image.format = format;
+    image.levels.resize(chain.levels.size());
+    for(unsigned int i = 0; i < chain.levels.size(); i++) {
+        bcEncodeLevel(chain.levels[i], chain.channels, format, quality, image.levels[i]);
+    }
+    image.psnr = chain.levels.empty() ? 0.0 : BcPSNR(chain.levels[0], chain.channels, format, image.levels[0]);
+}
+
+void bcDecodeColor(const unsigned char *block, bool fourColor, unsigned char rgba[64]) {
+    int c0 = block[0] | (block[1] << 8), c1 = block[2] | (block[3] << 8);
+    float palette[4][4];
+    bcUnpack565(c0, palette[0]);
+    bcUnpack565(c1, palette[1]);
+    for(int c = 0; c < 3; c++) {
+        if(fourColor || c0 > c1) {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        else {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+            palette[3][c] = 0.0f;
+        }
+    }
+    palette[2][3] = 255.0f;
+    palette[3][3] = fourColor || c0 > c1 ? 255.0f : 0.0f;
+    uint32_t bits;
+    memcpy(&bits, block + 4, 4);
+    for(int i = 0; i < 16; i++) {
+        const float *color = palette[(bits >> (i * 2)) & 3];
+        for(int c = 0; c < 4; c++) {
+            rgba[i * 4 + c] = (unsigned char)(color[c] + 0.5f);
+        }
+    }
+}
+
+void bcDecodeChannel(const unsigned char *block, unsigned char rgba[64], int channel) {
+    float palette[16][4];
+    bcChannelPalette(block[0], block[1], palette);
+    uint64_t bits = 0;
+    for(int i = 0; i < 6; i++) {
+        bits |= (uint64_t)block[2 + i] << (i * 8);
+    }
+    for(int i = 0; i < 16; i++) {
+        rgba[i * 4 + channel] = (unsigned char)palette[(bits >> (i * 3)) & 7][0];
+    }
+}
+
+void bcDecodeBC7(const unsigned char *block, unsigned char rgba[64]) {
+    unsigned int bit = 0;
+    const auto take = [&](unsigned int bits) {
+        uint32_t value = 0;
+        for(unsigned int i = 0; i < bits; i++, bit++) {
+            value |= (uint32_t)((block[bit >> 3] >> (bit & 7)) & 1) << i;
+        }
+        return value;
+    };
+    if(take(7) != (1u << 6)) {
+        // not mode 6, show it rather than guess
+        for(int i = 0; i < 16; i++) {
+            rgba[i * 4 + 0] = 255; rgba[i * 4 + 1] = 0; rgba[i * 4 + 2] = 255; rgba[i * 4 + 3] = 255;
+        }
+        return;
+    }
+    int e0[4], e1[4];
+    for(int c = 0; c < 4; c++) {
+        e0[c] = (int)take(7) << 1;
+        e1[c] = (int)take(7) << 1;
+    }
+    int p0 = (int)take(1), p1 = (int)take(1);
+    for(int c = 0; c < 4; c++) {
+        e0[c] |= p0;
+        e1[c] |= p1;
+    }
+    for(int i = 0; i < 16; i++) {
+        int index = (int)take(i == 0 ? 3 : 4);
+        for(int c = 0; c < 4; c++) {
+            rgba[i * 4 + c] = (unsigned char)(((64 - BC7_WEIGHTS[index]) * e0[c] + BC7_WEIGHTS[index] * e1[c] + 32) >> 6);
+        }
+    }
+}
+
+void DecodeBcBlock(Bc_Format format, const unsigned char *block, unsigned char rgba[64]) {
+    for(int i = 0; i < 16; i++) {
+        rgba[i * 4 + 0] = rgba[i * 4 + 1] = rgba[i * 4 + 2] = 0;
+        rgba[i * 4 + 3] = 255;
+    }
+    switch(format) {
+        case BC_FORMAT_BC1:
+            bcDecodeColor(block, false, rgba);
+            break;
+        case BC_FORMAT_BC3:
+            bcDecodeColor(block + 8, true, rgba);
+            bcDecodeChannel(block, rgba, 3);
+            break;
+        case BC_FORMAT_BC4:
+            bcDecodeChannel(block, rgba, 0);
+            break;
+        case BC_FORMAT_BC5:
+            bcDecodeChannel(block, rgba, 0);
+            bcDecodeChannel(block + 8, rgba, 1);
+            break;
+        case BC_FORMAT_BC7:
+            bcDecodeBC7(block, rgba);
+            break;
+        default:
+            break;
+    }
+}
+
+double BcPSNR(const MipLevel &source, unsigned int channels, Bc_Format format, const BcLevel &encoded) {
+    // BC1 keeps no alpha, BC4 one channel and BC5 two
+    unsigned int compared = format == BC_FORMAT_BC1 ? 3 : format == BC_FORMAT_BC4 ? 1 : format == BC_FORMAT_BC5 ? 2 : 4;
+    const unsigned int blocksWide = (source.width + 3) / 4, blocksHigh = (source.height + 3) / 4;
+    const unsigned int blockBytes = BcBlockBytes(format);
+    double squared = 0.0;
+    float texels[16][4];
+    unsigned char decoded[64];
+    for(unsigned int by = 0; by < blocksHigh; by++) {
+        for(unsigned int bx = 0; bx < blocksWide; bx++) {
+            bcFetchBlock(source, channels, format, bx, by, texels);
+            DecodeBcBlock(format, &encoded.blocks[((size_t)by * blocksWide + bx) * blockBytes], decoded);
+            // texels past the edges were only padding
+            for(unsigned int i = 0; i < 16; i++) {
+                if(bx * 4 + i % 4 >= source.width || by * 4 + i / 4 >= source.height)
+                    continue;
+                for(unsigned int c = 0; c < compared; c++) {
+                    double d = texels[i][c] - decoded[i * 4 + c];
+                    squared += d * d;
+                }
+            }
+        }
+    }
+    double mse = squared / ((double)source.width * source.height * compared);
+    return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+void UploadBcImage(const BcImage &image) {
+    const GLenum format = bcGLFormat(image.format);
+    for(unsigned int i = 0; i < image.levels.size(); i++) {
+        const BcLevel &level = image.levels[i];
+        glCompressedTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, (GLsizei)level.blocks.size(), &level.blocks[0]);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image.levels.empty() ? 0 : (GLint)image.levels.size() - 1);
+    // BC4 holds a single channel, sample it as grey like the RGB texture it replaces
+    const GLint grey = image.format == BC_FORMAT_BC4 ? GL_RED : GL_GREEN;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, grey);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, image.format == BC_FORMAT_BC4 ? GL_RED : GL_BLUE);
+}
+
+bool BcHasAlpha(const MipLevel &level, unsigned int channels) {
+    if(channels != 2 && channels != 4)
+        return false;
+    for(size_t i = channels - 1; i < level.pixels.size(); i += channels) {
+        if(level.pixels[i] != 255)
+            return true;
+    }
+    return false;
+}
+
+size_t BcImageBytes(const BcImage &image) {
+    size_t bytes = 0;
+    for(unsigned int i = 0; i < image.levels.size(); i++) {
+        bytes += image.levels[i].blocks.size();
+    }
+    return bytes;
+}
+
+// settings in hex, e.g. marble.jpg.10000.bc
+static string bcCachePath(const string &sourcePath, uint32_t settings) {
+    char key[16];
+    snprintf(key, sizeof(key), ".%x.bc", settings);
+    return sourcePath + key;
+}
+
+bool ReadBcCache(const string &sourcePath, uint32_t settings, BcImage &image) {
+    int64_t mtime;
+    uint64_t size;
+    MappedFile file;
+    if(!StatFile(sourcePath, mtime, size) || !file.Open(bcCachePath(sourcePath, settings)) || file.Size() < sizeof(BcCacheHeader))
+        return false;
+    const BcCacheHeader *header = (const BcCacheHeader *)file.Data();
+    if(header->magic != BC_CACHE_MAGIC || header->version != BC_CACHE_VERSION || header->settings != settings ||
+       header->sourceMTime != mtime || header->sourceSize != size || header->width == 0 || header->height == 0 ||
+       header->format <= BC_FORMAT_NONE || header->format > BC_FORMAT_BC7 ||
+       header->numLevels == 0 || header->numLevels > MipLevelCount(header->width, header->height))
+        return false;
+
+    image.format = (Bc_Format)header->format;
+    image.psnr = header->psnr;
+    image.levels.clear();
+    size_t offset = sizeof(BcCacheHeader);
+    unsigned int width = header->width, height = header->height;
+    for(uint32_t i = 0; i < header->numLevels; i++) {
+        size_t bytes = bcLevelBytes(image.format, width, height);
+        if(offset + bytes > file.Size())
+            return false;
+        image.levels.push_back(BcLevel());
+        BcLevel &level = image.levels.back();
+        level.width = width;
+        level.height = height;
+        level.blocks.assign(file.Data() + offset, file.Data() + offset + bytes);
+        offset += bytes;
+        width  = max(width / 2, 1u);
+        height = max(height / 2, 1u);
+    }
+    return offset == file.Size();
+}
+
+bool WriteBcCache(const string &sourcePath, uint32_t settings, const BcImage &image) {
+    BcCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    if(image.levels.empty() || !StatFile(sourcePath, header.sourceMTime, header.sourceSize))
+        return false;
+    header.magic = BC_CACHE_MAGIC;
+    header.version = BC_CACHE_VERSION;
+    header.settings = settings;
+    header.format = (uint32_t)image.format;
+    header.width = image.levels[0].width;
+    header.height = image.levels[0].height;
+    header.numLevels = (uint32_t)image.levels.size();
+    header.psnr = (float)image.psnr;
+
+    return WriteFileAtomically(bcCachePath(sourcePath, settings), [&](ostream &out) {
+        out.write((const char *)&header, sizeof(header));
+        for(unsigned int i = 0; i < image.levels.size(); i++) {
+            out.write((const char *)&image.levels[i].blocks[0], image.levels[i].blocks.size());
+        }
+    });
+}
+
+#endif /* bc_encoder_h */
@@ -13,6 +13,8 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "culling.h"
+
 #include <vector>
 
 enum Camera_Movement {
@@ -29,6 +31,14 @@ const float SPEED = 2.5f;
 const float SENSITIVITY = 0.1f;
 const float ZOOM = 45.0f;
 
+// Copy of everything the renderer needs from the camera for one frame, so the simulation can keep moving it
+struct CameraSnapshot {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 position;
+    Frustum frustum;     // world space
+};
+
 // An abstract class that processes input and calculates the corresponding Euler Angles, Vectors and Matrices for use in OpenGL
 class Camera {
 public:
@@ -69,6 +79,26 @@ public:
         return glm::lookAt(Position, Position + Front, Up);
     }
     
+    // Returns the perspective projection for the current zoom
+    glm::mat4 GetProjectionMatrix(float aspect, float zNear = 0.1f, float zFar = 100.0f) {
+        return glm::perspective(glm::radians(Zoom), aspect, zNear, zFar);
+    }
+    
+    // Returns the world space view frustum, multiply in a model matrix with Frustum::FromMatrix for model space
+    Frustum GetFrustum(float aspect, float zNear = 0.1f, float zFar = 100.0f) {
+        return Frustum::FromMatrix(GetProjectionMatrix(aspect, zNear, zFar) * GetViewMatrix());
+    }
+    
+    // Returns this frame's matrices and frustum for a FramePacket
+    CameraSnapshot Snapshot(float aspect, float zNear = 0.1f, float zFar = 100.0f) {
+        CameraSnapshot snapshot;
+        snapshot.view = GetViewMatrix();
+        snapshot.projection = GetProjectionMatrix(aspect, zNear, zFar);
+        snapshot.position = Position;
+        snapshot.frustum = Frustum::FromMatrix(snapshot.projection * snapshot.view);
+        return snapshot;
+    }
+    
     // Processes input recieved from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing system)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime) {
         float velocity = MovementSpeed * deltaTime;
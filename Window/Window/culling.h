@@ -0,0 +1,199 @@
+//
+//  culling.h
+//  Window
+//
+//  Created by William Goniprow on 2/11/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef culling_h
+#define culling_h
+
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+
+#include <stdint.h>
+#include <cmath>
+#include <vector>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define CULLING_SSE 1
+#endif
+using namespace std;
+
+// Spheres per culling job, big enough that only scenes with thousands of objects spread across workers
+const unsigned int CULL_GRAIN = 1024;
+
+struct BoundingBox {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// Six planes (ax + by + cz + d >= 0 inside) pulled out of a projection * view (* model) matrix.
+// With a model matrix included the planes are in that model's space, so local bounds can be tested as is.
+struct Frustum {
+    glm::vec4 planes[6]; // left, right, bottom, top, near, far
+
+    static Frustum FromMatrix(const glm::mat4 &m) {
+        // Gribb & Hartmann: each plane is the last row of the matrix plus or minus one of the others
+        Frustum frustum;
+        for(int i = 0; i < 3; i++) {
+            for(int side = 0; side < 2; side++) {
+                float sign = side == 0 ? 1.0f : -1.0f;
+                glm::vec4 plane(m[0][3] + sign * m[0][i],
+                                m[1][3] + sign * m[1][i],
+                                m[2][3] + sign * m[2][i],
+                                m[3][3] + sign * m[3][i]);
+                float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+                frustum.planes[i * 2 + side] = plane / length;
+            }
+        }
+        return frustum;
+    }
+
+    bool IntersectsSphere(const glm::vec3 &center, float radius) const {
+        for(int i = 0; i < 6; i++) {
+            if(planes[i].x * center.x + planes[i].y * center.y + planes[i].z * center.z + planes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+    bool IntersectsBox(const BoundingBox &box) const {
+        for(int i = 0; i < 6; i++) {
+            // the corner furthest along the plane normal
+            glm::vec3 p(planes[i].x >= 0.0f ? box.max.x : box.min.x,
+                        planes[i].y >= 0.0f ? box.max.y : box.min.y,
+                        planes[i].z >= 0.0f ? box.max.z : box.min.z);
+            if(planes[i].x * p.x + planes[i].y * p.y + planes[i].z * p.z + planes[i].w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+BoundingBox ComputeBoundingBox(const glm::vec3 *positions, size_t count, size_t stride) {
+    BoundingBox box;
+    box.min = box.max = glm::vec3(0.0f);
+    if(count == 0)
+        return box;
+    box.min = box.max = positions[0];
+    const char *p = (const char *)positions;
+    for(size_t i = 1; i < count; i++) {
+        const glm::vec3 &position = *(const glm::vec3 *)(p + i * stride);
+        box.min = glm::min(box.min, position);
+        box.max = glm::max(box.max, position);
+    }
+    return box;
+}
+
+// Sphere around the box center, tightened to the furthest actual point
+BoundingSphere ComputeBoundingSphere(const glm::vec3 *positions, size_t count, size_t stride, const BoundingBox &box) {
+    BoundingSphere sphere;
+    sphere.center = (box.min + box.max) * 0.5f;
+    float radiusSquared = 0.0f;
+    const char *p = (const char *)positions;
+    for(size_t i = 0; i < count; i++) {
+        glm::vec3 d = *(const glm::vec3 *)(p + i * stride) - sphere.center;
+        radiusSquared = fmaxf(radiusSquared, glm::dot(d, d));
+    }
+    sphere.radius = sqrtf(radiusSquared);
+    return sphere;
+}
+
+// Bounding spheres as separate arrays so the frustum test can run on four at a time.
+// The arrays are padded to a multiple of four with spheres that never pass.
+class BoundsSoA {
+public:
+    vector<float> centerX;
+    vector<float> centerY;
+    vector<float> centerZ;
+    vector<float> radius;
+
+    BoundsSoA() : count(0) {}
+    size_t Size() const { return count; }
+    void Clear() {
+        centerX.clear();
+        centerY.clear();
+        centerZ.clear();
+        radius.clear();
+        count = 0;
+    }
+    void Add(const BoundingSphere &sphere) {
+        if(count == centerX.size()) {
+            for(int i = 0; i < 4; i++) {
+                centerX.push_back(0.0f);
+                centerY.push_back(0.0f);
+                centerZ.push_back(0.0f);
+                radius.push_back(-INFINITY);
+            }
+        }
+        centerX[count] = sphere.center.x;
+        centerY[count] = sphere.center.y;
+        centerZ[count] = sphere.center.z;
+        radius[count]  = sphere.radius;
+        count++;
+    }
+private:
+    size_t count;
+};
+
+// Tests spheres [first, last) of bounds against the frustum, visible[i] is set to 1 or 0 for each.
+// first must be a multiple of four. visible must hold at least bounds.Size() entries rounded up to four.
+void CullSpheres(const Frustum &frustum, const BoundsSoA &bounds, uint8_t *visible, size_t first, size_t last) {
+#ifdef CULLING_SSE
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for(int p = 0; p < 6; p++) {
+        planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+    for(size_t i = first; i < last; i += 4) {
+        __m128 x = _mm_loadu_ps(&bounds.centerX[i]);
+        __m128 y = _mm_loadu_ps(&bounds.centerY[i]);
+        __m128 z = _mm_loadu_ps(&bounds.centerZ[i]);
+        __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&bounds.radius[i]));
+        __m128 inside = _mm_cmpeq_ps(x, x); // all ones (centers are never NaN)
+        for(int p = 0; p < 6; p++) {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                                         _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+        }
+        int mask = _mm_movemask_ps(inside);
+        visible[i]     = (uint8_t)(mask & 1);
+        visible[i + 1] = (uint8_t)((mask >> 1) & 1);
+        visible[i + 2] = (uint8_t)((mask >> 2) & 1);
+        visible[i + 3] = (uint8_t)((mask >> 3) & 1);
+    }
+#else
+    for(size_t i = first; i < last; i++) {
+        bool inside = true;
+        for(int p = 0; p < 6 && inside; p++) {
+            const glm::vec4 &plane = frustum.planes[p];
+            inside = plane.x * bounds.centerX[i] + plane.y * bounds.centerY[i] + plane.z * bounds.centerZ[i] + plane.w >= -bounds.radius[i];
+        }
+        visible[i] = inside ? 1 : 0;
+    }
+#endif
+}
+
+void CullSpheres(const Frustum &frustum, const BoundsSoA &bounds, vector<uint8_t> &visible) {
+    size_t padded = (bounds.Size() + 3) & ~(size_t)3;
+    visible.resize(padded);
+    if(padded == 0)
+        return;
+    // ranges stay multiples of four since the grain is
+    uint8_t *output = &visible[0];
+    Jobs().ParallelFor((unsigned int)padded, CULL_GRAIN, [&](unsigned int first, unsigned int last) {
+        CullSpheres(frustum, bounds, output, first, last);
+    });
+}
+
+#endif /* culling_h */
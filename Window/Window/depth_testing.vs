@@ -6,10 +6,15 @@ out vec2 TexCoords;
 
 // uniform mat4 transform;
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// shared by every program, see frame_uniforms.h
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
 
 void main() {
     TexCoords = aTexCoords;
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = viewProjection * model * vec4(aPos, 1.0);
 }
@@ -0,0 +1,191 @@
+//
+//  draw_batch.h
+//  Window
+//
+//  Created by William Goniprow on 2/15/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef draw_batch_h
+#define draw_batch_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_ext.h"
+#include "geometry_pool.h"
+#include "mesh.h"
+#include "shader.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+using namespace std;
+
+// Texture unit the per-draw data buffer texture is bound to, out of the way of material textures
+const unsigned int DRAW_DATA_TEXTURE_UNIT = 15;
+// vec4 texels per draw in the data buffer: model matrix columns, then position offset and scale
+const unsigned int DRAW_DATA_TEXELS = 6;
+
+// Same layout as the GL indirect command
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLuint baseVertex;
+    GLuint baseInstance;
+};
+
+struct DrawBatchStats {
+    unsigned int draws;
+    unsigned int calls; // MultiDrawElementsIndirect calls, or single draws on the fallback path
+};
+
+// Draws pooled meshes (Mesh created with a GeometryPool) with one glMultiDrawElementsIndirect per pool and
+// material. Each draw's model matrix and dequantization go into a buffer texture the *_batched.vs shaders
+// fetch from by draw index. Without GL 4.3 the same data is drawn with one glDrawElementsBaseVertex per mesh.
+class DrawBatch {
+public:
+    /* Functions */
+    DrawBatch();
+    ~DrawBatch();
+    void Begin() { draws.clear(); }
+    // mesh must live in a GeometryPool, others are ignored
+    void Add(const Mesh &mesh, const glm::mat4 &model);
+    // Issues everything added since Begin with shader, which must be a *_batched.vs variant
+    void Execute(Shader &shader);
+    const DrawBatchStats &Stats() const { return stats; }
+private:
+    /* Batch Data */
+    struct BatchedDraw {
+        const Mesh *mesh;
+        glm::mat4 model;
+    };
+    vector<BatchedDraw> draws;
+    vector<DrawElementsIndirectCommand> commands;
+    vector<glm::vec4> drawData;
+    unsigned int indirectBuffer;
+    unsigned int dataBuffer;
+    unsigned int dataTexture;
+    DrawBatchStats stats;
+    /* Functions */
+    static bool sameMaterial(const Mesh &a, const Mesh &b);
+    static bool drawOrder(const BatchedDraw &a, const BatchedDraw &b);
+    // not copyable, the buffers are owned
+    DrawBatch(const DrawBatch &);
+    DrawBatch &operator=(const DrawBatch &);
+};
+
+DrawBatch::DrawBatch() : indirectBuffer(0) {
+    stats.draws = stats.calls = 0;
+    if(GLExt().multiDrawIndirect)
+        glGenBuffers(1, &indirectBuffer);
+    glGenBuffers(1, &dataBuffer);
+    glGenTextures(1, &dataTexture);
+}
+
+DrawBatch::~DrawBatch() {
+    if(indirectBuffer)
+        glDeleteBuffers(1, &indirectBuffer);
+    glDeleteBuffers(1, &dataBuffer);
+    glDeleteTextures(1, &dataTexture);
+}
+
+void DrawBatch::Add(const Mesh &mesh, const glm::mat4 &model) {
+    if(!mesh.pool)
+        return;
+    BatchedDraw draw;
+    draw.mesh = &mesh;
+    draw.model = model;
+    draws.push_back(draw);
+}
+
+bool DrawBatch::sameMaterial(const Mesh &a, const Mesh &b) {
+    // materials are shared, equal ones are the same object
+    return a.material == b.material;
+}
+
+// groups draws by pool, then by material, everything in a group goes out in one call
+bool DrawBatch::drawOrder(const BatchedDraw &a, const BatchedDraw &b) {
+    if(a.mesh->pool != b.mesh->pool)
+        return a.mesh->pool < b.mesh->pool;
+    unsigned int ma = a.mesh->material ? a.mesh->material->ID() : 0;
+    unsigned int mb = b.mesh->material ? b.mesh->material->ID() : 0;
+    return ma < mb;
+}
+
+void DrawBatch::Execute(Shader &shader) {
+    stats.draws = (unsigned int)draws.size();
+    stats.calls = 0;
+    if(draws.empty())
+        return;
+    stable_sort(draws.begin(), draws.end(), drawOrder);
+
+    // commands and per-draw data in the sorted order, draw i uses texels [i * DRAW_DATA_TEXELS, ...)
+    commands.resize(draws.size());
+    drawData.resize(draws.size() * DRAW_DATA_TEXELS);
+    for(unsigned int i = 0; i < draws.size(); i++) {
+        const GeometryRange &range = draws[i].mesh->range;
+        DrawElementsIndirectCommand &command = commands[i];
+        command.count         = range.indexCount;
+        command.instanceCount = 1;
+        command.firstIndex    = range.firstIndex;
+        command.baseVertex    = range.baseVertex;
+        command.baseInstance  = i; // becomes the draw index through the DrawIDs buffer
+        glm::vec4 *data = &drawData[i * DRAW_DATA_TEXELS];
+        for(int column = 0; column < 4; column++)
+            data[column] = draws[i].model[column];
+        data[4] = glm::vec4(range.positionOffset, 0.0f);
+        data[5] = glm::vec4(range.positionScale, 0.0f);
+    }
+
+    // orphan and refill, the previous frame's draws may still be reading
+    glBindBuffer(GL_TEXTURE_BUFFER, dataBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, drawData.size() * sizeof(glm::vec4), &drawData[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0 + DRAW_DATA_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, dataTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, dataBuffer);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.use();
+    shader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
+    const bool indirect = GLExt().multiDrawIndirect;
+    if(indirect) {
+        DrawIDs().Reserve((unsigned int)draws.size());
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0], GL_STREAM_DRAW);
+    }
+
+    unsigned int first = 0;
+    while(first < draws.size()) {
+        const Mesh &mesh = *draws[first].mesh;
+        unsigned int last = first + 1;
+        while(last < draws.size() && draws[last].mesh->pool == mesh.pool && sameMaterial(*draws[last].mesh, mesh))
+            last++;
+
+        // the material only binds units from 0 up, never the data buffer's unit
+        mesh.bindTextures(shader);
+        glBindVertexArray(mesh.pool->VAO());
+        if(indirect) {
+            GLExt().MultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)(first * sizeof(DrawElementsIndirectCommand)), last - first, 0);
+            stats.calls++;
+        }
+        else {
+            for(unsigned int i = first; i < last; i++) {
+                // the draw ID attribute is disabled here, its constant value is what the shader reads
+                glVertexAttribI1ui(DRAW_ID_LOCATION, i);
+                glDrawElementsBaseVertex(GL_TRIANGLES, commands[i].count, GL_UNSIGNED_INT,
+                                         (void *)(commands[i].firstIndex * sizeof(unsigned int)), commands[i].baseVertex);
+                stats.calls++;
+            }
+        }
+        first = last;
+    }
+
+    if(indirect)
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+#endif /* draw_batch_h */
@@ -0,0 +1,130 @@
+//
+//  frame_uniforms.h
+//  Window
+//
+//  Created by William Goniprow on 2/17/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef frame_uniforms_h
+#define frame_uniforms_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "stream_buffer.h"
+
+#include <cstddef>
+#include <cstring>
+using namespace std;
+
+const unsigned int MAX_POINT_LIGHTS = 4; // NR_POINT_LIGHTS in lightingShader.fs
+
+// C++ mirrors of the std140 blocks in the shaders. A vec3 takes 16 bytes unless a float follows it,
+// the padding members are there to keep every field at its std140 offset.
+
+// layout (std140) uniform Camera, binding CAMERA_BLOCK_BINDING
+struct CameraBlock {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::vec3 viewPos;
+    float padding;
+};
+
+struct DirLightData {
+    glm::vec3 direction;
+    float padding0;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+struct PointLightData {
+    glm::vec3 position;
+    float constant;
+    float linear;
+    float quadratic;
+    float padding0[2];
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+struct SpotLightData {
+    glm::vec3 position;
+    float padding0;
+    glm::vec3 direction;
+    float cutOff;
+    float outerCutOff;
+    float constant;
+    float linear;
+    float quadratic;
+    glm::vec3 ambient;
+    float padding1;
+    glm::vec3 diffuse;
+    float padding2;
+    glm::vec3 specular;
+    float padding3;
+};
+
+// layout (std140) uniform Lights, binding LIGHTS_BLOCK_BINDING
+struct LightsBlock {
+    DirLightData dirLight;
+    PointLightData pointLights[MAX_POINT_LIGHTS];
+    SpotLightData spotLight;
+};
+
+static_assert(sizeof(CameraBlock) == 208, "Camera block must match std140");
+static_assert(sizeof(PointLightData) == 80 && offsetof(PointLightData, ambient) == 32, "PointLight must match std140");
+static_assert(sizeof(SpotLightData) == 96 && offsetof(SpotLightData, cutOff) == 28 && offsetof(SpotLightData, ambient) == 48, "SpotLight must match std140");
+static_assert(offsetof(LightsBlock, pointLights) == 64 && offsetof(LightsBlock, spotLight) == 384, "Lights block must match std140");
+
+// Uploads the camera and light blocks once per frame through a stream buffer and binds them to their
+// binding points, every Shader picks them up from there without any per-program uniform calls.
+class FrameUniforms {
+public:
+    // edited freely between frames, uploaded by every Begin
+    LightsBlock lights;
+
+    /* Functions */
+    FrameUniforms() : lights(LightsBlock()), buffer(GL_UNIFORM_BUFFER, 4096), alignment(StreamBuffer::UniformAlignment()) {}
+    // Uploads this frame's blocks and binds them, call before any draws
+    void Begin(const glm::mat4 &view, const glm::mat4 &projection, const glm::vec3 &viewPos) {
+        CameraBlock camera;
+        camera.view = view;
+        camera.projection = projection;
+        camera.viewProjection = projection * view;
+        camera.viewPos = viewPos;
+        camera.padding = 0.0f;
+
+        buffer.BeginFrame();
+        StreamSlice cameraSlice = buffer.Allocate(sizeof(CameraBlock), alignment);
+        StreamSlice lightsSlice = buffer.Allocate(sizeof(LightsBlock), alignment);
+        if(!cameraSlice.data || !lightsSlice.data)
+            return;
+        memcpy(cameraSlice.data, &camera, sizeof(camera));
+        memcpy(lightsSlice.data, &lights, sizeof(lights));
+        buffer.Flush();
+        buffer.BindRange(cameraSlice, CAMERA_BLOCK_BINDING);
+        buffer.BindRange(lightsSlice, LIGHTS_BLOCK_BINDING);
+    }
+    // Call after the frame's last draw
+    void End() {
+        buffer.EndFrame();
+    }
+    const StreamBuffer &Buffer() const { return buffer; }
+private:
+    /* Frame Data */
+    StreamBuffer buffer;
+    size_t alignment;
+};
+
+#endif /* frame_uniforms_h */
@@ -0,0 +1,189 @@
+//
+//  geometry_pool.h
+//  Window
+//
+//  Created by William Goniprow on 2/15/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef geometry_pool_h
+#define geometry_pool_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_ext.h"
+#include "vertex_format.h"
+
+#include <stdint.h>
+#include <vector>
+using namespace std;
+
+// Attribute the *_batched.vs shaders read their draw index from, after the instancing ones (3-7)
+const unsigned int DRAW_ID_LOCATION = 8;
+
+// Where one mesh lives inside a GeometryPool
+struct GeometryRange {
+    unsigned int baseVertex;
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    // dequantization, identity unless the pool is VERTEX_QUANTIZED
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+};
+
+// 0, 1, 2, ... read with divisor 1, so with MultiDrawElementsIndirect the baseInstance of each command
+// turns into its draw index. Shared by every pool VAO.
+class DrawIDBuffer {
+public:
+    DrawIDBuffer() : VBO(0), size(0) {}
+    // Makes sure ids [0, count) exist
+    void Reserve(unsigned int count) {
+        if(!VBO)
+            glGenBuffers(1, &VBO);
+        if(count <= size)
+            return;
+        unsigned int newSize = size ? size : 1024;
+        while(newSize < count)
+            newSize *= 2;
+        vector<uint32_t> ids(newSize);
+        for(unsigned int i = 0; i < newSize; i++)
+            ids[i] = i;
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, newSize * sizeof(uint32_t), &ids[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        size = newSize;
+    }
+    unsigned int ID() const { return VBO; }
+private:
+    unsigned int VBO;
+    unsigned int size;
+};
+
+DrawIDBuffer &DrawIDs() {
+    static DrawIDBuffer drawIDs;
+    return drawIDs;
+}
+
+// Static meshes of one vertex format sub-allocated from a shared vertex and index buffer behind a single VAO.
+// Ranges are never freed, the pool is meant for geometry that lives as long as the scene.
+class GeometryPool {
+public:
+    /* Functions */
+    GeometryPool(Vertex_Format format);
+    // Uploads a mesh into the pool, growing the buffers if needed
+    GeometryRange Add(const vector<Vertex> &vertices, const vector<unsigned int> &indices);
+    unsigned int VAO() const { return vao; }
+    Vertex_Format Format() const { return format; }
+    unsigned int NumVertices() const { return numVertices; }
+    unsigned int NumIndices() const { return numIndices; }
+private:
+    /* Pool Data */
+    Vertex_Format format;
+    unsigned int vao, VBO, EBO;
+    unsigned int vertexCapacity, indexCapacity;
+    unsigned int numVertices, numIndices;
+    /* Functions */
+    void grow(unsigned int minVertices, unsigned int minIndices);
+    // not copyable, the buffers are owned
+    GeometryPool(const GeometryPool &);
+    GeometryPool &operator=(const GeometryPool &);
+};
+
+// One pool per vertex format, created on first use (needs a current GL context)
+GeometryPool &SharedGeometry(Vertex_Format format) {
+    static GeometryPool *pools[3] = {NULL, NULL, NULL};
+    if(!pools[format])
+        pools[format] = new GeometryPool(format);
+    return *pools[format];
+}
+
+GeometryPool::GeometryPool(Vertex_Format format) : format(format), vao(0), VBO(0), EBO(0), vertexCapacity(0), indexCapacity(0), numVertices(0), numIndices(0) {
+    glGenVertexArrays(1, &vao);
+    DrawIDs().Reserve(1);
+    if(GLExt().multiDrawIndirect) {
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, DrawIDs().ID());
+        glEnableVertexAttribArray(DRAW_ID_LOCATION);
+        glVertexAttribIPointer(DRAW_ID_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void *)0);
+        glVertexAttribDivisor(DRAW_ID_LOCATION, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    // otherwise the attribute stays disabled and DrawBatch sets it with glVertexAttribI1ui per draw
+    grow(1 << 16, 1 << 18);
+}
+
+void GeometryPool::grow(unsigned int minVertices, unsigned int minIndices) {
+    unsigned int newVertexCapacity = vertexCapacity ? vertexCapacity : minVertices;
+    unsigned int newIndexCapacity  = indexCapacity ? indexCapacity : minIndices;
+    while(newVertexCapacity < minVertices)
+        newVertexCapacity *= 2;
+    while(newIndexCapacity < minIndices)
+        newIndexCapacity *= 2;
+    if(newVertexCapacity == vertexCapacity && newIndexCapacity == indexCapacity)
+        return;
+
+    const size_t stride = VertexStride(format);
+    unsigned int buffers[2];
+    glGenBuffers(2, buffers);
+    // copy what is already there on the GPU, the CPU copies may be long gone
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[0]);
+    glBufferData(GL_COPY_WRITE_BUFFER, newVertexCapacity * stride, NULL, GL_STATIC_DRAW);
+    if(VBO && numVertices) {
+        glBindBuffer(GL_COPY_READ_BUFFER, VBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numVertices * stride);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[1]);
+    glBufferData(GL_COPY_WRITE_BUFFER, newIndexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+    if(EBO && numIndices) {
+        glBindBuffer(GL_COPY_READ_BUFFER, EBO);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, numIndices * sizeof(unsigned int));
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    if(VBO)
+        glDeleteBuffers(1, &VBO);
+    if(EBO)
+        glDeleteBuffers(1, &EBO);
+    VBO = buffers[0];
+    EBO = buffers[1];
+    vertexCapacity = newVertexCapacity;
+    indexCapacity  = newIndexCapacity;
+
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    SetupVertexAttributes(format);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+GeometryRange GeometryPool::Add(const vector<Vertex> &vertices, const vector<unsigned int> &indices) {
+    grow(numVertices + (unsigned int)vertices.size(), numIndices + (unsigned int)indices.size());
+
+    GeometryRange range;
+    range.baseVertex = numVertices;
+    range.firstIndex = numIndices;
+    range.indexCount = (unsigned int)indices.size();
+    vector<char> encoded;
+    EncodeVertices(format, vertices, encoded, range.positionOffset, range.positionScale);
+
+    const size_t stride = VertexStride(format);
+    if(!encoded.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, numVertices * stride, encoded.size(), &encoded[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    if(!indices.empty()) {
+        // indices stay relative to the mesh, baseVertex is added at draw time
+        glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, numIndices * sizeof(unsigned int), indices.size() * sizeof(unsigned int), &indices[0]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    numVertices += (unsigned int)vertices.size();
+    numIndices  += (unsigned int)indices.size();
+    return range;
+}
+
+#endif /* geometry_pool_h */
@@ -0,0 +1,138 @@
+//
+//  gl_ext.h
+//  Window
+//
+//  Created by William Goniprow on 2/12/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef gl_ext_h
+#define gl_ext_h
+
+#include <glad/glad.h>
+
+#include <cstring>
+using namespace std;
+
+// glad is generated for the 3.3 core profile, anything newer is looked up here at runtime
+// and only used when the driver actually has it. Call LoadGLExtensions once after gladLoadGLLoader.
+
+// GL 4.1 / ARB_get_program_binary
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// GL 4.3 / ARB_multi_draw_indirect
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// EXT_texture_compression_s3tc (BC1, BC3), not core anywhere but on practically every desktop driver
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// GL 4.2 / ARB_texture_compression_bptc (BC7)
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+typedef void (APIENTRYP GLEXT_GETPROGRAMBINARY)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP GLEXT_PROGRAMBINARY)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP GLEXT_PROGRAMPARAMETERI)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP GLEXT_MULTIDRAWELEMENTSINDIRECT)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+typedef void (APIENTRYP GLEXT_BUFFERSTORAGE)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+struct GLExtensions {
+    bool loaded;
+    /* Program Binaries */
+    bool programBinary;
+    GLEXT_GETPROGRAMBINARY GetProgramBinary;
+    GLEXT_PROGRAMBINARY ProgramBinary;
+    GLEXT_PROGRAMPARAMETERI ProgramParameteri;
+    /* Indirect Drawing */
+    bool multiDrawIndirect; // also implies baseInstance in the indirect commands is honoured
+    GLEXT_MULTIDRAWELEMENTSINDIRECT MultiDrawElementsIndirect;
+    /* Buffer Storage */
+    bool bufferStorage;
+    GLEXT_BUFFERSTORAGE BufferStorage;
+    /* Texture Compression */
+    bool textureS3TC;
+    bool textureS3TCsRGB;   // the SRGB DXT formats, they come with EXT_texture_sRGB rather than the S3TC extension
+    bool textureBPTC;
+};
+
+GLExtensions &GLExt() {
+    static GLExtensions extensions = GLExtensions();
+    return extensions;
+}
+
+bool HasGLExtension(const char *name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for(GLint i = 0; i < count; i++) {
+        const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if(extension && strcmp(extension, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool HasGLVersion(int major, int minor) {
+    GLint contextMajor = 0, contextMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+void LoadGLExtensions(GLADloadproc load) {
+    GLExtensions &ext = GLExt();
+    ext = GLExtensions();
+    ext.loaded = true;
+
+    if(HasGLVersion(4, 1) || HasGLExtension("GL_ARB_get_program_binary")) {
+        ext.GetProgramBinary  = (GLEXT_GETPROGRAMBINARY)load("glGetProgramBinary");
+        ext.ProgramBinary     = (GLEXT_PROGRAMBINARY)load("glProgramBinary");
+        ext.ProgramParameteri = (GLEXT_PROGRAMPARAMETERI)load("glProgramParameteri");
+        // a driver can expose the entry points and still support zero formats
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        ext.programBinary = ext.GetProgramBinary && ext.ProgramBinary && ext.ProgramParameteri && formats > 0;
+    }
+    
+    // a non-zero baseInstance in an indirect command needs 4.2 / ARB_base_instance on top
+    if((HasGLVersion(4, 3) || HasGLExtension("GL_ARB_multi_draw_indirect")) &&
+       (HasGLVersion(4, 2) || HasGLExtension("GL_ARB_base_instance"))) {
+        ext.MultiDrawElementsIndirect = (GLEXT_MULTIDRAWELEMENTSINDIRECT)load("glMultiDrawElementsIndirect");
+        ext.multiDrawIndirect = ext.MultiDrawElementsIndirect != NULL;
+    }
+    
+    if(HasGLVersion(4, 4) || HasGLExtension("GL_ARB_buffer_storage")) {
+        ext.BufferStorage = (GLEXT_BUFFERSTORAGE)load("glBufferStorage");
+        ext.bufferStorage = ext.BufferStorage != NULL;
+    }
+    
+    // only formats, glCompressedTexImage2D itself is core
+    ext.textureS3TC = HasGLExtension("GL_EXT_texture_compression_s3tc");
+    ext.textureS3TCsRGB = ext.textureS3TC && HasGLExtension("GL_EXT_texture_sRGB");
+    ext.textureBPTC = HasGLVersion(4, 2) || HasGLExtension("GL_ARB_texture_compression_bptc");
+}
+
+#endif /* gl_ext_h */
@@ -0,0 +1,259 @@
+//
+//  headless.h
+//  Window
+//
+//  Created by William Goniprow on 2/19/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef headless_h
+#define headless_h
+
+#include <glad/glad.h>
+
+#ifndef __APPLE__
+#define EGL_NO_X11
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// --headless [--size WxH] [--frames N] [--output frame.ppm]
+struct HeadlessOptions {
+    bool enabled;
+    unsigned int width;
+    unsigned int height;
+    unsigned int frames;
+    string output;  // last frame is written here as a PPM if set
+};
+
+HeadlessOptions ParseHeadlessOptions(int argc, char **argv, unsigned int width, unsigned int height) {
+    HeadlessOptions options;
+    options.enabled = false;
+    options.width = width;
+    options.height = height;
+    options.frames = 100;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--headless") == 0)
+            options.enabled = true;
+        else if(strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            unsigned int w = 0, h = 0;
+            if(sscanf(argv[++i], "%ux%u", &w, &h) == 2 && w > 0 && h > 0) {
+                options.width = w;
+                options.height = h;
+            }
+            else
+                cout << "ERROR::HEADLESS::BAD_SIZE " << argv[i] << endl;
+        }
+        else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            options.frames = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else if(strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            options.output = argv[++i];
+    }
+    return options;
+}
+
+// GL 3.3 core context without a window, for machines with no display. The context comes from EGL,
+// surfaceless where the driver allows it (Mesa llvmpipe does) and on a 1x1 pbuffer otherwise.
+// Everything is drawn into an FBO of the requested size, which stays bound as the draw framebuffer.
+class HeadlessContext {
+public:
+    /* Functions */
+    HeadlessContext();
+    ~HeadlessContext();
+    // Creates the context and makes it current, load GL through GetProcAddress after this
+    bool Create(unsigned int width, unsigned int height);
+    // Binds the offscreen framebuffer and sets the viewport to it, needs GL loaded
+    bool CreateFramebuffer();
+    static void *GetProcAddress(const char *name);
+    // Moves the context between threads, it can only be current on one at a time
+    bool MakeCurrent();
+    void ReleaseCurrent();
+    // RGBA8 rows bottom to top, as glReadPixels returns them
+    void ReadPixels(vector<unsigned char> &pixels) const;
+    bool WritePPM(const string &path) const;
+    unsigned int Width() const { return width; }
+    unsigned int Height() const { return height; }
+private:
+    /* Context Data */
+    unsigned int width;
+    unsigned int height;
+    unsigned int framebuffer;
+    unsigned int colorBuffer;
+    unsigned int depthBuffer;
+#ifndef __APPLE__
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+#endif
+    // not copyable, the context is owned
+    HeadlessContext(const HeadlessContext &);
+    HeadlessContext &operator=(const HeadlessContext &);
+};
+
+HeadlessContext::HeadlessContext() : width(0), height(0), framebuffer(0), colorBuffer(0), depthBuffer(0) {
+#ifndef __APPLE__
+    display = EGL_NO_DISPLAY;
+    surface = EGL_NO_SURFACE;
+    context = EGL_NO_CONTEXT;
+#endif
+}
+
+HeadlessContext::~HeadlessContext() {
+#ifndef __APPLE__
+    if(context != EGL_NO_CONTEXT) {
+        // may be released by a render thread that has exited
+        if(framebuffer && eglMakeCurrent(display, surface, surface, context)) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &colorBuffer);
+            glDeleteRenderbuffers(1, &depthBuffer);
+        }
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(display, context);
+    }
+    if(surface != EGL_NO_SURFACE)
+        eglDestroySurface(display, surface);
+    if(display != EGL_NO_DISPLAY)
+        eglTerminate(display);
+#endif
+}
+
+void *HeadlessContext::GetProcAddress(const char *name) {
+#ifndef __APPLE__
+    return (void *)eglGetProcAddress(name);
+#else
+    return NULL;
+#endif
+}
+
+bool HeadlessContext::Create(unsigned int width, unsigned int height) {
+    this->width = width;
+    this->height = height;
+#ifdef __APPLE__
+    cout << "ERROR::HEADLESS::EGL_NOT_AVAILABLE" << endl;
+    return false;
+#else
+    // a surfaceless platform display needs no window system at all, fall back to the default one
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if(getPlatformDisplay && clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless"))
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    if(display == EGL_NO_DISPLAY)
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        cout << "ERROR::HEADLESS::NO_DISPLAY" << endl;
+        display = EGL_NO_DISPLAY;
+        return false;
+    }
+
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    const bool surfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+    const EGLint configAttributes[] = {
+        EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint configs = 0;
+    if(!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs < 1) {
+        cout << "ERROR::HEADLESS::NO_CONFIG" << endl;
+        return false;
+    }
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+        cout << "ERROR::HEADLESS::NO_OPENGL_API" << endl;
+        return false;
+    }
+    // same version and profile the window asks GLFW for
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION_KHR, 3,
+        EGL_CONTEXT_MINOR_VERSION_KHR, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+        EGL_NONE
+    };
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+    if(context == EGL_NO_CONTEXT) {
+        cout << "ERROR::HEADLESS::CONTEXT_CREATION_FAILED 0x" << hex << eglGetError() << dec << endl;
+        return false;
+    }
+    if(!surfaceless) {
+        const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+    }
+    if(!eglMakeCurrent(display, surface, surface, context)) {
+        cout << "ERROR::HEADLESS::MAKE_CURRENT_FAILED" << endl;
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool HeadlessContext::MakeCurrent() {
+#ifndef __APPLE__
+    if(context != EGL_NO_CONTEXT && eglMakeCurrent(display, surface, surface, context))
+        return true;
+#endif
+    cout << "ERROR::HEADLESS::MAKE_CURRENT_FAILED" << endl;
+    return false;
+}
+
+void HeadlessContext::ReleaseCurrent() {
+#ifndef __APPLE__
+    if(display != EGL_NO_DISPLAY)
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+#endif
+}
+
+bool HeadlessContext::CreateFramebuffer() {
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << endl;
+        return false;
+    }
+    glViewport(0, 0, width, height);
+    return true;
+}
+
+void HeadlessContext::ReadPixels(vector<unsigned char> &pixels) const {
+    pixels.resize((size_t)width * height * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+}
+
+bool HeadlessContext::WritePPM(const string &path) const {
+    vector<unsigned char> pixels;
+    ReadPixels(pixels);
+    ofstream out(path.c_str(), ios::binary);
+    if(!out) {
+        cout << "ERROR::HEADLESS::FILE_NOT_WRITTEN " << path << endl;
+        return false;
+    }
+    out << "P6\n" << width << " " << height << "\n255\n";
+    // PPM is top to bottom
+    for(unsigned int y = height; y-- > 0;) {
+        const unsigned char *row = &pixels[(size_t)y * width * 4];
+        for(unsigned int x = 0; x < width; x++)
+            out.write((const char *)&row[x * 4], 3);
+    }
+    return (bool)out;
+}
+
+#endif /* headless_h */
@@ -0,0 +1,234 @@
+//
+//  input_recorder.h
+//  Window
+//
+//  Created by William Goniprow on 2/20/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef input_recorder_h
+#define input_recorder_h
+
+#include <stdint.h>
+#include <bitset>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Simulation step used while recording or replaying, so a replay walks the exact same camera path
+const float INPUT_TIMESTEP = 1.0f / 60.0f;
+const unsigned int INPUT_MAX_KEYS = 512;   // GLFW_KEY_LAST is 348
+const uint32_t INPUT_FILE_MAGIC = 0x54504E49; // "INPT"
+const uint32_t INPUT_FILE_VERSION = 1;
+
+enum Input_Mode {
+    INPUT_LIVE,
+    INPUT_RECORD,
+    INPUT_REPLAY
+};
+
+enum Input_Event_Type {
+    INPUT_KEY,
+    INPUT_MOUSE,
+    INPUT_SCROLL,
+    INPUT_END  // last record of a file, tick is the frame count
+};
+
+// One record in an input file. Events are stamped with the frame that consumes them rather than wall time.
+struct InputEvent {
+    uint32_t tick;
+    uint8_t type;
+    uint8_t pressed; // INPUT_KEY
+    uint16_t key;    // INPUT_KEY
+    float x;         // cursor position, or scroll offsets
+    float y;
+};
+static_assert(sizeof(InputEvent) == 16, "InputEvent is written to disk as is");
+
+struct InputFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    float timestep;
+    uint32_t reserved;
+};
+
+// --record file / --replay file
+struct InputOptions {
+    Input_Mode mode;
+    string path;
+};
+
+InputOptions ParseInputOptions(int argc, char **argv) {
+    InputOptions options;
+    options.mode = INPUT_LIVE;
+    for(int i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--record") == 0) {
+            options.mode = INPUT_RECORD;
+            options.path = argv[++i];
+        }
+        else if(strcmp(argv[i], "--replay") == 0) {
+            options.mode = INPUT_REPLAY;
+            options.path = argv[++i];
+        }
+    }
+    return options;
+}
+
+// Sits between the window callbacks and the code that reacts to input. Callbacks Push events, each frame
+// starts with BeginFrame, which hands that frame's events out through Events() and updates the held keys.
+// Live and recorded runs take the queued events, recording also appends them to a file; replays read them
+// back from the file and ignore the window. Either way the same events reach the same frames in the same order.
+class InputRecorder {
+public:
+    /* Functions */
+    InputRecorder() : mode(INPUT_LIVE), tick(0), next(0) {}
+    ~InputRecorder() { Close(); }
+    bool Open(const InputOptions &options);
+    // Writes the end record, recordings are only complete once this ran
+    void Close();
+    // From the window callbacks, ignored while replaying
+    void Push(const InputEvent &event);
+    void PushKey(int key, bool pressed);
+    void PushMouse(float x, float y);
+    void PushScroll(float x, float y);
+    // Starts frame tick + 1, false once a replay has run out
+    bool BeginFrame();
+    // Time step for this frame, fixed unless running live
+    float DeltaTime(float wallDelta) const { return mode == INPUT_LIVE ? wallDelta : INPUT_TIMESTEP; }
+    const vector<InputEvent> &Events() const { return events; }
+    bool KeyDown(int key) const { return key >= 0 && key < (int)INPUT_MAX_KEYS && keys[key]; }
+    Input_Mode Mode() const { return mode; }
+    uint32_t Tick() const { return tick; }
+private:
+    /* Recorder Data */
+    Input_Mode mode;
+    string path;
+    ofstream file;
+    uint32_t tick;
+    vector<InputEvent> pending;   // pushed since the last BeginFrame
+    vector<InputEvent> events;    // this frame's
+    vector<InputEvent> recording; // whole replay file
+    size_t next;                  // next replay event
+    bitset<INPUT_MAX_KEYS> keys;
+    // not copyable, the file is owned
+    InputRecorder(const InputRecorder &);
+    InputRecorder &operator=(const InputRecorder &);
+};
+
+bool InputRecorder::Open(const InputOptions &options) {
+    Close();
+    mode = options.mode;
+    path = options.path;
+    tick = 0;
+    next = 0;
+    keys.reset();
+    if(mode == INPUT_RECORD) {
+        file.open(path.c_str(), ios::binary | ios::trunc);
+        if(!file) {
+            cout << "ERROR::INPUT::FILE_NOT_WRITTEN " << path << endl;
+            mode = INPUT_LIVE;
+            return false;
+        }
+        InputFileHeader header = { INPUT_FILE_MAGIC, INPUT_FILE_VERSION, INPUT_TIMESTEP, 0 };
+        file.write((const char *)&header, sizeof(header));
+    }
+    else if(mode == INPUT_REPLAY) {
+        ifstream in(path.c_str(), ios::binary);
+        InputFileHeader header;
+        if(!in || !in.read((char *)&header, sizeof(header)) || header.magic != INPUT_FILE_MAGIC || header.version != INPUT_FILE_VERSION) {
+            cout << "ERROR::INPUT::FILE_NOT_READ " << path << endl;
+            mode = INPUT_LIVE;
+            return false;
+        }
+        if(header.timestep != INPUT_TIMESTEP)
+            cout << "ERROR::INPUT::TIMESTEP_MISMATCH " << header.timestep << endl;
+        InputEvent event;
+        while(in.read((char *)&event, sizeof(event))) {
+            // a key or type out of range means the file is corrupt, BeginFrame indexes keys with it
+            if(event.type > INPUT_END || (event.type == INPUT_KEY && event.key >= INPUT_MAX_KEYS)) {
+                cout << "ERROR::INPUT::INVALID_EVENT " << path << endl;
+                recording.clear();
+                mode = INPUT_LIVE;
+                return false;
+            }
+            recording.push_back(event);
+        }
+        if(recording.empty() || recording.back().type != INPUT_END)
+            cout << "ERROR::INPUT::RECORDING_TRUNCATED " << path << endl;
+    }
+    return true;
+}
+
+void InputRecorder::Close() {
+    if(!file.is_open())
+        return;
+    // the first frame that is not part of the recording
+    InputEvent end = InputEvent();
+    end.tick = tick + 1;
+    end.type = INPUT_END;
+    file.write((const char *)&end, sizeof(end));
+    file.close();
+}
+
+void InputRecorder::Push(const InputEvent &event) {
+    if(mode == INPUT_REPLAY)
+        return;
+    pending.push_back(event);
+    // consumed by the next frame
+    pending.back().tick = tick + 1;
+}
+
+void InputRecorder::PushKey(int key, bool pressed) {
+    if(key < 0 || key >= (int)INPUT_MAX_KEYS)
+        return;
+    InputEvent event = InputEvent();
+    event.type = INPUT_KEY;
+    event.key = (uint16_t)key;
+    event.pressed = pressed;
+    Push(event);
+}
+
+void InputRecorder::PushMouse(float x, float y) {
+    InputEvent event = InputEvent();
+    event.type = INPUT_MOUSE;
+    event.x = x;
+    event.y = y;
+    Push(event);
+}
+
+void InputRecorder::PushScroll(float x, float y) {
+    InputEvent event = InputEvent();
+    event.type = INPUT_SCROLL;
+    event.x = x;
+    event.y = y;
+    Push(event);
+}
+
+bool InputRecorder::BeginFrame() {
+    tick++;
+    events.clear();
+    if(mode == INPUT_REPLAY) {
+        while(next < recording.size() && recording[next].tick <= tick) {
+            if(recording[next].type == INPUT_END)
+                return false;
+            events.push_back(recording[next++]);
+        }
+        if(next == recording.size())
+            return false;
+    }
+    else {
+        events.swap(pending);
+        if(file.is_open() && !events.empty())
+            file.write((const char *)&events[0], events.size() * sizeof(InputEvent));
+    }
+    for(size_t i = 0; i < events.size(); i++) {
+        if(events[i].type == INPUT_KEY)
+            keys[events[i].key] = events[i].pressed != 0;
+    }
+    return true;
+}
+
+#endif /* input_recorder_h */
@@ -0,0 +1,88 @@
+//
+//  instance_buffer.h
+//  Window
+//
+//  Created by William Goniprow on 2/14/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef instance_buffer_h
+#define instance_buffer_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+// Attribute locations used by the *_instanced.vs shaders, after the per-vertex ones (0-2)
+const unsigned int INSTANCE_MODEL_LOCATION    = 3; // mat4, takes 3, 4, 5 and 6
+const unsigned int INSTANCE_MATERIAL_LOCATION = 7;
+
+struct InstanceData {
+    glm::mat4 model;
+    unsigned int material; // free for the shader to index with, 0 if unused
+};
+
+// Per-instance attributes streamed from one buffer. The same buffer can be attached to any number of
+// VAOs, a draw of N instances then reads the first N entries.
+class InstanceBuffer {
+public:
+    /* Functions */
+    InstanceBuffer() : VBO(0), capacity(0), count(0) {}
+    ~InstanceBuffer() {
+        if(VBO)
+            glDeleteBuffers(1, &VBO);
+    }
+    // Replaces the contents, call whenever the instances move
+    void Update(const InstanceData *instances, unsigned int count);
+    void Update(const vector<InstanceData> &instances) {
+        Update(instances.empty() ? NULL : &instances[0], (unsigned int)instances.size());
+    }
+    // Points the instance attributes of vao at this buffer, leaves vao bound
+    void Attach(unsigned int vao) const;
+    unsigned int Count() const { return count; }
+    unsigned int ID() const { return VBO; }
+private:
+    /* Buffer Data */
+    unsigned int VBO;
+    unsigned int capacity;
+    unsigned int count;
+    // not copyable, the buffer is owned
+    InstanceBuffer(const InstanceBuffer &);
+    InstanceBuffer &operator=(const InstanceBuffer &);
+};
+
+void InstanceBuffer::Update(const InstanceData *instances, unsigned int count) {
+    if(!VBO)
+        glGenBuffers(1, &VBO);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    // grow by half again so a slowly growing crowd doesn't reallocate every frame
+    if(count > capacity)
+        capacity = count + count / 2;
+    // fresh storage either way, a draw still reading the old contents doesn't stall the upload
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(InstanceData), NULL, GL_DYNAMIC_DRAW);
+    if(count > 0)
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(InstanceData), instances);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    this->count = count;
+}
+
+void InstanceBuffer::Attach(unsigned int vao) const {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    // a mat4 attribute is four vec4 columns
+    for(unsigned int column = 0; column < 4; column++) {
+        unsigned int location = INSTANCE_MODEL_LOCATION + column;
+        glEnableVertexAttribArray(location);
+        glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void *)(offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+        glVertexAttribDivisor(location, 1);
+    }
+    glEnableVertexAttribArray(INSTANCE_MATERIAL_LOCATION);
+    glVertexAttribIPointer(INSTANCE_MATERIAL_LOCATION, 1, GL_UNSIGNED_INT, sizeof(InstanceData), (void *)offsetof(InstanceData, material));
+    glVertexAttribDivisor(INSTANCE_MATERIAL_LOCATION, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+#endif /* instance_buffer_h */
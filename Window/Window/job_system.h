@@ -0,0 +1,329 @@
+//
+//  job_system.h
+//  Window
+//
+//  Created by William Goniprow on 2/21/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef job_system_h
+#define job_system_h
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Counts the unfinished jobs started with it, Wait on it to join them
+struct JobCounter {
+    atomic<unsigned int> pending;
+    JobCounter() : pending(0) {}
+    bool Done() const { return pending.load() == 0; }
+};
+
+struct JobWorkerStats {
+    unsigned long long jobs;
+    unsigned long long steals;   // jobs taken from another worker's queue
+    double busySeconds;
+    double utilization;          // busy fraction of the time since ResetStats
+};
+
+// Work stealing scheduler. Every worker owns a deque, jobs it spawns go to the back of its own deque and it
+// takes work from the back too, so nested jobs run depth first while the data is still in cache. A worker that
+// runs dry steals the oldest job from the front of another worker's deque. Jobs from other threads are dealt
+// out to the workers round robin.
+// Jobs must not touch OpenGL. GL work goes through RunOnMainThread and runs when the main thread calls
+// RunMainThreadJobs, or while it is blocked in Wait.
+class JobSystem {
+public:
+    /* Functions */
+    // The creating thread runs the main thread jobs unless SetMainThread moves them
+    JobSystem(unsigned int numWorkers);
+    ~JobSystem();
+    // Queues job on any worker, counter (if given) drops back once it has run
+    void Run(function<void()> job, JobCounter *counter = NULL);
+    // Queues job for the main thread
+    void RunOnMainThread(function<void()> job, JobCounter *counter = NULL);
+    // Runs the queued main thread jobs and returns how many, main thread only
+    unsigned int RunMainThreadJobs();
+    // Runs other jobs until counter reaches zero instead of blocking
+    void Wait(JobCounter &counter);
+    // Calls func(begin, end) over [0, count) in ranges of grain items across the workers and the caller,
+    // returns when all are done. Ranges no bigger than grain run inline on the caller.
+    void ParallelFor(unsigned int count, unsigned int grain, const function<void(unsigned int, unsigned int)> &func);
+    // Calls func(i) for every i in [0, count), one index per job
+    void ParallelFor(unsigned int count, const function<void(unsigned int)> &func);
+    unsigned int NumWorkers() const { return (unsigned int)threads.size(); }
+    bool IsMainThread() const { return this_thread::get_id() == mainThread.load(); }
+    // Hands main thread jobs to the calling thread, for when the GL context lives on another thread than the creator
+    void SetMainThread() { mainThread = this_thread::get_id(); }
+    vector<JobWorkerStats> Stats() const;
+    void ResetStats();
+private:
+    /* Scheduler Data */
+    struct Job {
+        function<void()> work;
+        JobCounter *counter;
+    };
+    struct Worker {
+        mutex lock;
+        deque<Job> jobs;
+        atomic<unsigned long long> executed;
+        atomic<unsigned long long> steals;
+        atomic<unsigned long long> busyNanoseconds;
+    };
+    vector<Worker *> workers;
+    vector<thread> threads;
+    mutex mainLock;
+    deque<Job> mainJobs;
+    mutex sleepLock;
+    condition_variable wake;
+    atomic<unsigned int> queued;
+    atomic<unsigned int> nextWorker;
+    atomic<bool> stopping;
+    atomic<thread::id> mainThread;
+    chrono::steady_clock::time_point statsStart;
+    /* Functions */
+    void workerLoop(int index);
+    bool runOne(int self);
+    void execute(Job &job, int self, bool stolen);
+    static int &currentWorker();
+    // not copyable, the threads are owned
+    JobSystem(const JobSystem &);
+    JobSystem &operator=(const JobSystem &);
+};
+
+// Worker count for Jobs(), 0 means one per core besides the main thread. Only has an effect before the first Jobs()
+unsigned int &JobWorkerSetting() {
+    static unsigned int workers = 0;
+    return workers;
+}
+
+// --workers N, 0 if not given
+unsigned int ParseJobWorkers(int argc, char **argv) {
+    for(int i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--workers") == 0)
+            return (unsigned int)strtoul(argv[i + 1], NULL, 10);
+    }
+    return 0;
+}
+
+// The process wide scheduler shared by loading, culling and rendering
+JobSystem &Jobs() {
+    static JobSystem jobs(JobWorkerSetting() ? JobWorkerSetting() : (thread::hardware_concurrency() > 1 ? thread::hardware_concurrency() - 1 : 1));
+    return jobs;
+}
+
+int &JobSystem::currentWorker() {
+    // index of the worker running on this thread, -1 everywhere else
+    static thread_local int index = -1;
+    return index;
+}
+
+JobSystem::JobSystem(unsigned int numWorkers) : queued(0), nextWorker(0), stopping(false), mainThread(this_thread::get_id()), statsStart(chrono::steady_clock::now()) {
+    if(numWorkers == 0)
+        numWorkers = 1;
+    for(unsigned int i = 0; i < numWorkers; i++) {
+        Worker *worker = new Worker();
+        worker->executed = 0;
+        worker->steals = 0;
+        worker->busyNanoseconds = 0;
+        workers.push_back(worker);
+    }
+    for(unsigned int i = 0; i < numWorkers; i++) {
+        threads.push_back(thread(&JobSystem::workerLoop, this, (int)i));
+    }
+}
+
+JobSystem::~JobSystem() {
+    {
+        lock_guard<mutex> lock(sleepLock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for(unsigned int i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    for(unsigned int i = 0; i < workers.size(); i++) {
+        delete workers[i];
+    }
+}
+
+void JobSystem::Run(function<void()> job, JobCounter *counter) {
+    if(counter)
+        counter->pending++;
+    Job entry;
+    entry.work = std::move(job);
+    entry.counter = counter;
+    int self = currentWorker();
+    Worker &worker = *workers[self >= 0 ? (unsigned int)self : nextWorker++ % workers.size()];
+    {
+        lock_guard<mutex> lock(worker.lock);
+        worker.jobs.push_back(std::move(entry));
+    }
+    queued++;
+    {
+        // taking the lock orders this against a worker that just found nothing queued and is about to sleep
+        lock_guard<mutex> lock(sleepLock);
+    }
+    wake.notify_one();
+}
+
+void JobSystem::RunOnMainThread(function<void()> job, JobCounter *counter) {
+    if(counter)
+        counter->pending++;
+    Job entry;
+    entry.work = std::move(job);
+    entry.counter = counter;
+    lock_guard<mutex> lock(mainLock);
+    mainJobs.push_back(std::move(entry));
+}
+
+unsigned int JobSystem::RunMainThreadJobs() {
+    if(!IsMainThread())
+        return 0;
+    deque<Job> batch;
+    {
+        lock_guard<mutex> lock(mainLock);
+        batch.swap(mainJobs);
+    }
+    for(unsigned int i = 0; i < batch.size(); i++) {
+        batch[i].work();
+        if(batch[i].counter)
+            batch[i].counter->pending--;
+    }
+    return (unsigned int)batch.size();
+}
+
+void JobSystem::execute(Job &job, int self, bool stolen) {
+    // jobs run while a job Waits are nested in it, only the outermost one counts towards busy time
+    static thread_local unsigned int depth = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    depth++;
+    job.work();
+    depth--;
+    if(job.counter)
+        job.counter->pending--;
+    if(self >= 0) {
+        Worker &worker = *workers[self];
+        worker.executed++;
+        if(stolen)
+            worker.steals++;
+        if(depth == 0)
+            worker.busyNanoseconds += (unsigned long long)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    }
+}
+
+bool JobSystem::runOne(int self) {
+    Job job;
+    // own work first, newest job, then the oldest job of everyone else starting with the next worker over
+    if(self >= 0) {
+        Worker &worker = *workers[self];
+        unique_lock<mutex> lock(worker.lock);
+        if(!worker.jobs.empty()) {
+            job = std::move(worker.jobs.back());
+            worker.jobs.pop_back();
+            lock.unlock();
+            queued--;
+            execute(job, self, false);
+            return true;
+        }
+    }
+    unsigned int count = (unsigned int)workers.size();
+    unsigned int start = self >= 0 ? (unsigned int)self + 1 : nextWorker.load();
+    for(unsigned int i = 0; i < count; i++) {
+        unsigned int victim = (start + i) % count;
+        if((int)victim == self)
+            continue;
+        Worker &worker = *workers[victim];
+        unique_lock<mutex> lock(worker.lock);
+        if(worker.jobs.empty())
+            continue;
+        job = std::move(worker.jobs.front());
+        worker.jobs.pop_front();
+        lock.unlock();
+        queued--;
+        execute(job, self, true);
+        return true;
+    }
+    return false;
+}
+
+void JobSystem::workerLoop(int index) {
+    currentWorker() = index;
+    while(true) {
+        if(runOne(index))
+            continue;
+        unique_lock<mutex> lock(sleepLock);
+        wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+        if(stopping && queued.load() == 0)
+            return;
+    }
+}
+
+void JobSystem::Wait(JobCounter &counter) {
+    int self = currentWorker();
+    while(!counter.Done()) {
+        // the main thread may be waiting on a job only it can run
+        if(IsMainThread() && RunMainThreadJobs() > 0)
+            continue;
+        if(!runOne(self))
+            this_thread::yield();
+    }
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int grain, const function<void(unsigned int, unsigned int)> &func) {
+    if(count == 0)
+        return;
+    if(grain == 0)
+        grain = 1;
+    if(count <= grain) {
+        func(0, count);
+        return;
+    }
+    // the caller takes the first range itself instead of just blocking
+    JobCounter counter;
+    for(unsigned int begin = grain; begin < count; begin += grain) {
+        unsigned int end = count - begin > grain ? begin + grain : count;
+        Run([&func, begin, end]() { func(begin, end); }, &counter);
+    }
+    func(0, grain);
+    Wait(counter);
+}
+
+void JobSystem::ParallelFor(unsigned int count, const function<void(unsigned int)> &func) {
+    ParallelFor(count, 1, [&func](unsigned int begin, unsigned int end) {
+        for(unsigned int i = begin; i < end; i++)
+            func(i);
+    });
+}
+
+vector<JobWorkerStats> JobSystem::Stats() const {
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - statsStart).count();
+    vector<JobWorkerStats> stats(workers.size());
+    for(unsigned int i = 0; i < workers.size(); i++) {
+        stats[i].jobs = workers[i]->executed;
+        stats[i].steals = workers[i]->steals;
+        stats[i].busySeconds = workers[i]->busyNanoseconds / 1e9;
+        stats[i].utilization = elapsed > 0.0 ? stats[i].busySeconds / elapsed : 0.0;
+    }
+    return stats;
+}
+
+void JobSystem::ResetStats() {
+    for(unsigned int i = 0; i < workers.size(); i++) {
+        workers[i]->executed = 0;
+        workers[i]->steals = 0;
+        workers[i]->busyNanoseconds = 0;
+    }
+    statsStart = chrono::steady_clock::now();
+}
+
+#endif /* job_system_h */
@@ -0,0 +1,443 @@
+//
+//  ktx2.h
+//  Window
+//
+//  Created by William Goniprow on 2/27/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef ktx2_h
+#define ktx2_h
+
+#include <glad/glad.h>
+
+#include "bc_encoder.h"
+#include "mapped_file.h"
+#include "mipmap.h"
+
+#if defined(KTX2_ZLIB)
+#include <zlib.h>
+#endif
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// KTX 2.0 textures (https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html), 2D with any number of mip levels.
+// The file is mapped and the levels go to GL straight from the mapped pages, nothing is decoded or copied on
+// the heap unless the levels are supercompressed. Zlib supercompression needs KTX2_ZLIB defined and -lz, Zstandard
+// and Basis Universal aren't supported.
+
+const unsigned char KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// GL_EXT_texture_sRGB with S3TC, and the sRGB half of BPTC
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+enum Ktx2_Supercompression {
+    KTX2_SUPERCOMPRESSION_NONE = 0,
+    KTX2_SUPERCOMPRESSION_ZSTD = 2,
+    KTX2_SUPERCOMPRESSION_ZLIB = 3
+};
+
+struct Ktx2Header {
+    unsigned char identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct Ktx2LevelIndex {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+// A Vulkan format this loader can upload and what GL calls it
+struct Ktx2Format {
+    uint32_t vkFormat;
+    GLenum internalFormat;
+    GLenum format;          // and type, for the uncompressed formats
+    GLenum type;
+    unsigned int channels;  // of the uncompressed formats, 0 for block formats
+    unsigned int bytes;     // per texel, or per 4x4 block
+    Bc_Format bc;
+    bool srgb;
+};
+
+const Ktx2Format KTX2_FORMATS[] = {
+    {   9, GL_R8,           GL_RED,  GL_UNSIGNED_BYTE, 1, 1,  BC_FORMAT_NONE, false }, // R8_UNORM
+    {  16, GL_RG8,          GL_RG,   GL_UNSIGNED_BYTE, 2, 2,  BC_FORMAT_NONE, false }, // R8G8_UNORM
+    {  23, GL_RGB8,         GL_RGB,  GL_UNSIGNED_BYTE, 3, 3,  BC_FORMAT_NONE, false }, // R8G8B8_UNORM
+    {  29, GL_SRGB8,        GL_RGB,  GL_UNSIGNED_BYTE, 3, 3,  BC_FORMAT_NONE, true  }, // R8G8B8_SRGB
+    {  37, GL_RGBA8,        GL_RGBA, GL_UNSIGNED_BYTE, 4, 4,  BC_FORMAT_NONE, false }, // R8G8B8A8_UNORM
+    {  43, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, 4,  BC_FORMAT_NONE, true  }, // R8G8B8A8_SRGB
+    { 131, GL_COMPRESSED_RGB_S3TC_DXT1_EXT,        GL_NONE, GL_NONE, 0, 8,  BC_FORMAT_BC1, false }, // BC1_RGB_UNORM_BLOCK
+    { 132, GL_COMPRESSED_SRGB_S3TC_DXT1_EXT,       GL_NONE, GL_NONE, 0, 8,  BC_FORMAT_BC1, true  }, // BC1_RGB_SRGB_BLOCK
+    { 137, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,       GL_NONE, GL_NONE, 0, 16, BC_FORMAT_BC3, false }, // BC3_UNORM_BLOCK
+    { 138, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, GL_NONE, GL_NONE, 0, 16, BC_FORMAT_BC3, true  }, // BC3_SRGB_BLOCK
+    { 139, GL_COMPRESSED_RED_RGTC1,                GL_NONE, GL_NONE, 0, 8,  BC_FORMAT_BC4, false }, // BC4_UNORM_BLOCK
+    { 141, GL_COMPRESSED_RG_RGTC2,                 GL_NONE, GL_NONE, 0, 16, BC_FORMAT_BC5, false }, // BC5_UNORM_BLOCK
+    { 145, GL_COMPRESSED_RGBA_BPTC_UNORM,          GL_NONE, GL_NONE, 0, 16, BC_FORMAT_BC7, false }, // BC7_UNORM_BLOCK
+    { 146, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM,    GL_NONE, GL_NONE, 0, 16, BC_FORMAT_BC7, true  }  // BC7_SRGB_BLOCK
+};
+
+const Ktx2Format *Ktx2FindFormat(uint32_t vkFormat) {
+    for(unsigned int i = 0; i < sizeof(KTX2_FORMATS) / sizeof(KTX2_FORMATS[0]); i++) {
+        if(KTX2_FORMATS[i].vkFormat == vkFormat)
+            return &KTX2_FORMATS[i];
+    }
+    return NULL;
+}
+
+// The non-sRGB format for a block format or an uncompressed channel count, what the converter writes.
+// Our textures hold sRGB bytes but are sampled as UNORM, like the PNGs they come from
+const Ktx2Format *Ktx2FindFormat(Bc_Format bc, unsigned int channels) {
+    for(unsigned int i = 0; i < sizeof(KTX2_FORMATS) / sizeof(KTX2_FORMATS[0]); i++) {
+        const Ktx2Format &format = KTX2_FORMATS[i];
+        if(!format.srgb && format.bc == bc && (bc != BC_FORMAT_NONE || format.channels == channels))
+            return &format;
+    }
+    return NULL;
+}
+
+// Bytes a level of format takes before supercompression
+size_t Ktx2LevelBytes(const Ktx2Format &format, unsigned int width, unsigned int height) {
+    if(format.bc != BC_FORMAT_NONE)
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * format.bytes;
+    return (size_t)width * height * format.bytes;
+}
+
+// A mapped .ktx2 file. Open checks it, Prepare pulls the levels into memory off the GL thread,
+// Upload hands them to GL. Open and Prepare are safe in a job, Upload is GL thread only
+class Ktx2File {
+public:
+    /* Functions */
+    Ktx2File() : format(NULL) {}
+    // Maps and validates path, prints why and returns false if it can't be uploaded
+    bool Open(const string &path);
+    // Faults the mapped levels in, or inflates supercompressed ones
+    bool Prepare();
+    unsigned int Width() const { return header.pixelWidth; }
+    unsigned int Height() const { return header.pixelHeight; }
+    unsigned int NumLevels() const { return max(header.levelCount, 1u); }
+    const Ktx2Format &Format() const { return *format; }
+    // Uploads up to maxLevels levels into the bound GL_TEXTURE_2D, returns roughly what they take in video memory
+    size_t Upload(unsigned int maxLevels = ~0u) const;
+private:
+    /* File Data */
+    string path;
+    MappedFile file;
+    Ktx2Header header;
+    vector<Ktx2LevelIndex> levels;
+    const Ktx2Format *format;
+    vector<vector<unsigned char> > inflated; // supercompressed levels, decompressed by Prepare
+    /* Functions */
+    const unsigned char *levelData(unsigned int level) const;
+    // not copyable, the mapping is owned
+    Ktx2File(const Ktx2File &);
+    Ktx2File &operator=(const Ktx2File &);
+};
+
+bool Ktx2File::Open(const string &path) {
+    this->path = path;
+    if(!file.Open(path) || file.Size() < sizeof(Ktx2Header)) {
+        cout << "ERROR::KTX2::FILE_NOT_READ " << path << endl;
+        return false;
+    }
+    memcpy(&header, file.Data(), sizeof(header));
+    if(memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0) {
+        cout << "ERROR::KTX2::NOT_KTX2 " << path << endl;
+        return false;
+    }
+    // plain 2D textures only, no arrays, cube maps or volumes
+    if(header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0 || header.layerCount > 1 || header.faceCount != 1) {
+        cout << "ERROR::KTX2::NOT_2D " << path << endl;
+        return false;
+    }
+    format = Ktx2FindFormat(header.vkFormat);
+    if(!format || (format->bc != BC_FORMAT_NONE && !BcSupported(format->bc))) {
+        cout << "ERROR::KTX2::FORMAT_UNSUPPORTED " << header.vkFormat << " " << path << endl;
+        return false;
+    }
+    // without EXT_texture_sRGB the SRGB DXT blocks go up as UNORM, the way our own textures are sampled anyway
+    if(format->srgb && (format->bc == BC_FORMAT_BC1 || format->bc == BC_FORMAT_BC3) && !GLExt().textureS3TCsRGB)
+        format = Ktx2FindFormat(format->bc, 0);
+    bool zlib = header.supercompressionScheme == KTX2_SUPERCOMPRESSION_ZLIB;
+#if !defined(KTX2_ZLIB)
+    zlib = false;
+#endif
+    if(header.supercompressionScheme != KTX2_SUPERCOMPRESSION_NONE && !zlib) {
+        cout << "ERROR::KTX2::SUPERCOMPRESSION_UNSUPPORTED " << header.supercompressionScheme << " " << path << endl;
+        return false;
+    }
+
+    // the level index follows the header, level 0 first, and every level has to lie inside the file
+    const unsigned int numLevels = NumLevels();
+    if(numLevels > MipLevelCount(header.pixelWidth, header.pixelHeight)) {
+        cout << "ERROR::KTX2::BAD_LEVEL_COUNT " << header.levelCount << " " << path << endl;
+        return false;
+    }
+    if(sizeof(Ktx2Header) + numLevels * sizeof(Ktx2LevelIndex) > file.Size()) {
+        cout << "ERROR::KTX2::TRUNCATED " << path << endl;
+        return false;
+    }
+    levels.resize(numLevels);
+    memcpy(&levels[0], file.Data() + sizeof(Ktx2Header), numLevels * sizeof(Ktx2LevelIndex));
+    unsigned int width = header.pixelWidth, height = header.pixelHeight;
+    for(unsigned int i = 0; i < numLevels; i++) {
+        const Ktx2LevelIndex &level = levels[i];
+        const uint64_t expected = Ktx2LevelBytes(*format, width, height);
+        const uint64_t stored = zlib ? level.uncompressedByteLength : level.byteLength;
+        if(level.byteOffset > file.Size() || level.byteLength > file.Size() - level.byteOffset || stored != expected) {
+            cout << "ERROR::KTX2::BAD_LEVEL " << i << " " << path << endl;
+            return false;
+        }
+        width  = max(width / 2, 1u);
+        height = max(height / 2, 1u);
+    }
+    return true;
+}
+
+bool Ktx2File::Prepare() {
+    if(header.supercompressionScheme == KTX2_SUPERCOMPRESSION_NONE) {
+        file.Prefetch();
+        return true;
+    }
+#if defined(KTX2_ZLIB)
+    inflated.resize(NumLevels());
+    for(unsigned int i = 0; i < NumLevels(); i++) {
+        inflated[i].resize((size_t)levels[i].uncompressedByteLength);
+        uLongf length = (uLongf)inflated[i].size();
+        if(uncompress(&inflated[i][0], &length, (const Bytef *)file.Data() + levels[i].byteOffset, (uLong)levels[i].byteLength) != Z_OK ||
+           length != inflated[i].size()) {
+            cout << "ERROR::KTX2::INFLATE_FAILED " << i << " " << path << endl;
+            return false;
+        }
+    }
+    // the mapped copies aren't needed anymore
+    file.Close();
+    return true;
+#else
+    return false;
+#endif
+}
+
+const unsigned char *Ktx2File::levelData(unsigned int level) const {
+    if(!inflated.empty())
+        return &inflated[level][0];
+    return (const unsigned char *)file.Data() + levels[level].byteOffset;
+}
+
+size_t Ktx2File::Upload(unsigned int maxLevels) const {
+    const unsigned int numLevels = min(NumLevels(), max(maxLevels, 1u));
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // KTX2 rows are tightly packed
+    size_t bytes = 0;
+    unsigned int width = Width(), height = Height();
+    for(unsigned int i = 0; i < numLevels; i++) {
+        const size_t size = Ktx2LevelBytes(*format, width, height);
+        if(format->bc != BC_FORMAT_NONE)
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, format->internalFormat, width, height, 0, (GLsizei)size, levelData(i));
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, format->internalFormat, width, height, 0, format->format, format->type, levelData(i));
+        // drivers pad RGB out to four bytes
+        bytes += format->channels == 3 ? size / 3 * 4 : size;
+        width  = max(width / 2, 1u);
+        height = max(height / 2, 1u);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
+    // BC4 is sampled as grey, the same as when the loader compresses a mask itself
+    const bool grey = format->bc == BC_FORMAT_BC4;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_G, grey ? GL_RED : GL_GREEN);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_B, grey ? GL_RED : GL_BLUE);
+    return bytes;
+}
+
+/* Writing */
+
+// Basic data format descriptor (Khronos Data Format 1.3) for format, which KTX2 requires
+void ktx2DataFormatDescriptor(const Ktx2Format &format, vector<uint32_t> &dfd) {
+    struct Sample { uint32_t offset, length, channel, lower, upper; };
+    vector<Sample> samples;
+    uint32_t model = 1; // KHR_DF_MODEL_RGBSDA
+    unsigned int blockSize = 1;
+    if(format.bc == BC_FORMAT_NONE) {
+        for(unsigned int c = 0; c < format.channels; c++) {
+            // alpha is channel 15 and never has the sRGB transfer applied
+            uint32_t channel = c == 3 ? 15 | (format.srgb ? 0x10 : 0) : c;
+            Sample sample = { c * 8, 8, channel, 0, 255 };
+            samples.push_back(sample);
+        }
+    }
+    else {
+        blockSize = 4;
+        const Sample color  = { 0,  64, 0,  0, 0xFFFFFFFF };
+        const Sample alpha  = { 0,  64, 15, 0, 0xFFFFFFFF };
+        const Sample second = { 64, 64, 1,  0, 0xFFFFFFFF };
+        switch(format.bc) {
+            case BC_FORMAT_BC1: model = 128; samples.push_back(color); break;
+            case BC_FORMAT_BC3: {
+                model = 130;
+                samples.push_back(alpha);
+                Sample rgb = { 64, 64, 0, 0, 0xFFFFFFFF };
+                samples.push_back(rgb);
+                break;
+            }
+            case BC_FORMAT_BC4: model = 131; samples.push_back(color); break;
+            case BC_FORMAT_BC5: model = 132; samples.push_back(color); samples.push_back(second); break;
+            case BC_FORMAT_BC7: {
+                model = 134;
+                Sample whole = { 0, 128, 0, 0, 0xFFFFFFFF };
+                samples.push_back(whole);
+                break;
+            }
+            default: break;
+        }
+    }
+    const uint32_t descriptorSize = 24 + 16 * (uint32_t)samples.size();
+    dfd.clear();
+    dfd.push_back(4 + descriptorSize);        // dfdTotalSize
+    dfd.push_back(0);                         // vendor Khronos, basic descriptor
+    dfd.push_back(2 | descriptorSize << 16);  // version 1.3
+    // BT.709 primaries, transfer function sRGB or linear, straight alpha
+    dfd.push_back(model | 1 << 8 | (format.srgb ? 2u : 1u) << 16);
+    dfd.push_back((blockSize - 1) | (blockSize - 1) << 8);
+    dfd.push_back(format.bytes);              // bytesPlane0
+    dfd.push_back(0);
+    for(unsigned int i = 0; i < samples.size(); i++) {
+        dfd.push_back(samples[i].offset | (samples[i].length - 1) << 16 | samples[i].channel << 24);
+        dfd.push_back(0); // sample position
+        dfd.push_back(samples[i].lower);
+        dfd.push_back(samples[i].upper);
+    }
+}
+
+// Writes levels (level 0 first) of format as a KTX2 file, zlib supercompressed if asked to and built with KTX2_ZLIB
+bool WriteKtx2(const string &path, const Ktx2Format &format, unsigned int width, unsigned int height,
+               const vector<const vector<unsigned char> *> &levelData, Ktx2_Supercompression supercompression) {
+#if !defined(KTX2_ZLIB)
+    if(supercompression == KTX2_SUPERCOMPRESSION_ZLIB) {
+        cout << "ERROR::KTX2::ZLIB_NOT_BUILT_IN " << path << endl;
+        return false;
+    }
+#endif
+    if(supercompression == KTX2_SUPERCOMPRESSION_ZSTD || levelData.empty())
+        return false;
+    const unsigned int numLevels = (unsigned int)levelData.size();
+
+    vector<uint32_t> dfd;
+    ktx2DataFormatDescriptor(format, dfd);
+    const char writer[] = "KTXwriter\0ktx2convert";
+    const uint32_t keyValueLength = sizeof(writer);
+
+    Ktx2Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+    header.vkFormat = format.vkFormat;
+    header.typeSize = 1;
+    header.pixelWidth = width;
+    header.pixelHeight = height;
+    header.faceCount = 1;
+    header.levelCount = numLevels;
+    header.supercompressionScheme = supercompression;
+    header.dfdByteOffset = (uint32_t)(sizeof(Ktx2Header) + numLevels * sizeof(Ktx2LevelIndex));
+    header.dfdByteLength = (uint32_t)(dfd.size() * sizeof(uint32_t));
+    header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+    header.kvdByteLength = (4 + keyValueLength + 3) & ~3u;
+
+    // level data goes smallest first, each level aligned to the texel block (and 4) unless supercompressed
+    vector<vector<unsigned char> > stored(numLevels);
+    vector<Ktx2LevelIndex> index(numLevels);
+    uint64_t alignment = format.bytes % 4 == 0 ? format.bytes : format.bytes % 2 == 0 ? format.bytes * 2 : format.bytes * 4;
+    if(supercompression != KTX2_SUPERCOMPRESSION_NONE)
+        alignment = 1;
+    uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+    for(int i = (int)numLevels - 1; i >= 0; i--) {
+        const vector<unsigned char> &data = *levelData[i];
+        index[i].uncompressedByteLength = data.size();
+        if(supercompression == KTX2_SUPERCOMPRESSION_NONE) {
+            stored[i] = data;
+        }
+#if defined(KTX2_ZLIB)
+        else {
+            uLongf length = compressBound((uLong)data.size());
+            stored[i].resize(length);
+            if(compress2(&stored[i][0], &length, &data[0], (uLong)data.size(), Z_BEST_COMPRESSION) != Z_OK)
+                return false;
+            stored[i].resize(length);
+        }
+#endif
+        offset = (offset + alignment - 1) / alignment * alignment;
+        index[i].byteOffset = offset;
+        index[i].byteLength = stored[i].size();
+        offset += stored[i].size();
+    }
+
+    return WriteFileAtomically(path, [&](ostream &out) {
+        out.write((const char *)&header, sizeof(header));
+        out.write((const char *)&index[0], numLevels * sizeof(Ktx2LevelIndex));
+        out.write((const char *)&dfd[0], header.dfdByteLength);
+        out.write((const char *)&keyValueLength, sizeof(keyValueLength));
+        out.write(writer, keyValueLength);
+        const char padding[16] = {0};
+        out.write(padding, header.kvdByteLength - 4 - keyValueLength);
+        uint64_t written = header.kvdByteOffset + header.kvdByteLength;
+        for(int i = (int)numLevels - 1; i >= 0; i--) {
+            out.write(padding, index[i].byteOffset - written);
+            if(!stored[i].empty())
+                out.write((const char *)&stored[i][0], stored[i].size());
+            written = index[i].byteOffset + stored[i].size();
+        }
+    });
+}
+
+bool WriteKtx2(const string &path, const MipChain &chain, Ktx2_Supercompression supercompression) {
+    const Ktx2Format *format = Ktx2FindFormat(BC_FORMAT_NONE, chain.channels);
+    if(!format || chain.levels.empty())
+        return false;
+    vector<const vector<unsigned char> *> levels;
+    for(unsigned int i = 0; i < chain.levels.size(); i++) {
+        levels.push_back(&chain.levels[i].pixels);
+    }
+    return WriteKtx2(path, *format, chain.levels[0].width, chain.levels[0].height, levels, supercompression);
+}
+
+bool WriteKtx2(const string &path, const BcImage &image, Ktx2_Supercompression supercompression) {
+    const Ktx2Format *format = Ktx2FindFormat(image.format, 0);
+    if(!format || image.levels.empty())
+        return false;
+    vector<const vector<unsigned char> *> levels;
+    for(unsigned int i = 0; i < image.levels.size(); i++) {
+        levels.push_back(&image.levels[i].blocks);
+    }
+    return WriteKtx2(path, *format, image.levels[0].width, image.levels[0].height, levels, supercompression);
+}
+
+#endif /* ktx2_h */
@@ -12,7 +12,6 @@ struct DirLight {
     vec3 diffuse;
     vec3 specular;
 };
-uniform DirLight dirLight;
 
 struct PointLight {
     vec3 position;
@@ -26,7 +25,6 @@ struct PointLight {
     vec3 specular;
 };
 #define NR_POINT_LIGHTS 4
-uniform PointLight pointLights[NR_POINT_LIGHTS];
 
 struct SpotLight {
     vec3 position;
@@ -42,7 +40,19 @@ struct SpotLight {
     vec3 diffuse;
     vec3 specular;
 };
-uniform SpotLight spotLight;
+
+// shared by every program, see frame_uniforms.h
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
+layout (std140) uniform Lights {
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight;
+};
 
 out vec4 FragColor;
 
@@ -51,7 +61,6 @@ in vec3 Normal;
 in vec3 FragPos;
 
 uniform Material material;
-uniform vec3 viewPos;
 
 // Functions
 vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
@@ -9,13 +9,18 @@ out vec2 TexCoords;
 
 // uniform mat4 transform;
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// shared by every program, see frame_uniforms.h
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
 
 void main() {
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal;
     TexCoords = aTexCoords;
     
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = viewProjection * model * vec4(aPos, 1.0);
 }
@@ -0,0 +1,36 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;       // float, or unorm16 relative to the mesh bounds
+layout (location = 1) in vec2 aNormal;    // octahedral encoded
+layout (location = 2) in vec2 aTexCoords; // half floats
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+
+uniform mat4 model;
+// shared by every program, see frame_uniforms.h
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
+// set by Mesh::Draw, identity for VERTEX_PACKED
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 octahedralDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+void main() {
+    vec3 position = aPos * positionScale + positionOffset;
+    FragPos = vec3(model * vec4(position, 1.0));
+    Normal = mat3(transpose(inverse(model))) * octahedralDecode(aNormal);
+    TexCoords = aTexCoords;
+    
+    gl_Position = viewProjection * model * vec4(position, 1.0);
+}
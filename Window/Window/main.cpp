@@ -11,7 +11,11 @@
 #include <math.h>
 
 #include <glad/glad.h>
+#ifndef WINDOW_NO_GLFW
 #include <GLFW/glfw3.h>
+#else
+#include "no_glfw.h"    // Linux builds without GLFW, --headless only
+#endif
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -19,17 +23,28 @@
 
 #include "shader.h"
 #include "camera.h"
+#include "frame_uniforms.h"
+#include "headless.h"
+#include "input_recorder.h"
+#include "job_system.h"
 #include "model.h"
+#include "profiler.h"
+#include "render_thread.h"
+#include "texture_cache.h"
+#include "texture_loader.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void processInput(GLFWwindow* window);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
-unsigned int loadTexture(char const* path);
+TextureHandle loadTexture(char const* path);
+void render(RenderThread &renderer, GLFWwindow *window, HeadlessContext *offscreen, const string &output);
 
 //Settings
 const unsigned int SCR_WIDTH = 1280;
 const unsigned int SCR_HEIGHT = 720;
+const unsigned int MODEL_RECORD_GRAIN = 16; // model instances recorded per job
 
 // Timing
 float deltaTime = 0.0f;
@@ -41,280 +56,499 @@ float lastX = (float)SCR_WIDTH / 2.0f;
 float lastY = (float)SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
 
-int main() {
-    // glfw: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    
+// Input, recorded to or replayed from a file with --record / --replay
+InputRecorder input;
+
+// Simulation state the render thread gets through the frame packets
+GLenum polygonMode = GL_FILL;
+int framebufferWidth = SCR_WIDTH;
+int framebufferHeight = SCR_HEIGHT;
+
+// What the frame uniform stream buffer saw, the render thread fills it in as it exits
+StreamBufferStats frameUniformStats = StreamBufferStats();
+
+// Objects the render thread has geometry for, see PacketObject
+enum Scene_Object {
+    SCENE_CUBE,
+    SCENE_FLOOR
+};
+
+int main(int argc, char **argv) {
+    // --headless renders a fixed number of frames offscreen through EGL and exits, see headless.h
+    HeadlessOptions headless = ParseHeadlessOptions(argc, argv, SCR_WIDTH, SCR_HEIGHT);
+    HeadlessContext offscreen;
+    input.Open(ParseInputOptions(argc, argv));
+    // --workers N sizes the job system, before anything starts it
+    JobWorkerSetting() = ParseJobWorkers(argc, argv);
+    // --texture-budget MB caps the video memory cached textures may take, see texture_cache.h
+    if(size_t textureBudget = ParseTextureBudget(argc, argv))
+        SharedTextures().SetBudget(textureBudget);
+    // --mip-cache keeps filtered mip chains next to the textures, see mipmap.h
+    MipCacheSetting() = ParseMipCache(argc, argv);
+    // --compress-textures [fast|normal|high] block compresses textures at load and caches them, see bc_encoder.h
+    TextureCompression() = ParseTextureCompression(argc, argv);
+    GLFWwindow* window = NULL;
+    if(headless.enabled) {
+        if(!offscreen.Create(headless.width, headless.height))
+            return -1;
+        if(!gladLoadGLLoader((GLADloadproc)HeadlessContext::GetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+        LoadGLExtensions((GLADloadproc)HeadlessContext::GetProcAddress);
+        if(!offscreen.CreateFramebuffer())
+            return -1;
+        framebufferWidth = headless.width;
+        framebufferHeight = headless.height;
+    }
+    else {
+        // glfw: initialize and configure
+        // ------------------------------
+        if(!glfwInit()) {
+            std::cout << "Failed to initialize GLFW" << std::endl;
+            return -1;
+        }
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        
 #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
-    
-    // glfw window creation
-    // --------------------
-    GLFWwindow* window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if(window == NULL) {
-        std::cout << "Failed to create window" << std::endl;
-        glfwTerminate();
-        return -1;
+        
+        // glfw window creation
+        // --------------------
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+        if(window == NULL) {
+            std::cout << "Failed to create window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);     // Tell OpenGL if the user resized the window
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+        
+        // tell GLFW to capture our mouse
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        
+        // glad: load all OpenGL function pointers
+        // ---------------------------------------
+        if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+        // entry points newer than GL 3.3, used where the driver has them
+        LoadGLExtensions((GLADloadproc)glfwGetProcAddress);
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);     // Tell OpenGL if the user resized the window
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
     
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // the context moves to the render thread, this one keeps the window, input and simulation
+    // ----------------------------------------------------------------------------------------
+    if(headless.enabled)
+        offscreen.ReleaseCurrent();
+    else
+        glfwMakeContextCurrent(NULL);
+    RenderThread renderer;
+    renderer.Start([&](RenderThread &thread) {
+        render(thread, window, headless.enabled ? &offscreen : NULL, headless.output);
+    });
+    
+    const glm::vec3 cubePositions[] = {
+        glm::vec3(-1.0f, 0.0f, -1.0f),
+        glm::vec3( 2.0f, 0.0f,  0.0f)
+    };
+    // bounding spheres for culling, around the object origins
+    const float cubeRadius  = sqrtf(3.0f * 0.5f * 0.5f);
+    const float floorRadius = sqrtf(2.0f * 5.0f * 5.0f);
+    
+    // simulation loop, hands a packet per frame to the render thread
+    // -----------------------------------------------------------------
+    unsigned int frameCount = 0;
+    while(headless.enabled ? frameCount < headless.frames : !glfwWindowShouldClose(window))
+    {
+        // per-frame time logic, headless runs advance a fixed 60Hz step so every run draws the same frames
+        // and recorded or replayed runs step the camera by INPUT_TIMESTEP
+        // --------------------
+        float currentFrame = headless.enabled ? frameCount * INPUT_TIMESTEP : glfwGetTime();
+        frameCount++;
+        deltaTime = input.DeltaTime(currentFrame - lastFrame);
+        lastFrame = currentFrame;
+        // a replay ends the run when it runs out
+        if(!input.BeginFrame())
+            break;
+        // waits while the render thread is FRAME_PACKET_DEPTH - 1 frames behind
+        FramePacket *packet = renderer.BeginFrame();
+        if(!packet)
+            break;
+        {
+            ProfileScope simulateScope("Simulate");
+            
+            // input
+            // -----
+            processInput(window);
+            
+            // snapshot the camera and record the visible objects, the render thread draws from the copy
+            float aspect = framebufferHeight > 0 ? (float)framebufferWidth / (float)framebufferHeight : 1.0f;
+            packet->camera = camera.Snapshot(aspect);
+            packet->lights = LightsBlock();
+            packet->polygonMode = polygonMode;
+            packet->viewportWidth = framebufferWidth;
+            packet->viewportHeight = framebufferHeight;
+            const Frustum &frustum = packet->camera.frustum;
+            for(unsigned int i = 0; i < 2; i++) {
+                if(frustum.IntersectsSphere(cubePositions[i], cubeRadius)) {
+                    PacketObject cube;
+                    cube.object = SCENE_CUBE;
+                    cube.model = glm::translate(glm::mat4(1.0f), cubePositions[i]);
+                    packet->objects.push_back(cube);
+                }
+            }
+            if(frustum.IntersectsSphere(glm::vec3(0.0f, -0.5f, 0.0f), floorRadius)) {
+                PacketObject floor;
+                floor.object = SCENE_FLOOR;
+                floor.model = glm::mat4(1.0f);
+                packet->objects.push_back(floor);
+            }
+        }
+        renderer.SubmitFrame();
+        
+        // glfw: poll IO events (keys pressed/released, mouse moved etc.), buffers are swapped on the render thread
+        // -----------------------------------------------------------------------------------------------------------
+        if(window)
+            glfwPollEvents();
+    }
+    // the render thread draws what was already submitted, then releases the context
+    renderer.Stop();
     
-    // glad: load all OpenGL function pointers
-    // ---------------------------------------
-    if(!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+    // per scope timings over the last few seconds, see profiler.h
+    Profile().WriteCSV("profile.csv");
+    Profile().WriteChromeTrace("profile_trace.json");
+    vector<JobWorkerStats> workerStats = Jobs().Stats();
+    for(unsigned int i = 0; i < workerStats.size(); i++) {
+        std::cout << "Worker " << i << ": " << workerStats[i].jobs << " jobs, " << workerStats[i].steals << " stolen, "
+                  << (int)(workerStats[i].utilization * 100.0 + 0.5) << "% busy" << std::endl;
     }
+    TextureCacheStats textureStats = SharedTextures().Stats();
+    std::cout << "Textures: " << textureStats.textures << " cached, " << (textureStats.residentBytes >> 10) << " KB resident, "
+              << textureStats.evictions << " evicted, " << textureStats.reloads << " reloaded" << std::endl;
+    // stalls are frames where the CPU caught up with the GPU and had to wait for a region of the ring
+    std::cout << "Frame uniforms: " << frameUniformStats.frames << " frames, " << frameUniformStats.stalls << " stalls, "
+              << frameUniformStats.stallMilliseconds << " ms waiting, " << frameUniformStats.peakFrameBytes << " bytes peak per frame" << std::endl;
+    input.Close();
+    if(headless.enabled)
+        return 0;
     
-    // configure global opengl state
-    // -----------------------------
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+    glfwTerminate();
+    return 0;
+}
 
-    // build and compile our shader program
-    // ------------------------------------
-    Shader shader("depth_testing.vs", "depth_testing.fs");
+// Owns the context and every GL object, draws the packets the simulation hands over until it stops
+void render(RenderThread &renderer, GLFWwindow *window, HeadlessContext *offscreen, const string &output) {
+    if(offscreen)
+        offscreen->MakeCurrent();
+    else
+        glfwMakeContextCurrent(window);
+    // GL jobs from the job system run on this thread from now on
+    Jobs().SetMainThread();
+    {
+        // configure global opengl state
+        // -----------------------------
+        glEnable(GL_DEPTH_TEST);
+        glDepthFunc(GL_LESS);
+
+        // build and compile our shader program
+        // ------------------------------------
+        Shader shader("depth_testing.vs", "depth_testing.fs");
+        // the cubes are all the same mesh, they go out in one instanced draw
+        Shader instancedShader("depth_testing_instanced.vs", "depth_testing.fs");
     
-    // set up vertex data (and buffer(s)) and configure vertex attributes
-    // ------------------------------------------------------------------
-    float cubeVertices[] = {
-        // positions          // texture Coords
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-         0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+        // set up vertex data (and buffer(s)) and configure vertex attributes
+        // ------------------------------------------------------------------
+        float cubeVertices[] = {
+            // positions          // texture Coords
+            -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+             0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+            -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
         
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+             0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+            -0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
         
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
         
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
         
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
         
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-         0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-         0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-        -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-        -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-    };
-    float planeVertices[] = {
-        // positions          // texture Coords (note we set these higher than 1 (together with GL_REPEAT as texture wrapping mode). this will cause the floor texture to repeat)
-         5.0f, -0.5f,  5.0f,  2.0f, 0.0f,
-        -5.0f, -0.5f,  5.0f,  0.0f, 0.0f,
-        -5.0f, -0.5f, -5.0f,  0.0f, 2.0f,
+            -0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+             0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+             0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+            -0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
+            -0.5f,  0.5f, -0.5f,  0.0f, 1.0f
+        };
+        float planeVertices[] = {
+            // positions          // texture Coords (note we set these higher than 1 (together with GL_REPEAT as texture wrapping mode). this will cause the floor texture to repeat)
+             5.0f, -0.5f,  5.0f,  2.0f, 0.0f,
+            -5.0f, -0.5f,  5.0f,  0.0f, 0.0f,
+            -5.0f, -0.5f, -5.0f,  0.0f, 2.0f,
         
-         5.0f, -0.5f,  5.0f,  2.0f, 0.0f,
-        -5.0f, -0.5f, -5.0f,  0.0f, 2.0f,
-         5.0f, -0.5f, -5.0f,  2.0f, 2.0f
-    };
+             5.0f, -0.5f,  5.0f,  2.0f, 0.0f,
+            -5.0f, -0.5f, -5.0f,  0.0f, 2.0f,
+             5.0f, -0.5f, -5.0f,  2.0f, 2.0f
+        };
     
-    // cube VAO
-    unsigned int cubeVAO, cubeVBO;
-    glGenVertexArrays(1, &cubeVAO);
-    glGenBuffers(1, &cubeVBO);
-    glBindVertexArray(cubeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glBindVertexArray(0);
-    // plane VAO
-    unsigned int planeVAO, planeVBO;
-    glGenVertexArrays(1, &planeVAO);
-    glGenBuffers(1, &planeVBO);
-    glBindVertexArray(planeVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), &planeVertices, GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glBindVertexArray(0);
-    
-    // load textures
-    // -------------
-    unsigned int cubeTexture  = loadTexture("marble.jpg");
-    unsigned int floorTexture = loadTexture("metal.png");
-    
-    // shader configuration
-    // --------------------
-    shader.use();
-    shader.setInt("texture1", 0);
+        // cube VAO
+        unsigned int cubeVAO, cubeVBO;
+        glGenVertexArrays(1, &cubeVAO);
+        glGenBuffers(1, &cubeVBO);
+        glBindVertexArray(cubeVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), &cubeVertices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glBindVertexArray(0);
+        // plane VAO
+        unsigned int planeVAO, planeVBO;
+        glGenVertexArrays(1, &planeVAO);
+        glGenBuffers(1, &planeVBO);
+        glBindVertexArray(planeVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), &planeVertices, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glBindVertexArray(0);
     
-    // render loop
-    // -----------
-    while(!glfwWindowShouldClose(window))
-    {
-        // per-frame time logic
+        // load textures
+        // -------------
+        TextureHandle cubeTexture  = loadTexture("marble.jpg");
+        TextureHandle floorTexture = loadTexture("metal.png");
+        // what a headless run writes out shouldn't depend on how fast the decodes and mip filtering went
+        if(offscreen)
+            Textures().Finish();
+
+        // shader configuration
         // --------------------
-        float currentFrame = glfwGetTime();
-        deltaTime = currentFrame - lastFrame;
-        lastFrame = currentFrame;
-        
-        // input
-        // -----
-        processInput(window);
-        
-        // render
-        // ------
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
         shader.use();
-        glm::mat4 model = glm::mat4(1.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        shader.setMat4("view", view);
-        shader.setMat4("projection", projection);
-        // cubes
-        glBindVertexArray(cubeVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, cubeTexture);
-        model = glm::translate(model, glm::vec3(-1.0f, 0.0f, -1.0f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(2.0f, 0.0f, 0.0f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        // floor
-        glBindVertexArray(planeVAO);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        glm::mat4 identity = glm::mat4(1.0f);
-        shader.setMat4("model", identity);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        shader.setInt("texture1", 0);
+        // per draw uniforms are resolved once up front, camera data comes from the shared Camera block
+        Uniform<glm::mat4> modelUniform = shader.GetUniform<glm::mat4>("model");
+        instancedShader.use();
+        instancedShader.setInt("texture1", 0);
+        FrameUniforms frameUniforms;
+    
+        // per cube transforms, refilled every frame with just the visible ones
+        vector<InstanceData> cubeInstances;
+        InstanceBuffer cubeInstanceBuffer;
+        cubeInstanceBuffer.Update(cubeInstances);
+        cubeInstanceBuffer.Attach(cubeVAO);
         glBindVertexArray(0);
+        RenderQueue renderQueue;
+        int viewportWidth = framebufferWidth, viewportHeight = framebufferHeight;
         
-        // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
-        // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        // render loop
+        // -----------
+        while(const FramePacket *packet = renderer.AcquireFrame())
+        {
+            Profile().BeginFrame();
+            double frameStart = Profile().Now();
+            if(packet->viewportWidth != viewportWidth || packet->viewportHeight != viewportHeight) {
+                viewportWidth = packet->viewportWidth;
+                viewportHeight = packet->viewportHeight;
+                glViewport(0, 0, viewportWidth, viewportHeight);
+            }
+            glPolygonMode(GL_FRONT_AND_BACK, packet->polygonMode);
+            
+            // finish uploading any textures that were decoded since the last frame
+            {
+                ProfileScope uploadScope("TextureUpload");
+                Textures().Update();
+                SharedTextures().Update();
+                Jobs().RunMainThreadJobs();
+            }
+            
+            // render
+            // ------
+            Profile().BeginGpu("Frame");
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            
+            // one upload for every program
+            const CameraSnapshot &view = packet->camera;
+            frameUniforms.lights = packet->lights;
+            frameUniforms.Begin(view.view, view.projection, view.position);
+            
+            // turn the packet into draws, the queue sorts them by state and distance before issuing
+            double recordStart = Profile().Now();
+            renderQueue.Begin(view.position, 100.0f);
+            cubeInstances.clear();
+            glm::vec3 cubeCenter(0.0f);
+            for(unsigned int i = 0; i < packet->objects.size(); i++) {
+                const PacketObject &object = packet->objects[i];
+                glm::vec3 center = glm::vec3(object.model[3]);
+                if(object.object == SCENE_CUBE) {
+                    InstanceData instance;
+                    instance.model = object.model;
+                    instance.material = 0;
+                    cubeInstances.push_back(instance);
+                    cubeCenter += center;
+                }
+                else if(object.object == SCENE_FLOOR) {
+                    DrawCommand floor;
+                    floor.shader = &shader;
+                    floor.vao = planeVAO;
+                    floor.count = 6;
+                    floor.numTextures = 1;
+                    floor.textures[0] = floorTexture.ID();
+                    floor.modelUniform = modelUniform;
+                    floor.model = object.model;
+                    renderQueue.Submit(floor, center + glm::vec3(0.0f, -0.5f, 0.0f));
+                }
+            }
+            // every cube goes out in one instanced draw
+            if(!cubeInstances.empty()) {
+                cubeInstanceBuffer.Update(cubeInstances);
+                DrawCommand cubes;
+                cubes.shader = &instancedShader;
+                cubes.vao = cubeVAO;
+                cubes.count = 36;
+                cubes.instances = (unsigned int)cubeInstances.size();
+                cubes.numTextures = 1;
+                cubes.textures[0] = cubeTexture.ID();
+                renderQueue.Submit(cubes, cubeCenter / (float)cubeInstances.size());
+            }
+            // models are recorded on the workers, MODEL_RECORD_GRAIN instances to a command buffer
+            for(unsigned int i = 0; i < packet->models.size(); i++) {
+                packet->models[i].model->PrepareSubmit(*packet->models[i].shader);
+            }
+            renderQueue.Record((unsigned int)packet->models.size(), MODEL_RECORD_GRAIN, [packet, &view](CommandBuffer &buffer, unsigned int begin, unsigned int end) {
+                for(unsigned int i = begin; i < end; i++) {
+                    const PacketModel &model = packet->models[i];
+                    Frustum frustum = Frustum::FromMatrix(view.projection * view.view * model.transform);
+                    model.model->Submit(buffer, *model.shader, model.transform, frustum);
+                }
+            });
+            Profile().AddCpuSample("Record", recordStart, Profile().Now());
+            {
+                ProfileScope cpuScope("Execute");
+                GpuProfileScope gpuScope("Execute");
+                renderQueue.Execute();
+            }
+            frameUniforms.End();
+            Profile().EndGpu();
+            // everything the packet held is in GL's hands now
+            renderer.ReleaseFrame();
+            
+            if(window)
+                glfwSwapBuffers(window);
+            Profile().AddCpuSample("Frame", frameStart, Profile().Now());
+            Profile().EndFrame();
+        }
+        frameUniformStats = frameUniforms.Buffer().Stats();
+        if(offscreen && !output.empty())
+            offscreen->WritePPM(output);
+        
+        // optional: de-allocate all resources once they've outlived their purpose:
+        // ------------------------------------------------------------------------
+        glDeleteVertexArrays(1, &cubeVAO);
+        glDeleteVertexArrays(1, &planeVAO);
+        glDeleteBuffers(1, &cubeVBO);
+        glDeleteBuffers(1, &planeVBO);
     }
-    
-    // optional: de-allocate all resources once they've outlived their purpose:
-    // ------------------------------------------------------------------------
-    glDeleteVertexArrays(1, &cubeVAO);
-    glDeleteVertexArrays(1, &planeVAO);
-    glDeleteBuffers(1, &cubeVBO);
-    glDeleteBuffers(1, &planeVBO);
-    
-    glfwTerminate();
-    return 0;
+    if(offscreen)
+        offscreen->ReleaseCurrent();
+    else
+        glfwMakeContextCurrent(NULL);
 }
 
-// Deals with all input from user
+// Deals with all input from user, as handed out by the InputRecorder for this frame
 void processInput(GLFWwindow *window) {
-    if(glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    const vector<InputEvent> &events = input.Events();
+    for(size_t i = 0; i < events.size(); i++) {
+        if(events[i].type == INPUT_MOUSE) {
+            if(firstMouse) {
+                lastX = events[i].x;
+                lastY = events[i].y;
+                firstMouse = false;
+            }
+            
+            float xoffset = events[i].x - lastX;
+            float yoffset = lastY - events[i].y;
+            lastX = events[i].x;
+            lastY = events[i].y;
+            
+            camera.ProcessMouseMovement(xoffset, yoffset);
+        }
+        else if(events[i].type == INPUT_SCROLL)
+            camera.ProcessMouseScroll(events[i].y);
+    }
+    
+    if(input.KeyDown(GLFW_KEY_ESCAPE) && window)
         glfwSetWindowShouldClose(window, true);
-    if(glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    if(glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-    if(glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
-        glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
-    if(glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
+    if(input.KeyDown(GLFW_KEY_1))
+        polygonMode = GL_LINE;
+    if(input.KeyDown(GLFW_KEY_2))
+        polygonMode = GL_FILL;
+    if(input.KeyDown(GLFW_KEY_3))
+        polygonMode = GL_POINT;
+    if(input.KeyDown(GLFW_KEY_W))
         camera.ProcessKeyboard(FORWARD, deltaTime);
-    if(glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
+    if(input.KeyDown(GLFW_KEY_S))
         camera.ProcessKeyboard(BACKWARD, deltaTime);
-    if(glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
+    if(input.KeyDown(GLFW_KEY_A))
         camera.ProcessKeyboard(LEFT, deltaTime);
-    if(glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
+    if(input.KeyDown(GLFW_KEY_D))
         camera.ProcessKeyboard(RIGHT, deltaTime);
     
 }
 
-// Changes the viewport size if window size changes
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if(action != GLFW_REPEAT)
+        input.PushKey(key, action == GLFW_PRESS);
+}
+
+// Changes the viewport size if window size changes, the render thread applies it with the next packet
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
-    glViewport(0, 0, width, height);
+    framebufferWidth = width;
+    framebufferHeight = height;
 }
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
-    if(firstMouse) {
-        lastX = xpos;
-        lastY = ypos;
-        firstMouse = false;
-    }
-    
-    float xoffset = xpos - lastX;
-    float yoffset = lastY - ypos;
-    lastX = xpos;
-    lastY = ypos;
-    
-    camera.ProcessMouseMovement(xoffset, yoffset);
+    input.PushMouse((float)xpos, (float)ypos);
 }
 
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset) {
-    camera.ProcessMouseScroll(yoffset);
+    input.PushScroll((float)xoffset, (float)yoffset);
 }
 
-unsigned int loadTexture(char const* path) {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if(data) {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-        
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-    
-    return textureID;
+TextureHandle loadTexture(char const* path) {
+    // decoded on the job system, uploaded by Textures().Update() in the render loop. The cache loads each file once
+    return SharedTextures().Load(path);
 }
-
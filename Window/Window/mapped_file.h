@@ -0,0 +1,121 @@
+//
+//  mapped_file.h
+//  Window
+//
+//  Created by William Goniprow on 2/9/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef mapped_file_h
+#define mapped_file_h
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+using namespace std;
+
+// The mtime and size of path, what the on-disk caches are keyed on. False if it can't be stat'ed
+bool StatFile(const string &path, int64_t &mtime, uint64_t &size);
+// Writes path through write into a temporary file next to it and renames that over path, so a crash or another
+// process never sees a half written file. The temporary name is unique to the writing process and thread, two
+// writers of the same path each rename a whole file and the last one wins. False and path left alone if anything failed
+bool WriteFileAtomically(const string &path, const function<void(ostream &out)> &write);
+
+// Read-only memory map of a whole file
+class MappedFile {
+public:
+    /* Functions */
+    MappedFile() : data(NULL), size(0) {}
+    ~MappedFile() { Close(); }
+    // Maps the file, false if it can't be opened or is empty
+    bool Open(const string &path);
+    void Close();
+    const char *Data() const { return data; }
+    size_t Size() const { return size; }
+    bool IsOpen() const { return data != NULL; }
+    // Faults every page in now, so whoever reads the data next doesn't wait on the disk
+    void Prefetch() const;
+private:
+    /* File Data */
+    const char *data;
+    size_t size;
+    // not copyable, the mapping is owned
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+bool MappedFile::Open(const string &path) {
+    Close();
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // the mapping keeps the file alive
+    if(mapped == MAP_FAILED) {
+        return false;
+    }
+    data = (const char *)mapped;
+    size = (size_t)st.st_size;
+    return true;
+}
+
+void MappedFile::Close() {
+    if(data) {
+        munmap((void *)data, size);
+    }
+    data = NULL;
+    size = 0;
+}
+
+void MappedFile::Prefetch() const {
+    if(!data)
+        return;
+    madvise((void *)data, size, MADV_WILLNEED);
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    volatile char sink = 0;
+    for(size_t offset = 0; offset < size; offset += page) {
+        sink = sink + data[offset];
+    }
+}
+
+bool StatFile(const string &path, int64_t &mtime, uint64_t &size) {
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return false;
+    mtime = (int64_t)st.st_mtime;
+    size  = (uint64_t)st.st_size;
+    return true;
+}
+
+bool WriteFileAtomically(const string &path, const function<void(ostream &out)> &write) {
+    ostringstream unique;
+    unique << path << "." << getpid() << "." << this_thread::get_id() << ".tmp";
+    const string tmpPath = unique.str();
+    ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+    if(!out)
+        return false;
+    write(out);
+    out.close();
+    if(!out || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+#endif /* mapped_file_h */
@@ -0,0 +1,200 @@
+//
+//  material.h
+//  Window
+//
+//  Created by William Goniprow on 2/23/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef material_h
+#define material_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+const unsigned int MATERIAL_MAX_TEXTURES = 8;
+
+enum Texture_Type {
+    TEXTURE_DIFFUSE,
+    TEXTURE_SPECULAR,
+    TEXTURE_TYPE_COUNT
+};
+
+// Sampler names follow the type, "material.texture_diffuseN" with N counting from 1 per type
+const char *TextureTypeName(Texture_Type type) {
+    switch(type) {
+        case TEXTURE_DIFFUSE:  return "texture_diffuse";
+        case TEXTURE_SPECULAR: return "texture_specular";
+        default:               return "texture_unknown";
+    }
+}
+
+struct Texture {
+    unsigned int id;
+    Texture_Type type;
+    string path; // we store the path of the texture to compare to another
+};
+
+// Scalar parameters from the MTL file or the Assimp material
+struct MaterialParams {
+    float shininess;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    MaterialParams() : shininess(32.0f), diffuse(1.0f), specular(1.0f) {}
+};
+
+// Uniforms of one program a material sets, invalid handles for what the program doesn't use
+struct MaterialUniforms {
+    unsigned int program;
+    Uniform<int> samplers[MATERIAL_MAX_TEXTURES];
+    Uniform<float> shininess;
+    Uniform<glm::vec3> diffuse;
+    Uniform<glm::vec3> specular;
+    MaterialUniforms() : program(0) {}
+};
+
+// Textures and parameters shared by every mesh that looks the same. Texture units, sampler names and
+// parameters are fixed when it is created, so binding one is a run of glBindTexture calls and a few
+// uniforms the shader skips when they haven't changed. Created through Materials(), which hands out IDs.
+class Material {
+public:
+    /* Functions */
+    Material(unsigned int id, const vector<Texture> &textures, const MaterialParams &params);
+    // 1 and up in creation order, the render queue sorts by it
+    unsigned int ID() const { return id; }
+    unsigned int NumTextures() const { return numTextures; }
+    const Texture &GetTexture(unsigned int i) const { return textures[i]; }
+    unsigned int TextureID(unsigned int i) const { return textureIDs[i]; }
+    const MaterialParams &Params() const { return params; }
+    // Resolves the uniforms for shader and keeps them, GL thread only
+    void Prepare(const Shader &shader);
+    // The kept uniforms if they are shader's, otherwise resolved into scratch. Safe from any thread
+    const MaterialUniforms &Uniforms(const Shader &shader, MaterialUniforms &scratch) const;
+    // Binds texture i to unit i and sets the samplers and parameters, leaves unit 0 active
+    void Bind(Shader &shader) const;
+    // Just the parameters, for when the textures are bound some other way
+    void SetParameters(Shader &shader) const;
+private:
+    /* Material Data */
+    unsigned int id;
+    unsigned int numTextures;
+    vector<Texture> textures;
+    unsigned int textureIDs[MATERIAL_MAX_TEXTURES];
+    string samplerNames[MATERIAL_MAX_TEXTURES];
+    MaterialParams params;
+    MaterialUniforms uniforms; // resolved by Prepare
+    /* Functions */
+    void resolve(const Shader &shader, MaterialUniforms &resolved) const;
+};
+
+// Owns every material, identical texture sets with identical parameters come back as the same Material
+class MaterialLibrary {
+public:
+    /* Functions */
+    // The material for these textures and parameters, created the first time it is asked for. GL thread only
+    Material *Get(const vector<Texture> &textures, const MaterialParams &params);
+    size_t Size() const { return materials.size(); }
+private:
+    /* Library Data */
+    deque<Material> materials; // never moves what it holds, meshes point into it
+    unordered_map<string, Material *> lookup;
+};
+
+// The process wide library, used by Model
+MaterialLibrary &Materials() {
+    static MaterialLibrary library;
+    return library;
+}
+
+Material::Material(unsigned int id, const vector<Texture> &textures, const MaterialParams &params) : id(id), params(params) {
+    if(textures.size() > MATERIAL_MAX_TEXTURES)
+        cout << "ERROR::MATERIAL::TOO_MANY_TEXTURES " << textures.size() << endl;
+    numTextures = (unsigned int)min(textures.size(), (size_t)MATERIAL_MAX_TEXTURES);
+    this->textures.assign(textures.begin(), textures.begin() + numTextures);
+    memset(textureIDs, 0, sizeof(textureIDs));
+    // units follow the order of textures, the N in texture_diffuseN counts per type
+    unsigned int numbers[TEXTURE_TYPE_COUNT] = {0};
+    for(unsigned int i = 0; i < numTextures; i++) {
+        Texture_Type type = textures[i].type;
+        textureIDs[i] = textures[i].id;
+        samplerNames[i] = string("material.") + TextureTypeName(type) + std::to_string(type < TEXTURE_TYPE_COUNT ? ++numbers[type] : 1);
+    }
+}
+
+void Material::resolve(const Shader &shader, MaterialUniforms &resolved) const {
+    resolved.program = shader.ID;
+    for(unsigned int i = 0; i < numTextures; i++) {
+        resolved.samplers[i] = shader.GetUniform<int>(samplerNames[i]);
+    }
+    resolved.shininess = shader.GetUniform<float>("material.shininess");
+    resolved.diffuse   = shader.GetUniform<glm::vec3>("material.color_diffuse");
+    resolved.specular  = shader.GetUniform<glm::vec3>("material.color_specular");
+}
+
+void Material::Prepare(const Shader &shader) {
+    if(uniforms.program != shader.ID)
+        resolve(shader, uniforms);
+}
+
+const MaterialUniforms &Material::Uniforms(const Shader &shader, MaterialUniforms &scratch) const {
+    if(uniforms.program == shader.ID)
+        return uniforms;
+    resolve(shader, scratch);
+    return scratch;
+}
+
+void Material::Bind(Shader &shader) const {
+    MaterialUniforms scratch;
+    const MaterialUniforms &resolved = Uniforms(shader, scratch);
+    for(unsigned int i = 0; i < numTextures; i++) {
+        SharedTextures().Touch(textureIDs[i]);
+        glActiveTexture(GL_TEXTURE0 + i);
+        glBindTexture(GL_TEXTURE_2D, textureIDs[i]);
+        // samplers are ints, and the shader skips the upload when the unit hasn't changed
+        shader.Set(resolved.samplers[i], (int)i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+    shader.Set(resolved.shininess, params.shininess);
+    shader.Set(resolved.diffuse, params.diffuse);
+    shader.Set(resolved.specular, params.specular);
+}
+
+void Material::SetParameters(Shader &shader) const {
+    MaterialUniforms scratch;
+    const MaterialUniforms &resolved = Uniforms(shader, scratch);
+    shader.Set(resolved.shininess, params.shininess);
+    shader.Set(resolved.diffuse, params.diffuse);
+    shader.Set(resolved.specular, params.specular);
+}
+
+Material *MaterialLibrary::Get(const vector<Texture> &textures, const MaterialParams &params) {
+    // the texture names, types and parameters byte for byte are the identity
+    string key;
+    for(unsigned int i = 0; i < textures.size(); i++) {
+        key.append((const char *)&textures[i].id, sizeof(textures[i].id));
+        key.append((const char *)&textures[i].type, sizeof(textures[i].type));
+    }
+    key.append((const char *)&params.shininess, sizeof(params.shininess));
+    key.append((const char *)&params.diffuse[0], sizeof(glm::vec3));
+    key.append((const char *)&params.specular[0], sizeof(glm::vec3));
+    unordered_map<string, Material *>::iterator it = lookup.find(key);
+    if(it != lookup.end())
+        return it->second;
+    materials.push_back(Material((unsigned int)materials.size() + 1, textures, params));
+    lookup[key] = &materials.back();
+    return &materials.back();
+}
+
+#endif /* material_h */
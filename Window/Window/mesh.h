@@ -13,7 +13,15 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "vertex_format.h"
+#include "culling.h"
+#include "geometry_pool.h"
+#include "instance_buffer.h"
+#include "material.h"
+#include "render_queue.h"
 
+#include <stdint.h>
+#include <cmath>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -21,16 +29,18 @@
 #include <vector>
 using namespace std;
 
-struct Vertex {
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
+// Texture a mesh refers to before it has been loaded into GL
+struct TextureRef {
+    Texture_Type type;
+    string path;
 };
 
-struct Texture {
-    unsigned int id;
-    string type;
-    string path; // we store the path of the texture to compare to another
+// CPU-side result of importing one mesh, safe to build off the main thread
+struct MeshData {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    vector<TextureRef> textures;
+    MaterialParams material;
 };
 
 class Mesh {
@@ -38,26 +48,76 @@ public:
     /* Mesh Data */
     vector<Vertex> vertices;
     vector<unsigned int> indices;
-    vector<Texture> textures;
+    Material *material; // shared with every mesh that looks the same, owned by Materials()
+    Vertex_Format format;
+    // model space bounds, computed once at load
+    BoundingBox bounds;
+    BoundingSphere sphere;
     /* Functions */
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures);
-    void Draw(Shader shader);
+    // with a pool the mesh is sub-allocated from its shared buffers instead of getting its own
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, Material *material, Vertex_Format format = VERTEX_FLOAT, GeometryPool *pool = NULL);
+    void Draw(Shader &shader);
+    // Draws instanceCount copies (all of instances by default) in one call, use the *_instanced.vs shaders
+    void DrawInstanced(Shader &shader, const InstanceBuffer &instances, unsigned int instanceCount = ~0u);
+    // Resolves the uniforms Draw and Submit set against shader, material included. Without it Submit looks them up on every call
+    void PrepareSubmit(const Shader &shader);
+    // Records the draw into a queue or command buffer, nothing is bound until the queue executes.
+    // Changes nothing in the mesh, so any number of threads can record it at once
+    void Submit(CommandBuffer &buffer, Shader &shader, const glm::mat4 &model) const;
 private:
     /* Render Data */
     unsigned int VAO, VBO, EBO;
+    // uniforms of the program a draw command is recorded for, the material keeps its own
+    struct SubmitUniforms {
+        unsigned int program;
+        Uniform<glm::mat4> model;
+        Uniform<glm::vec3> positionOffset;
+        Uniform<glm::vec3> positionScale;
+    };
+    SubmitUniforms submitUniforms; // resolved by PrepareSubmit
+    unsigned int instanceVBO; // instance buffer currently attached to VAO
+    GLenum indexType;
+    GeometryPool *pool;
+    GeometryRange range;      // where the draw starts, all zero when the mesh has its own buffers
+    glm::vec3 positionOffset; // dequantization for VERTEX_QUANTIZED, identity otherwise
+    glm::vec3 positionScale;
     /* Functions */
     void setupMesh();
+    void *indexOffset() const { return (void *)(range.firstIndex * (indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(unsigned int))); }
+    void bindTextures(Shader &shader) const;
+    void resolveUniforms(const Shader &shader, SubmitUniforms &uniforms) const;
+    const SubmitUniforms &uniformsFor(const Shader &shader, SubmitUniforms &scratch) const;
+    friend class DrawBatch;
 };
 
-Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures) {
-    this->vertices = vertices;
-    this->indices  = indices;
-    this->textures = textures;
+Mesh::Mesh(vector<Vertex> vertices, vector<unsigned int> indices, Material *material, Vertex_Format format, GeometryPool *pool) {
+    this->vertices = std::move(vertices);
+    this->indices  = std::move(indices);
+    this->material = material;
+    this->format   = format;
+    this->pool     = pool;
+    submitUniforms.program = 0;
+    instanceVBO = 0;
+    
+    if(!this->vertices.empty()) {
+        bounds = ComputeBoundingBox(&this->vertices[0].Position, this->vertices.size(), sizeof(Vertex));
+        sphere = ComputeBoundingSphere(&this->vertices[0].Position, this->vertices.size(), sizeof(Vertex), bounds);
+    }
     
     setupMesh();
 }
 
 void Mesh::setupMesh() {
+    if(pool) {
+        range = pool->Add(vertices, indices);
+        VAO = pool->VAO();
+        VBO = EBO = 0;
+        indexType = GL_UNSIGNED_INT;
+        positionOffset = range.positionOffset;
+        positionScale  = range.positionScale;
+        return;
+    }
+    
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
@@ -65,48 +125,126 @@ void Mesh::setupMesh() {
     glBindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+    vector<char> encoded;
+    EncodeVertices(format, vertices, encoded, positionOffset, positionScale);
+    range.baseVertex = 0;
+    range.firstIndex = 0;
+    range.indexCount = (unsigned int)indices.size();
+    range.positionOffset = positionOffset;
+    range.positionScale  = positionScale;
+    glBufferData(GL_ARRAY_BUFFER, encoded.size(), encoded.empty() ? NULL : &encoded[0], GL_STATIC_DRAW);
+    SetupVertexAttributes(format);
     
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-    
-    // Vertex positions
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-    // Vertex normals
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-    // Vertex texture coords
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+    if(format != VERTEX_FLOAT && vertices.size() <= 65536) {
+        // every index fits in 16 bits, halve the index buffer too
+        vector<uint16_t> shortIndices(indices.begin(), indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(uint16_t), shortIndices.empty() ? NULL : &shortIndices[0], GL_STATIC_DRAW);
+        indexType = GL_UNSIGNED_SHORT;
+    }
+    else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.empty() ? NULL : &indices[0], GL_STATIC_DRAW);
+        indexType = GL_UNSIGNED_INT;
+    }
     
     glBindVertexArray(0);
 }
 
-void Mesh::Draw(Shader shader) {
-    unsigned int diffuseNr = 1;
-    unsigned int specularNr = 1;
-    for(unsigned int i = 0; i < textures.size(); i++) {
-        glActiveTexture(GL_TEXTURE0 + i); // activate proper texture unit before binding
-        // retrieve texture number (the N in diffuse_textureN)
-        string number;
-        string name = textures[i].type;
-        if(name == "texture_diffuse") {
-            number = std::to_string(diffuseNr++);
-        }
-        else if(name == "texture_specular") {
-            number = std::to_string(specularNr++);
-        }
-        
-        shader.setFloat(("material." + name + number).c_str(), i);
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+void Mesh::bindTextures(Shader &shader) const {
+    if(material)
+        material->Bind(shader);
+    
+    // the packed shaders scale quantized positions back into model space
+    if(format != VERTEX_FLOAT) {
+        SubmitUniforms scratch;
+        const SubmitUniforms &uniforms = uniformsFor(shader, scratch);
+        shader.Set(uniforms.positionOffset, positionOffset);
+        shader.Set(uniforms.positionScale, positionScale);
     }
-    glActiveTexture(GL_TEXTURE0);
+}
+
+void Mesh::Draw(Shader &shader) {
+    PrepareSubmit(shader);
+    bindTextures(shader);
     
     // Draw Mesh
     glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+    glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, indexType, indexOffset(), range.baseVertex);
     glBindVertexArray(0);
 }
 
+void Mesh::DrawInstanced(Shader &shader, const InstanceBuffer &instances, unsigned int instanceCount) {
+    if(instanceCount > instances.Count())
+        instanceCount = instances.Count();
+    if(instanceCount == 0)
+        return;
+    bindTextures(shader);
+    
+    // a pool VAO is shared, another mesh may have attached a different buffer since
+    if(pool || instanceVBO != instances.ID()) {
+        instances.Attach(VAO);
+        instanceVBO = instances.ID();
+    }
+    else {
+        glBindVertexArray(VAO);
+    }
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, indexType, indexOffset(), instanceCount, range.baseVertex);
+    glBindVertexArray(0);
+}
+
+void Mesh::resolveUniforms(const Shader &shader, SubmitUniforms &uniforms) const {
+    uniforms.program = shader.ID;
+    uniforms.model = shader.GetUniform<glm::mat4>("model");
+    if(format != VERTEX_FLOAT) {
+        uniforms.positionOffset = shader.GetUniform<glm::vec3>("positionOffset");
+        uniforms.positionScale  = shader.GetUniform<glm::vec3>("positionScale");
+    }
+}
+
+const Mesh::SubmitUniforms &Mesh::uniformsFor(const Shader &shader, SubmitUniforms &scratch) const {
+    if(submitUniforms.program == shader.ID)
+        return submitUniforms;
+    resolveUniforms(shader, scratch);
+    return scratch;
+}
+
+void Mesh::PrepareSubmit(const Shader &shader) {
+    if(submitUniforms.program != shader.ID)
+        resolveUniforms(shader, submitUniforms);
+    if(material)
+        material->Prepare(shader);
+}
+
+void Mesh::Submit(CommandBuffer &buffer, Shader &shader, const glm::mat4 &model) const {
+    SubmitUniforms scratch;
+    const SubmitUniforms &uniforms = uniformsFor(shader, scratch);
+    
+    DrawCommand command;
+    command.shader    = &shader;
+    command.vao       = VAO;
+    command.indexType = indexType;
+    command.first     = range.firstIndex;
+    command.count     = range.indexCount;
+    command.baseVertex = range.baseVertex;
+    if(material) {
+        MaterialUniforms materialScratch;
+        const MaterialUniforms &materialUniforms = material->Uniforms(shader, materialScratch);
+        command.material = material;
+        command.numTextures = min(material->NumTextures(), RENDER_MAX_TEXTURES);
+        for(unsigned int i = 0; i < command.numTextures; i++) {
+            command.textures[i] = material->TextureID(i);
+            command.samplers[i] = materialUniforms.samplers[i];
+        }
+    }
+    command.modelUniform = uniforms.model;
+    command.model = model;
+    if(format != VERTEX_FLOAT) {
+        command.positionOffsetUniform = uniforms.positionOffset;
+        command.positionScaleUniform  = uniforms.positionScale;
+        command.positionOffset = positionOffset;
+        command.positionScale  = positionScale;
+    }
+    buffer.Submit(command, glm::vec3(model * glm::vec4(sphere.center, 1.0f)));
+}
+
 #endif /* mesh_h */
@@ -0,0 +1,314 @@
+//
+//  mesh_cache.h
+//  Window
+//
+//  Created by William Goniprow on 2/6/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef mesh_cache_h
+#define mesh_cache_h
+
+#include "mesh.h"
+#include "mapped_file.h"
+
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <vector>
+using namespace std;
+
+// Binary cache written next to a model after its first import ("<model>.meshcache").
+// It is only valid for the exact source file (path, mtime, size), the material libraries it read (path, mtime, size),
+// and the import flags and model options it was built from.
+//
+// File layout (all offsets from the start of the file):
+//   CacheHeader
+//   CacheLibrary[numLibraries] material libraries (.mtl) the source pulled in, path as a range into the string table
+//   CacheMesh[numMeshes]       per-mesh ranges into the vertex/index/texture arrays and material parameters
+//   CacheTexture[numTextures]  texture references, Texture_Type and the path as a range into the string table
+//   char[stringsSize]          string table (source path first, not null terminated)
+//   Vertex[numVertices]        16 byte aligned
+//   unsigned int[numIndices]
+const uint32_t MESH_CACHE_MAGIC   = 0x48534D4C; // "LMSH"
+const uint32_t MESH_CACHE_VERSION = 4;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t importFlags;
+    uint32_t options;         // Model_Option flags, optimized meshes are stored as optimized
+    uint32_t vertexSize;      // sizeof(Vertex) when written, guards against layout changes
+    uint32_t numLibraries;
+    int64_t  sourceMTime;
+    uint64_t sourceSize;
+    uint32_t sourcePathLength;
+    uint32_t numMeshes;
+    uint32_t numTextures;
+    uint32_t stringsSize;
+    uint64_t numVertices;
+    uint64_t numIndices;
+    uint64_t librariesOffset;
+    uint64_t meshesOffset;
+    uint64_t texturesOffset;
+    uint64_t stringsOffset;
+    uint64_t verticesOffset;
+    uint64_t indicesOffset;
+};
+
+struct CacheMesh {
+    uint32_t firstVertex;
+    uint32_t numVertices;
+    uint32_t firstIndex;
+    uint32_t numIndices;
+    uint32_t firstTexture;
+    uint32_t numTextures;
+    float shininess;
+    float diffuse[3];
+    float specular[3];
+};
+
+struct CacheLibrary {
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    int64_t  mtime;           // -1 if the library didn't exist, creating it invalidates the cache too
+    uint64_t size;
+};
+
+struct CacheTexture {
+    uint32_t type;
+    uint32_t reserved;
+    uint32_t pathOffset;
+    uint32_t pathLength;
+};
+
+class MeshCache {
+public:
+    /* Functions */
+    MeshCache(const string &sourcePath, uint32_t importFlags, uint32_t options = 0);
+    // Maps the cache file and checks it against the source file, false if it is missing or stale
+    bool Open();
+    // Serializes the imported meshes, replacing any existing cache file. libraries are the material files the import read
+    bool Write(const vector<Mesh> &meshes, const vector<string> &libraries = vector<string>());
+
+    uint32_t NumMeshes() const { return header->numMeshes; }
+    const CacheMesh &GetMesh(uint32_t i) const { return meshes[i]; }
+    const Vertex *Vertices() const { return vertices; }
+    const unsigned int *Indices() const { return indices; }
+    Texture_Type TextureType(uint32_t i) const { return (Texture_Type)textures[i].type; }
+    string TexturePath(uint32_t i) const { return string(strings + textures[i].pathOffset, textures[i].pathLength); }
+    MaterialParams GetMaterial(uint32_t i) const;
+private:
+    /* Cache Data */
+    string sourcePath;
+    string cachePath;
+    uint32_t importFlags;
+    uint32_t options;
+    MappedFile file;
+    const CacheHeader *header;
+    const CacheMesh *meshes;
+    const CacheTexture *textures;
+    const char *strings;
+    const Vertex *vertices;
+    const unsigned int *indices;
+    /* Functions */
+    bool validate(const char *base, size_t mappedSize) const;
+};
+
+MeshCache::MeshCache(const string &sourcePath, uint32_t importFlags, uint32_t options) : header(NULL), meshes(NULL), textures(NULL), strings(NULL), vertices(NULL), indices(NULL) {
+    this->sourcePath  = sourcePath;
+    this->cachePath   = sourcePath + ".meshcache";
+    this->importFlags = importFlags;
+    this->options     = options;
+}
+
+bool MeshCache::Open() {
+    int64_t mtime;
+    uint64_t size;
+    if(!StatFile(sourcePath, mtime, size)) {
+        return false;
+    }
+
+    if(!file.Open(cachePath) || file.Size() < sizeof(CacheHeader)) {
+        file.Close();
+        return false;
+    }
+
+    const char *base = file.Data();
+    const size_t mappedSize = file.Size();
+    header = (const CacheHeader *)base;
+    // check the cache key: format, source file identity, import flags and options
+    bool valid = header->magic == MESH_CACHE_MAGIC && header->version == MESH_CACHE_VERSION &&
+                 header->vertexSize == sizeof(Vertex) && header->importFlags == importFlags && header->options == options &&
+                 header->sourceMTime == mtime && header->sourceSize == size &&
+                 header->sourcePathLength == sourcePath.size();
+    // and that nothing in it points outside the file, a truncated or corrupt cache is rebuilt like a stale one
+    if(!valid || !validate(base, mappedSize) || memcmp(base + header->stringsOffset, sourcePath.data(), sourcePath.size()) != 0) {
+        file.Close();
+        header = NULL;
+        return false;
+    }
+
+    meshes   = (const CacheMesh *)(base + header->meshesOffset);
+    textures = (const CacheTexture *)(base + header->texturesOffset);
+    strings  = base + header->stringsOffset;
+    vertices = (const Vertex *)(base + header->verticesOffset);
+    indices  = (const unsigned int *)(base + header->indicesOffset);
+    return true;
+}
+
+// True if count elements of elementSize at offset lie inside a file of fileSize bytes, without overflowing
+static bool cacheRangeFits(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t fileSize) {
+    return offset <= fileSize && count <= (fileSize - offset) / elementSize;
+}
+
+bool MeshCache::validate(const char *base, size_t mappedSize) const {
+    const CacheHeader &h = *header;
+    // sections are read in place, so they have to be aligned for their element types as well as inside the file
+    if(h.librariesOffset % 8 != 0 || h.meshesOffset % 4 != 0 || h.texturesOffset % 4 != 0 || h.verticesOffset % 4 != 0 || h.indicesOffset % 4 != 0)
+        return false;
+    if(!cacheRangeFits(h.librariesOffset, h.numLibraries, sizeof(CacheLibrary), mappedSize) ||
+       !cacheRangeFits(h.meshesOffset, h.numMeshes, sizeof(CacheMesh), mappedSize) ||
+       !cacheRangeFits(h.texturesOffset, h.numTextures, sizeof(CacheTexture), mappedSize) ||
+       !cacheRangeFits(h.stringsOffset, h.stringsSize, 1, mappedSize) ||
+       !cacheRangeFits(h.verticesOffset, h.numVertices, sizeof(Vertex), mappedSize) ||
+       !cacheRangeFits(h.indicesOffset, h.numIndices, sizeof(unsigned int), mappedSize) ||
+       h.sourcePathLength > h.stringsSize)
+        return false;
+
+    // the material libraries have to be unchanged too
+    const CacheLibrary *libraries = (const CacheLibrary *)(base + h.librariesOffset);
+    for(uint32_t i = 0; i < h.numLibraries; i++) {
+        if((uint64_t)libraries[i].pathOffset + libraries[i].pathLength > h.stringsSize)
+            return false;
+        int64_t mtime = -1;
+        uint64_t size = 0;
+        StatFile(string(base + h.stringsOffset + libraries[i].pathOffset, libraries[i].pathLength), mtime, size);
+        if(mtime != libraries[i].mtime || size != libraries[i].size)
+            return false;
+    }
+
+    // every mesh's ranges, and the indices in them, stay inside the arrays they point into
+    const CacheMesh *meshTable = (const CacheMesh *)(base + h.meshesOffset);
+    const CacheTexture *textureTable = (const CacheTexture *)(base + h.texturesOffset);
+    const unsigned int *indexArray = (const unsigned int *)(base + h.indicesOffset);
+    for(uint32_t i = 0; i < h.numMeshes; i++) {
+        const CacheMesh &m = meshTable[i];
+        if((uint64_t)m.firstVertex + m.numVertices > h.numVertices || (uint64_t)m.firstIndex + m.numIndices > h.numIndices ||
+           (uint64_t)m.firstTexture + m.numTextures > h.numTextures)
+            return false;
+        for(uint32_t j = 0; j < m.numIndices; j++) {
+            if(indexArray[m.firstIndex + j] >= m.numVertices)
+                return false;
+        }
+    }
+    for(uint32_t i = 0; i < h.numTextures; i++) {
+        if(textureTable[i].type >= TEXTURE_TYPE_COUNT || (uint64_t)textureTable[i].pathOffset + textureTable[i].pathLength > h.stringsSize)
+            return false;
+    }
+    return true;
+}
+
+MaterialParams MeshCache::GetMaterial(uint32_t i) const {
+    MaterialParams params;
+    params.shininess = meshes[i].shininess;
+    params.diffuse  = glm::vec3(meshes[i].diffuse[0], meshes[i].diffuse[1], meshes[i].diffuse[2]);
+    params.specular = glm::vec3(meshes[i].specular[0], meshes[i].specular[1], meshes[i].specular[2]);
+    return params;
+}
+
+bool MeshCache::Write(const vector<Mesh> &meshes, const vector<string> &libraries) {
+    CacheHeader h;
+    memset(&h, 0, sizeof(h));
+    if(!StatFile(sourcePath, h.sourceMTime, h.sourceSize)) {
+        return false;
+    }
+    h.magic = MESH_CACHE_MAGIC;
+    h.version = MESH_CACHE_VERSION;
+    h.importFlags = importFlags;
+    h.options = options;
+    h.vertexSize = sizeof(Vertex);
+    h.sourcePathLength = (uint32_t)sourcePath.size();
+
+    // build the library table, mesh table, texture table and string table
+    vector<CacheLibrary> libraryTable;
+    vector<CacheMesh> meshTable;
+    vector<CacheTexture> textureTable;
+    string stringTable = sourcePath;
+    for(unsigned int i = 0; i < libraries.size(); i++) {
+        CacheLibrary l;
+        l.pathOffset = (uint32_t)stringTable.size();
+        l.pathLength = (uint32_t)libraries[i].size();
+        l.mtime = -1;
+        l.size = 0;
+        StatFile(libraries[i], l.mtime, l.size);
+        stringTable += libraries[i];
+        libraryTable.push_back(l);
+    }
+    for(unsigned int i = 0; i < meshes.size(); i++) {
+        CacheMesh m;
+        m.firstVertex  = (uint32_t)h.numVertices;
+        m.numVertices  = (uint32_t)meshes[i].vertices.size();
+        m.firstIndex   = (uint32_t)h.numIndices;
+        m.numIndices   = (uint32_t)meshes[i].indices.size();
+        m.firstTexture = (uint32_t)textureTable.size();
+        const Material *material = meshes[i].material;
+        m.numTextures  = material ? material->NumTextures() : 0;
+        MaterialParams params = material ? material->Params() : MaterialParams();
+        m.shininess = params.shininess;
+        for(int c = 0; c < 3; c++) {
+            m.diffuse[c]  = params.diffuse[c];
+            m.specular[c] = params.specular[c];
+        }
+        for(unsigned int j = 0; j < m.numTextures; j++) {
+            const Texture &texture = material->GetTexture(j);
+            CacheTexture t;
+            t.type = (uint32_t)texture.type;
+            t.reserved = 0;
+            t.pathOffset = (uint32_t)stringTable.size();
+            t.pathLength = (uint32_t)texture.path.size();
+            stringTable += texture.path;
+            textureTable.push_back(t);
+        }
+        h.numVertices += m.numVertices;
+        h.numIndices  += m.numIndices;
+        meshTable.push_back(m);
+    }
+    h.numLibraries = (uint32_t)libraryTable.size();
+    h.numMeshes   = (uint32_t)meshTable.size();
+    h.numTextures = (uint32_t)textureTable.size();
+    h.stringsSize = (uint32_t)stringTable.size();
+
+    h.librariesOffset = sizeof(CacheHeader);
+    h.meshesOffset   = h.librariesOffset + libraryTable.size() * sizeof(CacheLibrary);
+    h.texturesOffset = h.meshesOffset + meshTable.size() * sizeof(CacheMesh);
+    h.stringsOffset  = h.texturesOffset + textureTable.size() * sizeof(CacheTexture);
+    h.verticesOffset = (h.stringsOffset + h.stringsSize + 15) & ~(uint64_t)15;
+    h.indicesOffset  = h.verticesOffset + h.numVertices * sizeof(Vertex);
+
+    return WriteFileAtomically(cachePath, [&](ostream &out) {
+        out.write((const char *)&h, sizeof(h));
+        if(!libraryTable.empty())
+            out.write((const char *)&libraryTable[0], libraryTable.size() * sizeof(CacheLibrary));
+        if(!meshTable.empty())
+            out.write((const char *)&meshTable[0], meshTable.size() * sizeof(CacheMesh));
+        if(!textureTable.empty())
+            out.write((const char *)&textureTable[0], textureTable.size() * sizeof(CacheTexture));
+        out.write(stringTable.data(), stringTable.size());
+        const char padding[16] = {0};
+        out.write(padding, h.verticesOffset - (h.stringsOffset + h.stringsSize));
+        for(unsigned int i = 0; i < meshes.size(); i++) {
+            if(!meshes[i].vertices.empty())
+                out.write((const char *)&meshes[i].vertices[0], meshes[i].vertices.size() * sizeof(Vertex));
+        }
+        for(unsigned int i = 0; i < meshes.size(); i++) {
+            if(!meshes[i].indices.empty())
+                out.write((const char *)&meshes[i].indices[0], meshes[i].indices.size() * sizeof(unsigned int));
+        }
+    });
+}
+
+#endif /* mesh_cache_h */
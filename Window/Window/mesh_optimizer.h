@@ -0,0 +1,350 @@
+//
+//  mesh_optimizer.h
+//  Window
+//
+//  Created by William Goniprow on 2/10/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef mesh_optimizer_h
+#define mesh_optimizer_h
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+
+#include <stdint.h>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Import time optimization of MeshData for the post-transform vertex cache, overdraw and vertex fetch:
+//   1. identical vertices are merged
+//   2. triangles are reordered for the vertex cache (Tom Forsyth's linear-speed vertex cache optimization)
+//   3. the cache friendly order is cut into clusters at cache restarts and the clusters are sorted so
+//      outward facing ones are drawn first, which cuts overdraw without giving back the cache gains
+//   4. vertices are renumbered in the order the index buffer first touches them
+
+// Size of the FIFO cache used for the ACMR/ATVR numbers, a conservative stand-in for real hardware
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+    float acmr; // average cache miss ratio: transformed vertices per triangle, 0.5 is the ideal on big meshes
+    float atvr; // average transform to vertex ratio: transformed vertices per unique vertex, 1.0 is ideal
+};
+
+struct MeshOptimizationReport {
+    unsigned int verticesBefore;
+    unsigned int verticesAfter;
+    unsigned int triangles;
+    VertexCacheStats before;
+    VertexCacheStats after;
+};
+
+/* Analysis */
+
+// Runs the index buffer through a FIFO vertex cache
+VertexCacheStats AnalyzeVertexCache(const vector<unsigned int> &indices, unsigned int numVertices, unsigned int cacheSize = VERTEX_CACHE_SIZE) {
+    VertexCacheStats stats = { 0.0f, 0.0f };
+    if(indices.empty() || numVertices == 0)
+        return stats;
+    // a vertex is in the cache if it was inserted less than cacheSize misses ago
+    vector<unsigned int> insertedAt(numVertices, 0);
+    unsigned int misses = 0;
+    for(unsigned int i = 0; i < indices.size(); i++) {
+        unsigned int v = indices[i];
+        if(insertedAt[v] == 0 || misses + 1 - insertedAt[v] > cacheSize) {
+            misses++;
+            insertedAt[v] = misses;
+        }
+    }
+    stats.acmr = (float)misses / (float)(indices.size() / 3);
+    stats.atvr = (float)misses / (float)numVertices;
+    return stats;
+}
+
+/* Vertex deduplication */
+
+struct VertexBytesHash {
+    size_t operator()(const Vertex &v) const {
+        const uint32_t *words = (const uint32_t *)&v;
+        uint64_t h = 0xCBF29CE484222325ull;
+        for(unsigned int i = 0; i < sizeof(Vertex) / 4; i++) {
+            h = (h ^ words[i]) * 0x100000001B3ull;
+        }
+        return (size_t)h;
+    }
+};
+
+struct VertexBytesEqual {
+    bool operator()(const Vertex &a, const Vertex &b) const {
+        return memcmp(&a, &b, sizeof(Vertex)) == 0;
+    }
+};
+
+// Merges bitwise identical vertices and rewrites the indices to match
+void DeduplicateVertices(vector<Vertex> &vertices, vector<unsigned int> &indices) {
+    unordered_map<Vertex, unsigned int, VertexBytesHash, VertexBytesEqual> unique;
+    unique.reserve(vertices.size());
+    vector<unsigned int> remap(vertices.size());
+    vector<Vertex> merged;
+    merged.reserve(vertices.size());
+    for(unsigned int i = 0; i < vertices.size(); i++) {
+        pair<unordered_map<Vertex, unsigned int, VertexBytesHash, VertexBytesEqual>::iterator, bool> inserted =
+            unique.insert(make_pair(vertices[i], (unsigned int)merged.size()));
+        if(inserted.second)
+            merged.push_back(vertices[i]);
+        remap[i] = inserted.first->second;
+    }
+    for(unsigned int i = 0; i < indices.size(); i++) {
+        indices[i] = remap[indices[i]];
+    }
+    vertices.swap(merged);
+}
+
+/* Vertex cache optimization */
+
+const unsigned int FORSYTH_CACHE_SIZE = 32;
+
+// Forsyth's score for a vertex at a cache position with a number of triangles still using it
+static float forsythVertexScore(int cachePosition, unsigned int remainingValence) {
+    if(remainingValence == 0)
+        return -1.0f; // no triangles left, never pick it
+    float score = 0.0f;
+    if(cachePosition >= 0) {
+        if(cachePosition < 3) {
+            // the last triangle's vertices get a fixed score so we don't just repeat the same strip
+            score = 0.75f;
+        }
+        else {
+            const float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = powf(1.0f - (cachePosition - 3) * scaler, 1.5f);
+        }
+    }
+    // boost vertices with few triangles left so we finish them off rather than leaving lone triangles
+    score += 2.0f * powf((float)remainingValence, -0.5f);
+    return score;
+}
+
+// Reorders triangles for the post-transform vertex cache
+void OptimizeVertexCache(vector<unsigned int> &indices, unsigned int numVertices) {
+    const unsigned int numTriangles = (unsigned int)(indices.size() / 3);
+    if(numTriangles == 0)
+        return;
+
+    // vertex -> triangle adjacency
+    vector<unsigned int> valence(numVertices, 0);
+    for(unsigned int i = 0; i < indices.size(); i++)
+        valence[indices[i]]++;
+    vector<unsigned int> adjacencyOffset(numVertices + 1, 0);
+    for(unsigned int v = 0; v < numVertices; v++)
+        adjacencyOffset[v + 1] = adjacencyOffset[v] + valence[v];
+    vector<unsigned int> adjacency(indices.size());
+    vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+    for(unsigned int t = 0; t < numTriangles; t++) {
+        for(unsigned int k = 0; k < 3; k++)
+            adjacency[fill[indices[t * 3 + k]]++] = t;
+    }
+
+    vector<int> cachePosition(numVertices, -1);
+    vector<float> vertexScore(numVertices);
+    for(unsigned int v = 0; v < numVertices; v++)
+        vertexScore[v] = forsythVertexScore(-1, valence[v]);
+    vector<float> triangleScore(numTriangles);
+    for(unsigned int t = 0; t < numTriangles; t++)
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+    vector<char> emitted(numTriangles, 0);
+
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+    unsigned int cacheCount = 0;
+    unsigned int scanCursor = 0;
+
+    int best = 0;
+    for(unsigned int t = 1; t < numTriangles; t++) {
+        if(triangleScore[t] > triangleScore[best])
+            best = (int)t;
+    }
+
+    while(best >= 0) {
+        const unsigned int *tri = &indices[best * 3];
+        result.insert(result.end(), tri, tri + 3);
+        emitted[best] = 1;
+
+        // push the triangle's vertices to the front of the LRU cache
+        unsigned int newCache[FORSYTH_CACHE_SIZE + 3];
+        unsigned int newCount = 0;
+        for(unsigned int k = 0; k < 3; k++)
+            newCache[newCount++] = tri[k];
+        for(unsigned int i = 0; i < cacheCount; i++) {
+            unsigned int v = cache[i];
+            if(v != tri[0] && v != tri[1] && v != tri[2])
+                newCache[newCount++] = v;
+        }
+
+        // the emitted triangle no longer counts towards its vertices' valence
+        for(unsigned int k = 0; k < 3; k++) {
+            unsigned int v = tri[k];
+            unsigned int *begin = &adjacency[adjacencyOffset[v]];
+            unsigned int *end = begin + valence[v];
+            unsigned int *found = std::find(begin, end, (unsigned int)best);
+            if(found != end) {
+                *found = *(end - 1);
+                valence[v]--;
+            }
+        }
+
+        // rescore everything that moved in or fell out of the cache and remember the best triangle touching it
+        best = -1;
+        float bestScore = -1.0f;
+        for(unsigned int i = 0; i < newCount; i++) {
+            unsigned int v = newCache[i];
+            int position = i < FORSYTH_CACHE_SIZE ? (int)i : -1;
+            cachePosition[v] = position;
+            float score = forsythVertexScore(position, valence[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            for(unsigned int a = 0; a < valence[v]; a++) {
+                unsigned int t = adjacency[adjacencyOffset[v] + a];
+                triangleScore[t] += delta;
+                if(triangleScore[t] > bestScore) {
+                    bestScore = triangleScore[t];
+                    best = (int)t;
+                }
+            }
+        }
+        cacheCount = min(newCount, FORSYTH_CACHE_SIZE);
+        memcpy(cache, newCache, cacheCount * sizeof(unsigned int));
+
+        // nothing in the cache has triangles left, restart from the next unemitted one
+        if(best < 0) {
+            while(scanCursor < numTriangles && emitted[scanCursor])
+                scanCursor++;
+            if(scanCursor < numTriangles)
+                best = (int)scanCursor;
+        }
+    }
+    indices.swap(result);
+}
+
+/* Overdraw optimization */
+
+// Splits the (already cache optimized) triangle order into clusters wherever the cache restarts and
+// sorts the clusters front to back from the mesh's point of view: clusters whose average normal points
+// away from the mesh center are drawn first since they are the most likely occluders.
+void OptimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices, unsigned int cacheSize = VERTEX_CACHE_SIZE) {
+    const unsigned int numTriangles = (unsigned int)(indices.size() / 3);
+    if(numTriangles < 2)
+        return;
+
+    // hard boundaries: triangles where every vertex missed the cache, the order there is arbitrary anyway
+    vector<unsigned int> clusterStarts;
+    vector<unsigned int> insertedAt(vertices.size(), 0);
+    unsigned int misses = 0;
+    for(unsigned int t = 0; t < numTriangles; t++) {
+        unsigned int triangleMisses = 0;
+        for(unsigned int k = 0; k < 3; k++) {
+            unsigned int v = indices[t * 3 + k];
+            if(insertedAt[v] == 0 || misses + 1 - insertedAt[v] > cacheSize) {
+                misses++;
+                insertedAt[v] = misses;
+                triangleMisses++;
+            }
+        }
+        if(t == 0 || triangleMisses == 3)
+            clusterStarts.push_back(t);
+    }
+    if(clusterStarts.size() < 2)
+        return;
+    clusterStarts.push_back(numTriangles);
+
+    glm::vec3 meshCenter(0.0f);
+    for(unsigned int i = 0; i < vertices.size(); i++)
+        meshCenter += vertices[i].Position;
+    meshCenter = meshCenter / (float)vertices.size();
+
+    const unsigned int numClusters = (unsigned int)clusterStarts.size() - 1;
+    vector<float> sortKey(numClusters);
+    for(unsigned int c = 0; c < numClusters; c++) {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for(unsigned int t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+            const glm::vec3 &p0 = vertices[indices[t * 3]].Position;
+            const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+            const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // length is twice the area
+            float a = glm::length(n);
+            center += (p0 + p1 + p2) * (a / 3.0f);
+            normal += n;
+            area += a;
+        }
+        if(area > 0.0f)
+            center = center / area;
+        float normalLength = glm::length(normal);
+        sortKey[c] = normalLength > 0.0f ? glm::dot(center - meshCenter, normal / normalLength) : 0.0f;
+    }
+
+    vector<unsigned int> order(numClusters);
+    for(unsigned int c = 0; c < numClusters; c++)
+        order[c] = c;
+    stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return sortKey[a] > sortKey[b]; });
+
+    vector<unsigned int> result;
+    result.reserve(indices.size());
+    for(unsigned int i = 0; i < numClusters; i++) {
+        unsigned int c = order[i];
+        result.insert(result.end(), indices.begin() + clusterStarts[c] * 3, indices.begin() + clusterStarts[c + 1] * 3);
+    }
+    indices.swap(result);
+}
+
+/* Vertex fetch optimization */
+
+// Renumbers vertices in the order the index buffer first uses them and drops unused ones
+void OptimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices) {
+    const unsigned int unused = ~0u;
+    vector<unsigned int> remap(vertices.size(), unused);
+    vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for(unsigned int i = 0; i < indices.size(); i++) {
+        unsigned int &target = remap[indices[i]];
+        if(target == unused) {
+            target = (unsigned int)reordered.size();
+            reordered.push_back(vertices[indices[i]]);
+        }
+        indices[i] = target;
+    }
+    vertices.swap(reordered);
+}
+
+/* All passes */
+
+MeshOptimizationReport OptimizeMesh(MeshData &mesh) {
+    MeshOptimizationReport report;
+    report.verticesBefore = (unsigned int)mesh.vertices.size();
+    report.triangles = (unsigned int)(mesh.indices.size() / 3);
+    report.before = AnalyzeVertexCache(mesh.indices, (unsigned int)mesh.vertices.size());
+
+    DeduplicateVertices(mesh.vertices, mesh.indices);
+    OptimizeVertexCache(mesh.indices, (unsigned int)mesh.vertices.size());
+    OptimizeOverdraw(mesh.indices, mesh.vertices);
+    OptimizeVertexFetch(mesh.vertices, mesh.indices);
+
+    report.verticesAfter = (unsigned int)mesh.vertices.size();
+    report.after = AnalyzeVertexCache(mesh.indices, (unsigned int)mesh.vertices.size());
+    return report;
+}
+
+void PrintOptimizationReport(unsigned int meshIndex, const MeshOptimizationReport &report) {
+    cout << "MESH_OPTIMIZER::MESH " << meshIndex << ": " << report.triangles << " triangles, vertices "
+         << report.verticesBefore << " -> " << report.verticesAfter
+         << ", ACMR " << report.before.acmr << " -> " << report.after.acmr
+         << ", ATVR " << report.before.atvr << " -> " << report.after.atvr << endl;
+}
+
+#endif /* mesh_optimizer_h */
@@ -0,0 +1,453 @@
+//
+//  mipmap.h
+//  Window
+//
+//  Created by William Goniprow on 2/25/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef mipmap_h
+#define mipmap_h
+
+#include <glad/glad.h>
+
+#include "job_system.h"
+#include "mapped_file.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+const uint32_t MIP_CACHE_MAGIC   = 0x5350494D; // "MIPS"
+const uint32_t MIP_CACHE_VERSION = 1;
+// texels a filter job works through at least, smaller levels stay on one thread
+const unsigned int MIP_JOB_TEXELS = 16384;
+
+enum Mip_Filter {
+    MIP_FILTER_BOX,     // 2x2 average, what glGenerateMipmap does
+    MIP_FILTER_KAISER,  // Kaiser windowed sinc, radius 3, sharper without much ringing
+    MIP_FILTER_LANCZOS  // Lanczos 3, sharpest, rings a little on hard edges
+};
+
+struct MipOptions {
+    Mip_Filter filter;
+    bool srgb;  // color channels are sRGB encoded and filtered in linear light, alpha always is linear
+    MipOptions() : filter(MIP_FILTER_BOX), srgb(true) {}
+};
+
+struct MipLevel {
+    unsigned int width;
+    unsigned int height;
+    vector<unsigned char> pixels; // rows tightly packed, channels bytes per texel
+};
+
+// Every level of a texture down to 1x1, level 0 is the source image
+struct MipChain {
+    unsigned int channels;
+    vector<MipLevel> levels;
+};
+
+// Builds the whole chain on the CPU. Each level is filtered from the one above it in linear float RGBA, the rows
+// of a level are split across the job system. No GL calls, safe to run in a job.
+void GenerateMipChain(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int channels, const MipOptions &options, MipChain &chain);
+// Uploads every level into the bound GL_TEXTURE_2D and limits sampling to them
+void UploadMipChain(const MipChain &chain);
+// Roughly what the chain takes in video memory, drivers pad RGB out to four bytes
+size_t MipChainBytes(const MipChain &chain);
+// Levels in a full chain for a width x height level 0, floor(log2(max(width, height))) + 1
+unsigned int MipLevelCount(unsigned int width, unsigned int height);
+// The chain stored next to sourcePath ("<texture>.<options>.mips") for the same file and options, skips decoding and filtering.
+// Each set of options has its own file, so loads of one image with different options don't overwrite each other's
+string MipCachePath(const string &sourcePath, const MipOptions &options);
+bool ReadMipCache(const string &sourcePath, const MipOptions &options, MipChain &chain);
+bool WriteMipCache(const string &sourcePath, const MipOptions &options, const MipChain &chain);
+
+// Whether texture loads read and write .mips files, off unless --mip-cache is given
+bool &MipCacheSetting() {
+    static bool enabled = false;
+    return enabled;
+}
+
+bool ParseMipCache(int argc, char **argv) {
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--mip-cache") == 0)
+            return true;
+    }
+    return false;
+}
+
+struct MipCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t filter;
+    uint32_t srgb;
+    int64_t  sourceMTime;
+    uint64_t sourceSize;
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t numLevels;
+};
+
+// RGBA float texels, the working format between levels
+struct MipImage {
+    unsigned int width;
+    unsigned int height;
+    vector<float> texels;
+};
+
+// Source texels feeding one destination texel along one axis, count of them per texel
+struct MipTaps {
+    unsigned int count;
+    vector<unsigned int> index;
+    vector<float> weight;
+};
+
+// Four floats, one RGBA texel, in an SSE register where there is one
+#if defined(__SSE2__)
+typedef __m128 MipTexel;
+inline MipTexel mipLoad(const float *p) { return _mm_loadu_ps(p); }
+inline void mipStore(float *p, MipTexel t) { _mm_storeu_ps(p, t); }
+inline MipTexel mipSplat(float f) { return _mm_set1_ps(f); }
+inline MipTexel mipAdd(MipTexel a, MipTexel b) { return _mm_add_ps(a, b); }
+inline MipTexel mipMul(MipTexel a, MipTexel b) { return _mm_mul_ps(a, b); }
+inline MipTexel mipSaturate(MipTexel t) { return _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(1.0f)); }
+#else
+struct MipTexel { float v[4]; };
+inline MipTexel mipLoad(const float *p) { MipTexel t; memcpy(t.v, p, sizeof(t.v)); return t; }
+inline void mipStore(float *p, MipTexel t) { memcpy(p, t.v, sizeof(t.v)); }
+inline MipTexel mipSplat(float f) { MipTexel t = {{ f, f, f, f }}; return t; }
+inline MipTexel mipAdd(MipTexel a, MipTexel b) { for(int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+inline MipTexel mipMul(MipTexel a, MipTexel b) { for(int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+inline MipTexel mipSaturate(MipTexel t) { for(int i = 0; i < 4; i++) t.v[i] = min(max(t.v[i], 0.0f), 1.0f); return t; }
+#endif
+
+struct MipSRGBTables {
+    float toLinear[256];
+    unsigned char toSRGB[4096]; // indexed by linear * 4095
+    MipSRGBTables() {
+        for(int i = 0; i < 256; i++) {
+            float c = i / 255.0f;
+            toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+        }
+        for(int i = 0; i < 4096; i++) {
+            float l = i / 4095.0f;
+            float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+            toSRGB[i] = (unsigned char)(c * 255.0f + 0.5f);
+        }
+    }
+};
+
+const MipSRGBTables &mipSRGBTables() {
+    static MipSRGBTables tables;
+    return tables;
+}
+
+// channels past the color ones are alpha: grey+alpha images have one color channel
+unsigned int mipColorChannels(unsigned int channels) {
+    return channels == 2 ? 1 : min(channels, 3u);
+}
+
+unsigned int mipRowGrain(unsigned int width) {
+    return max(1u, MIP_JOB_TEXELS / max(width, 1u));
+}
+
+void mipDecode(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int channels, bool srgb, MipImage &image) {
+    image.width = width;
+    image.height = height;
+    image.texels.resize((size_t)width * height * 4);
+    const MipSRGBTables &tables = mipSRGBTables();
+    const unsigned int colors = mipColorChannels(channels);
+    Jobs().ParallelFor(height, mipRowGrain(width), [&](unsigned int begin, unsigned int end) {
+        for(unsigned int y = begin; y < end; y++) {
+            const unsigned char *in = pixels + (size_t)y * width * channels;
+            float *out = &image.texels[(size_t)y * width * 4];
+            for(unsigned int x = 0; x < width; x++, in += channels, out += 4) {
+                out[0] = out[1] = out[2] = 0.0f;
+                out[3] = 1.0f;
+                for(unsigned int c = 0; c < channels; c++) {
+                    // grey+alpha keeps its alpha in the alpha slot
+                    unsigned int slot = channels == 2 && c == 1 ? 3 : c;
+                    out[slot] = srgb && c < colors ? tables.toLinear[in[c]] : in[c] / 255.0f;
+                }
+            }
+        }
+    });
+}
+
+void mipEncode(const MipImage &image, unsigned int channels, bool srgb, MipLevel &level) {
+    level.width = image.width;
+    level.height = image.height;
+    level.pixels.resize((size_t)image.width * image.height * channels);
+    const MipSRGBTables &tables = mipSRGBTables();
+    const unsigned int colors = mipColorChannels(channels);
+    Jobs().ParallelFor(image.height, mipRowGrain(image.width), [&](unsigned int begin, unsigned int end) {
+        for(unsigned int y = begin; y < end; y++) {
+            const float *in = &image.texels[(size_t)y * image.width * 4];
+            unsigned char *out = &level.pixels[(size_t)y * image.width * channels];
+            for(unsigned int x = 0; x < image.width; x++, in += 4, out += channels) {
+                for(unsigned int c = 0; c < channels; c++) {
+                    float v = min(max(in[channels == 2 && c == 1 ? 3 : c], 0.0f), 1.0f);
+                    out[c] = srgb && c < colors ? tables.toSRGB[(int)(v * 4095.0f + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+                }
+            }
+        }
+    });
+}
+
+void mipBox(const MipImage &source, MipImage &dest) {
+    const MipTexel quarter = mipSplat(0.25f);
+    Jobs().ParallelFor(dest.height, mipRowGrain(dest.width * 4), [&](unsigned int begin, unsigned int end) {
+        for(unsigned int y = begin; y < end; y++) {
+            // a dimension already at 1 averages the same texel with itself
+            const float *row0 = &source.texels[(size_t)min(y * 2, source.height - 1) * source.width * 4];
+            const float *row1 = &source.texels[(size_t)min(y * 2 + 1, source.height - 1) * source.width * 4];
+            float *out = &dest.texels[(size_t)y * dest.width * 4];
+            for(unsigned int x = 0; x < dest.width; x++) {
+                unsigned int x0 = min(x * 2, source.width - 1) * 4;
+                unsigned int x1 = min(x * 2 + 1, source.width - 1) * 4;
+                MipTexel sum = mipAdd(mipAdd(mipLoad(row0 + x0), mipLoad(row0 + x1)), mipAdd(mipLoad(row1 + x0), mipLoad(row1 + x1)));
+                mipStore(out + x * 4, mipMul(sum, quarter));
+            }
+        }
+    });
+}
+
+float mipSinc(float x) {
+    if(fabsf(x) < 1e-6f)
+        return 1.0f;
+    x *= 3.14159265f;
+    return sinf(x) / x;
+}
+
+// modified Bessel function of the first kind, order 0
+float mipBesselI0(float x) {
+    float sum = 1.0f, term = 1.0f, half = x * 0.5f;
+    for(int k = 1; k < 32 && term > sum * 1e-8f; k++) {
+        term *= (half / k) * (half / k);
+        sum += term;
+    }
+    return sum;
+}
+
+const float MIP_FILTER_RADIUS = 3.0f;
+const float MIP_KAISER_ALPHA = 4.0f;
+
+float mipKernel(Mip_Filter filter, float x) {
+    if(fabsf(x) >= MIP_FILTER_RADIUS)
+        return 0.0f;
+    if(filter == MIP_FILTER_LANCZOS)
+        return mipSinc(x) * mipSinc(x / MIP_FILTER_RADIUS);
+    float t = x / MIP_FILTER_RADIUS;
+    return mipSinc(x) * mipBesselI0(MIP_KAISER_ALPHA * sqrtf(1.0f - t * t)) / mipBesselI0(MIP_KAISER_ALPHA);
+}
+
+// Weights from sourceSize samples down to destSize, the kernel is stretched by the scale so it filters out what the
+// smaller level can't hold. Samples past the edges are clamped to it.
+void mipBuildTaps(Mip_Filter filter, unsigned int sourceSize, unsigned int destSize, MipTaps &taps) {
+    const float scale = (float)sourceSize / destSize;
+    const float support = MIP_FILTER_RADIUS * scale;
+    taps.count = (unsigned int)ceilf(support * 2.0f) + 1;
+    taps.index.resize((size_t)destSize * taps.count);
+    taps.weight.resize((size_t)destSize * taps.count);
+    for(unsigned int d = 0; d < destSize; d++) {
+        float center = (d + 0.5f) * scale;
+        int first = (int)floorf(center - support);
+        float total = 0.0f;
+        for(unsigned int k = 0; k < taps.count; k++) {
+            int s = first + (int)k;
+            float w = mipKernel(filter, (s + 0.5f - center) / scale);
+            taps.index[d * taps.count + k] = (unsigned int)min(max(s, 0), (int)sourceSize - 1);
+            taps.weight[d * taps.count + k] = w;
+            total += w;
+        }
+        for(unsigned int k = 0; k < taps.count; k++) {
+            taps.weight[d * taps.count + k] /= total;
+        }
+    }
+}
+
+// horizontal pass, dest is taps' size wide and as tall as source
+void mipFilterRows(const MipImage &source, const MipTaps &taps, MipImage &dest) {
+    Jobs().ParallelFor(dest.height, mipRowGrain(dest.width * taps.count), [&](unsigned int begin, unsigned int end) {
+        for(unsigned int y = begin; y < end; y++) {
+            const float *row = &source.texels[(size_t)y * source.width * 4];
+            float *out = &dest.texels[(size_t)y * dest.width * 4];
+            for(unsigned int x = 0; x < dest.width; x++) {
+                const unsigned int *index = &taps.index[x * taps.count];
+                const float *weight = &taps.weight[x * taps.count];
+                MipTexel sum = mipSplat(0.0f);
+                for(unsigned int k = 0; k < taps.count; k++) {
+                    sum = mipAdd(sum, mipMul(mipLoad(row + index[k] * 4), mipSplat(weight[k])));
+                }
+                mipStore(out + x * 4, sum);
+            }
+        }
+    });
+}
+
+// vertical pass, whole rows at a time so source is walked in memory order. Negative lobes can push texels out
+// of range, they are clamped here so the ringing doesn't build up level over level
+void mipFilterColumns(const MipImage &source, const MipTaps &taps, MipImage &dest) {
+    Jobs().ParallelFor(dest.height, mipRowGrain(dest.width * taps.count), [&](unsigned int begin, unsigned int end) {
+        for(unsigned int y = begin; y < end; y++) {
+            float *out = &dest.texels[(size_t)y * dest.width * 4];
+            fill(out, out + dest.width * 4, 0.0f);
+            for(unsigned int k = 0; k < taps.count; k++) {
+                const float *row = &source.texels[(size_t)taps.index[y * taps.count + k] * source.width * 4];
+                const MipTexel weight = mipSplat(taps.weight[y * taps.count + k]);
+                for(unsigned int x = 0; x < dest.width; x++) {
+                    mipStore(out + x * 4, mipAdd(mipLoad(out + x * 4), mipMul(mipLoad(row + x * 4), weight)));
+                }
+            }
+            for(unsigned int x = 0; x < dest.width; x++) {
+                mipStore(out + x * 4, mipSaturate(mipLoad(out + x * 4)));
+            }
+        }
+    });
+}
+
+void GenerateMipChain(const unsigned char *pixels, unsigned int width, unsigned int height, unsigned int channels, const MipOptions &options, MipChain &chain) {
+    chain.channels = channels;
+    chain.levels.clear();
+    if(width == 0 || height == 0)
+        return;
+    chain.levels.resize(1);
+    chain.levels[0].width = width;
+    chain.levels[0].height = height;
+    chain.levels[0].pixels.assign(pixels, pixels + (size_t)width * height * channels);
+
+    MipImage current, next, rows;
+    mipDecode(pixels, width, height, channels, options.srgb, current);
+    MipTaps horizontal, vertical;
+    while(current.width > 1 || current.height > 1) {
+        next.width  = max(current.width / 2, 1u);
+        next.height = max(current.height / 2, 1u);
+        next.texels.resize((size_t)next.width * next.height * 4);
+        if(options.filter == MIP_FILTER_BOX) {
+            mipBox(current, next);
+        }
+        else {
+            mipBuildTaps(options.filter, current.width, next.width, horizontal);
+            mipBuildTaps(options.filter, current.height, next.height, vertical);
+            rows.width = next.width;
+            rows.height = current.height;
+            rows.texels.resize((size_t)rows.width * rows.height * 4);
+            mipFilterRows(current, horizontal, rows);
+            mipFilterColumns(rows, vertical, next);
+        }
+        chain.levels.push_back(MipLevel());
+        mipEncode(next, channels, options.srgb, chain.levels.back());
+        current.texels.swap(next.texels);
+        current.width = next.width;
+        current.height = next.height;
+    }
+}
+
+void UploadMipChain(const MipChain &chain) {
+    GLenum format = GL_RGB;
+    if(chain.channels == 1)
+        format = GL_RED;
+    else if(chain.channels == 2)
+        format = GL_RG;
+    else if(chain.channels == 4)
+        format = GL_RGBA;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of 1 and 3 channel images are not 4 byte aligned
+    for(unsigned int i = 0; i < chain.levels.size(); i++) {
+        const MipLevel &level = chain.levels[i];
+        glTexImage2D(GL_TEXTURE_2D, i, format, level.width, level.height, 0, format, GL_UNSIGNED_BYTE, &level.pixels[0]);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, chain.levels.empty() ? 0 : (GLint)chain.levels.size() - 1);
+}
+
+size_t MipChainBytes(const MipChain &chain) {
+    size_t bytes = 0;
+    for(unsigned int i = 0; i < chain.levels.size(); i++) {
+        bytes += (size_t)chain.levels[i].width * chain.levels[i].height * (chain.channels == 3 ? 4 : chain.channels);
+    }
+    return bytes;
+}
+
+unsigned int MipLevelCount(unsigned int width, unsigned int height) {
+    unsigned int count = 1;
+    for(unsigned int size = max(width, height); size > 1; size /= 2) {
+        count++;
+    }
+    return count;
+}
+
+// e.g. marble.jpg.0s.mips for a box filtered sRGB chain
+string MipCachePath(const string &sourcePath, const MipOptions &options) {
+    return sourcePath + "." + to_string((int)options.filter) + (options.srgb ? "s" : "l") + ".mips";
+}
+
+bool ReadMipCache(const string &sourcePath, const MipOptions &options, MipChain &chain) {
+    int64_t mtime;
+    uint64_t size;
+    MappedFile file;
+    if(!StatFile(sourcePath, mtime, size) || !file.Open(MipCachePath(sourcePath, options)) || file.Size() < sizeof(MipCacheHeader))
+        return false;
+    const MipCacheHeader *header = (const MipCacheHeader *)file.Data();
+    if(header->magic != MIP_CACHE_MAGIC || header->version != MIP_CACHE_VERSION || header->filter != (uint32_t)options.filter ||
+       header->srgb != (uint32_t)options.srgb || header->sourceMTime != mtime || header->sourceSize != size ||
+       header->channels < 1 || header->channels > 4 || header->width == 0 || header->height == 0 ||
+       header->numLevels == 0 || header->numLevels > MipLevelCount(header->width, header->height))
+        return false;
+
+    // the level sizes follow from the top one, the file has to hold exactly those
+    chain.channels = header->channels;
+    chain.levels.clear();
+    size_t offset = sizeof(MipCacheHeader);
+    unsigned int width = header->width, height = header->height;
+    for(uint32_t i = 0; i < header->numLevels; i++) {
+        size_t bytes = (size_t)width * height * header->channels;
+        if(offset + bytes > file.Size())
+            return false;
+        chain.levels.push_back(MipLevel());
+        MipLevel &level = chain.levels.back();
+        level.width = width;
+        level.height = height;
+        level.pixels.assign(file.Data() + offset, file.Data() + offset + bytes);
+        offset += bytes;
+        width  = max(width / 2, 1u);
+        height = max(height / 2, 1u);
+    }
+    const MipLevel &last = chain.levels.back();
+    return offset == file.Size() && last.width == 1 && last.height == 1;
+}
+
+bool WriteMipCache(const string &sourcePath, const MipOptions &options, const MipChain &chain) {
+    MipCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    if(chain.levels.empty() || !StatFile(sourcePath, header.sourceMTime, header.sourceSize))
+        return false;
+    header.magic = MIP_CACHE_MAGIC;
+    header.version = MIP_CACHE_VERSION;
+    header.filter = (uint32_t)options.filter;
+    header.srgb = options.srgb;
+    header.width = chain.levels[0].width;
+    header.height = chain.levels[0].height;
+    header.channels = chain.channels;
+    header.numLevels = (uint32_t)chain.levels.size();
+
+    return WriteFileAtomically(MipCachePath(sourcePath, options), [&](ostream &out) {
+        out.write((const char *)&header, sizeof(header));
+        for(unsigned int i = 0; i < chain.levels.size(); i++) {
+            out.write((const char *)&chain.levels[i].pixels[0], chain.levels[i].pixels.size());
+        }
+    });
+}
+
+#endif /* mipmap_h */
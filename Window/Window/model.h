@@ -16,10 +16,20 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
-#include "stb_image.h"
 
+#include "draw_batch.h"
+#include "geometry_pool.h"
+#include "instance_buffer.h"
+#include "job_system.h"
+#include "material.h"
 #include "mesh.h"
+#include "mesh_cache.h"
+#include "mesh_optimizer.h"
+#include "obj_loader.h"
+#include "render_queue.h"
 #include "shader.h"
+#include "texture_cache.h"
+#include "texture_loader.h"
 
 #include <string>
 #include <fstream>
@@ -31,60 +41,238 @@ using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory);
 
+// Options for loading a model, combined as flags
+enum Model_Option {
+    MODEL_OPTIMIZE_MESHES    = 1 << 0, // reorder for vertex cache/overdraw/fetch at import, the result is what gets cached
+    MODEL_COMPACT_VERTICES   = 1 << 1, // VERTEX_PACKED on the GPU, draw with the *Packed.vs shaders
+    MODEL_QUANTIZE_POSITIONS = 1 << 2, // VERTEX_QUANTIZED on the GPU, draw with the *Packed.vs shaders
+    MODEL_SHARED_GEOMETRY    = 1 << 3  // meshes go into SharedGeometry() instead of their own buffers, needed for DrawBatch
+};
+
 class Model {
 public:
-    vector<Texture> textures_loaded;
+    vector<TextureHandle> textures_loaded; // keeps this model's textures in SharedTextures()
     vector<Mesh> meshes;
     string directory;
+    unsigned int options;
+    // bounding spheres of meshes, same order, for culling
+    BoundsSoA meshBounds;
     /* Functions */
-    Model(char* path) {
+    Model(char* path, unsigned int options = 0) : options(options), preparedProgram(0) {
         loadModel(path);
     }
-    void Draw(Shader shader);
+    void Draw(Shader &shader);
+    // Draws only the meshes whose bounds intersect the frustum, which must be in this model's space
+    // (Frustum::FromMatrix(projection * view * model))
+    void Draw(Shader &shader, const Frustum &frustum);
+    // Draws every mesh once per instance, no culling
+    void DrawInstanced(Shader &shader, const InstanceBuffer &instances, unsigned int instanceCount = ~0u);
+    // Resolves every mesh's uniforms for shader, call on one thread before recording this model from several
+    void PrepareSubmit(const Shader &shader);
+    // Queues the visible meshes instead of drawing them, frustum is in model space as for Draw.
+    // Safe to call from several threads at once after PrepareSubmit
+    void Submit(CommandBuffer &buffer, Shader &shader, const glm::mat4 &model, const Frustum &frustum) const;
+    // Adds the visible meshes to a batch, needs MODEL_SHARED_GEOMETRY
+    void Submit(DrawBatch &batch, const glm::mat4 &model, const Frustum &frustum);
+    // CPU side import through Assimp, no GL calls
+    static bool ImportAssimp(const string &path, unsigned int importFlags, vector<MeshData> &meshData);
 private:
+    unsigned int preparedProgram; // last program PrepareSubmit resolved for
     /* Functions */
     void loadModel(string path);
-    void processNode(aiNode *node, const aiScene *scene);
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene);
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName);
+    void loadFromCache(const MeshCache &cache);
+    void createMeshes(vector<MeshData> &meshData);
+    Vertex_Format vertexFormat() const;
+    GeometryPool *geometryPool() const;
+    static void processNode(aiNode *node, const aiScene *scene, vector<aiMesh *> &sceneMeshes);
+    static MeshData processMesh(aiMesh *mesh, const aiScene *scene);
+    static void loadMaterialTextures(aiMaterial *mat, aiTextureType type, Texture_Type textureType, vector<TextureRef> &textures);
+    static MaterialParams loadMaterialParams(aiMaterial *mat);
+    Texture loadTexture(const string &path, Texture_Type type);
 };
 
-void Model::Draw(Shader shader) {
+void Model::Draw(Shader &shader) {
     for(unsigned int i = 0; i < meshes.size(); i++) {
         meshes[i].Draw(shader);
     }
 }
 
+void Model::Draw(Shader &shader, const Frustum &frustum) {
+    // cull everything first, GL state is only touched for what survives
+    vector<uint8_t> visible;
+    CullSpheres(frustum, meshBounds, visible);
+    for(unsigned int i = 0; i < meshes.size(); i++) {
+        if(visible[i])
+            meshes[i].Draw(shader);
+    }
+}
+
+void Model::DrawInstanced(Shader &shader, const InstanceBuffer &instances, unsigned int instanceCount) {
+    for(unsigned int i = 0; i < meshes.size(); i++) {
+        meshes[i].DrawInstanced(shader, instances, instanceCount);
+    }
+}
+
+void Model::PrepareSubmit(const Shader &shader) {
+    if(preparedProgram == shader.ID)
+        return;
+    for(unsigned int i = 0; i < meshes.size(); i++) {
+        meshes[i].PrepareSubmit(shader);
+    }
+    preparedProgram = shader.ID;
+}
+
+void Model::Submit(CommandBuffer &buffer, Shader &shader, const glm::mat4 &model, const Frustum &frustum) const {
+    vector<uint8_t> visible;
+    CullSpheres(frustum, meshBounds, visible);
+    for(unsigned int i = 0; i < meshes.size(); i++) {
+        if(visible[i])
+            meshes[i].Submit(buffer, shader, model);
+    }
+}
+
+void Model::Submit(DrawBatch &batch, const glm::mat4 &model, const Frustum &frustum) {
+    vector<uint8_t> visible;
+    CullSpheres(frustum, meshBounds, visible);
+    for(unsigned int i = 0; i < meshes.size(); i++) {
+        if(visible[i])
+            batch.Add(meshes[i], model);
+    }
+}
+
 void Model::loadModel(string path) {
+    const unsigned int importFlags = aiProcess_Triangulate | aiProcess_FlipUVs;
+    directory = path.substr(0, path.find_last_of('/'));
+    
+    // warm start: the binary cache skips importing entirely
+    // only options that change the imported data are part of the cache key
+    MeshCache cache(path, importFlags, options & MODEL_OPTIMIZE_MESHES);
+    if(cache.Open()) {
+        loadFromCache(cache);
+        return;
+    }
+    
+    // Wavefront files go through the native loader, everything else (or an OBJ it rejects) through Assimp
+    vector<MeshData> meshData;
+    vector<string> libraries; // material files the import reads, part of the cache key
+    string extension = path.substr(path.find_last_of('.') + 1);
+    bool imported = false;
+    if(extension == "obj" || extension == "OBJ") {
+        ObjLoader loader((importFlags & aiProcess_FlipUVs) != 0);
+        imported = loader.Load(path, meshData);
+        libraries = loader.Libraries();
+        if(!imported) {
+            cout << "ERROR::OBJ::" << loader.GetErrorString() << endl;
+        }
+    }
+    if(!imported && !ImportAssimp(path, importFlags, meshData)) {
+        return;
+    }
+    
+    if(options & MODEL_OPTIMIZE_MESHES) {
+        vector<MeshOptimizationReport> reports(meshData.size());
+        Jobs().ParallelFor((unsigned int)meshData.size(), [&](unsigned int i) {
+            reports[i] = OptimizeMesh(meshData[i]);
+        });
+        for(unsigned int i = 0; i < reports.size(); i++) {
+            PrintOptimizationReport(i, reports[i]);
+        }
+    }
+    
+    createMeshes(meshData);
+    
+    if(!cache.Write(meshes, libraries)) {
+        cout << "ERROR::MESH_CACHE::FAILED_TO_WRITE " << path << ".meshcache" << endl;
+    }
+}
+
+bool Model::ImportAssimp(const string &path, unsigned int importFlags, vector<MeshData> &meshData) {
     Assimp::Importer import;
-    const aiScene *scene = import.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    const aiScene *scene = import.ReadFile(path, importFlags);
     
     if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
         cout << "ERROR::ASSIMP::" << import.GetErrorString() << endl;
-        return;
+        return false;
     }
-    directory = path.substr(0, path.find_last_of('/'));
     
-    processNode(scene->mRootNode, scene);
+    // flatten the node tree first so mesh order stays the same no matter how the work is scheduled
+    vector<aiMesh *> sceneMeshes;
+    processNode(scene->mRootNode, scene, sceneMeshes);
+    
+    // convert vertices, indices and materials on the job system, nothing here touches GL
+    size_t firstMesh = meshData.size();
+    meshData.resize(firstMesh + sceneMeshes.size());
+    Jobs().ParallelFor((unsigned int)sceneMeshes.size(), [&](unsigned int i) {
+        meshData[firstMesh + i] = processMesh(sceneMeshes[i], scene);
+    });
+    return true;
+}
+
+void Model::createMeshes(vector<MeshData> &meshData) {
+    // textures and buffer uploads need the context, so they stay on this thread
+    meshes.reserve(meshes.size() + meshData.size());
+    for(unsigned int i = 0; i < meshData.size(); i++) {
+        vector<Texture> textures;
+        for(unsigned int j = 0; j < meshData[i].textures.size(); j++) {
+            textures.push_back(loadTexture(meshData[i].textures[j].path, meshData[i].textures[j].type));
+        }
+        Material *material = Materials().Get(textures, meshData[i].material);
+        meshes.push_back(Mesh(std::move(meshData[i].vertices), std::move(meshData[i].indices), material, vertexFormat(), geometryPool()));
+        meshBounds.Add(meshes.back().sphere);
+    }
+}
+
+Vertex_Format Model::vertexFormat() const {
+    if(options & MODEL_QUANTIZE_POSITIONS)
+        return VERTEX_QUANTIZED;
+    if(options & MODEL_COMPACT_VERTICES)
+        return VERTEX_PACKED;
+    return VERTEX_FLOAT;
+}
+
+GeometryPool *Model::geometryPool() const {
+    if(options & MODEL_SHARED_GEOMETRY)
+        return &SharedGeometry(vertexFormat());
+    return NULL;
+}
+
+void Model::loadFromCache(const MeshCache &cache) {
+    const Vertex *vertices = cache.Vertices();
+    const unsigned int *indices = cache.Indices();
+    meshes.reserve(cache.NumMeshes());
+    for(unsigned int i = 0; i < cache.NumMeshes(); i++) {
+        const CacheMesh &m = cache.GetMesh(i);
+        vector<Texture> textures;
+        for(unsigned int j = 0; j < m.numTextures; j++) {
+            textures.push_back(loadTexture(cache.TexturePath(m.firstTexture + j), cache.TextureType(m.firstTexture + j)));
+        }
+        Material *material = Materials().Get(textures, cache.GetMaterial(i));
+        // straight copies out of the mapped file, no per-vertex work
+        meshes.push_back(Mesh(vector<Vertex>(vertices + m.firstVertex, vertices + m.firstVertex + m.numVertices),
+                              vector<unsigned int>(indices + m.firstIndex, indices + m.firstIndex + m.numIndices),
+                              material, vertexFormat(), geometryPool()));
+        meshBounds.Add(meshes.back().sphere);
+    }
 }
 
-void Model::processNode(aiNode *node, const aiScene *scene) {
-    // process all the nodes meshes (if any)
+void Model::processNode(aiNode *node, const aiScene *scene, vector<aiMesh *> &sceneMeshes) {
+    // collect all the nodes meshes (if any)
     for(unsigned int i = 0; i < node->mNumMeshes; i++) {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        meshes.push_back(processMesh(mesh, scene));
+        sceneMeshes.push_back(scene->mMeshes[node->mMeshes[i]]);
     }
     // then do the same for each of its children
     for(unsigned int i = 0; i < node->mNumChildren; i++) {
-        processNode(node->mChildren[i], scene);
+        processNode(node->mChildren[i], scene, sceneMeshes);
     }
 }
 
-Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
-    vector<Texture> textures;
+MeshData Model::processMesh(aiMesh *mesh, const aiScene *scene) {
+    MeshData data;
+    vector<Vertex> &vertices = data.vertices;
+    vector<unsigned int> &indices = data.indices;
     
+    vertices.reserve(mesh->mNumVertices);
+    indices.reserve(mesh->mNumFaces * 3);
     for(unsigned int i = 0; i < mesh->mNumVertices; i++) {
         Vertex vertex;
         glm::vec3 vector;
@@ -117,76 +305,55 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
     // process materials
     if(mesh->mMaterialIndex >= 0) {
         aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-        vector<Texture> diffuseMaps  = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+        loadMaterialTextures(material, aiTextureType_DIFFUSE, TEXTURE_DIFFUSE, data.textures);
+        loadMaterialTextures(material, aiTextureType_SPECULAR, TEXTURE_SPECULAR, data.textures);
+        data.material = loadMaterialParams(material);
     }
     
-    return Mesh(vertices, indices, textures);
+    return data;
 }
 
-vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName) {
-    vector<Texture> textures;
+void Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, Texture_Type textureType, vector<TextureRef> &textures) {
     for(unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
         aiString str;
         mat->GetTexture(type, i, &str);
-        bool skip = false;
-        for(unsigned int j = 0; j < textures_loaded.size(); j++) {
-            if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0) {
-                textures.push_back(textures_loaded[j]);
-                skip = true;
-                break;
-            }
-        }
-        if(!skip) { // if texture hasnt already been loaded load it
-            Texture texture;
-            texture.id = TextureFromFile(str.C_Str(), directory);
-            texture.type = type;
-            texture.path = str.C_Str();
-            textures.push_back(texture);
-            textures_loaded.push_back(texture); // add to loaded textures
-        }
+        TextureRef texture;
+        texture.type = textureType;
+        texture.path = str.C_Str();
+        textures.push_back(texture);
     }
-    return textures;
+}
+
+MaterialParams Model::loadMaterialParams(aiMaterial *mat) {
+    // anything the material leaves out keeps the default
+    MaterialParams params;
+    float shininess;
+    aiColor3D color;
+    if(mat->Get(AI_MATKEY_SHININESS, shininess) == AI_SUCCESS)
+        params.shininess = shininess;
+    if(mat->Get(AI_MATKEY_COLOR_DIFFUSE, color) == AI_SUCCESS)
+        params.diffuse = glm::vec3(color.r, color.g, color.b);
+    if(mat->Get(AI_MATKEY_COLOR_SPECULAR, color) == AI_SUCCESS)
+        params.specular = glm::vec3(color.r, color.g, color.b);
+    return params;
+}
+
+Texture Model::loadTexture(const string &path, Texture_Type type) {
+    // the cache hands every model naming this file the same texture, specular maps only need one channel
+    TextureHandle handle = SharedTextures().Load(directory + '/' + path, type == TEXTURE_SPECULAR ? TEXTURE_LOAD_MASK : 0);
+    textures_loaded.push_back(handle);
+    Texture texture;
+    texture.id = handle.ID();
+    texture.type = type;
+    texture.path = path;
+    return texture;
 }
 
 unsigned int TextureFromFile(const char *path, const string &directory) {
     string filename = string(path);
     filename = directory + '/' + filename;
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-        format = GL_RED;
-        else if (nrComponents == 3)
-        format = GL_RGB;
-        else if (nrComponents == 4)
-        format = GL_RGBA;
-        
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-    
-    return textureID;
+    // decoded in the background, the returned texture holds a placeholder until Textures().Update() uploads it
+    return Textures().Load(filename);
 }
 
 #endif /* model_h */
@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;       // float, or unorm16 relative to the mesh bounds
+layout (location = 1) in vec2 aNormal;    // octahedral encoded
+layout (location = 2) in vec2 aTexCoords; // half floats
+
+out vec2 TexCoords;
+
+uniform mat4 model;
+// shared by every program, see frame_uniforms.h
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
+// set by Mesh::Draw, identity for VERTEX_PACKED
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+void main() {
+    TexCoords = aTexCoords;
+    vec3 position = aPos * positionScale + positionOffset;
+    gl_Position = viewProjection * model * vec4(position, 1.0);
+}
@@ -0,0 +1,30 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;       // any Vertex_Format, scaled back below
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 8) in uint aDrawID;    // from DrawBatch, one per mesh
+
+out vec2 TexCoords;
+
+// shared by every program, see frame_uniforms.h
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
+// per draw: model matrix columns, then position offset and scale
+uniform samplerBuffer drawData;
+
+void main() {
+    int base = int(aDrawID) * 6;
+    mat4 model = mat4(texelFetch(drawData, base),
+                      texelFetch(drawData, base + 1),
+                      texelFetch(drawData, base + 2),
+                      texelFetch(drawData, base + 3));
+    vec3 positionOffset = texelFetch(drawData, base + 4).xyz;
+    vec3 positionScale  = texelFetch(drawData, base + 5).xyz;
+    
+    TexCoords = aTexCoords;
+    vec3 position = aPos * positionScale + positionOffset;
+    gl_Position = viewProjection * model * vec4(position, 1.0);
+}
@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+// per instance, from InstanceBuffer
+layout (location = 3) in mat4 aModel;
+layout (location = 7) in uint aMaterial;
+
+out vec2 TexCoords;
+flat out uint MaterialIndex;
+
+// shared by every program, see frame_uniforms.h
+layout (std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec3 viewPos;
+};
+
+void main() {
+    TexCoords = aTexCoords;
+    MaterialIndex = aMaterial;
+    gl_Position = viewProjection * aModel * vec4(aPos, 1.0);
+}
@@ -0,0 +1,71 @@
+//
+//  no_glfw.h
+//  Window
+//
+//  Created by William Goniprow on 2/29/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef no_glfw_h
+#define no_glfw_h
+
+#include <cstddef>
+#include <iostream>
+using namespace std;
+
+// Stand-ins for the GLFW calls main.cpp makes, included instead of GLFW/glfw3.h when building with
+// -DWINDOW_NO_GLFW on a machine without GLFW. There is never a window: glfwInit fails, so only --headless
+// runs. The constants are GLFW's own, recorded key codes mean the same thing in either build.
+
+typedef struct GLFWwindow GLFWwindow;
+typedef struct GLFWmonitor GLFWmonitor;
+typedef void (*GLFWframebuffersizefun)(GLFWwindow *, int, int);
+typedef void (*GLFWkeyfun)(GLFWwindow *, int, int, int, int);
+typedef void (*GLFWcursorposfun)(GLFWwindow *, double, double);
+typedef void (*GLFWscrollfun)(GLFWwindow *, double, double);
+
+#define GLFW_FALSE 0
+#define GLFW_TRUE  1
+#define GLFW_PRESS  1
+#define GLFW_REPEAT 2
+
+#define GLFW_KEY_1      49
+#define GLFW_KEY_2      50
+#define GLFW_KEY_3      51
+#define GLFW_KEY_A      65
+#define GLFW_KEY_D      68
+#define GLFW_KEY_S      83
+#define GLFW_KEY_W      87
+#define GLFW_KEY_ESCAPE 256
+
+#define GLFW_CONTEXT_VERSION_MAJOR  0x00022002
+#define GLFW_CONTEXT_VERSION_MINOR  0x00022003
+#define GLFW_OPENGL_FORWARD_COMPAT  0x00022006
+#define GLFW_OPENGL_PROFILE         0x00022008
+#define GLFW_OPENGL_CORE_PROFILE    0x00032001
+#define GLFW_CURSOR                 0x00033001
+#define GLFW_CURSOR_DISABLED        0x00034003
+
+/* Functions */
+int glfwInit() {
+    cout << "ERROR::WINDOW::BUILT_WITHOUT_GLFW run with --headless" << endl;
+    return GLFW_FALSE;
+}
+void glfwTerminate() {}
+void glfwWindowHint(int, int) {}
+GLFWwindow *glfwCreateWindow(int, int, const char *, GLFWmonitor *, GLFWwindow *) { return NULL; }
+void glfwMakeContextCurrent(GLFWwindow *) {}
+void *glfwGetProcAddress(const char *) { return NULL; }
+void glfwGetFramebufferSize(GLFWwindow *, int *width, int *height) { *width = *height = 0; }
+GLFWframebuffersizefun glfwSetFramebufferSizeCallback(GLFWwindow *, GLFWframebuffersizefun) { return NULL; }
+GLFWkeyfun glfwSetKeyCallback(GLFWwindow *, GLFWkeyfun) { return NULL; }
+GLFWcursorposfun glfwSetCursorPosCallback(GLFWwindow *, GLFWcursorposfun) { return NULL; }
+GLFWscrollfun glfwSetScrollCallback(GLFWwindow *, GLFWscrollfun) { return NULL; }
+void glfwSetInputMode(GLFWwindow *, int, int) {}
+int glfwWindowShouldClose(GLFWwindow *) { return GLFW_TRUE; }
+void glfwSetWindowShouldClose(GLFWwindow *, int) {}
+double glfwGetTime() { return 0.0; }
+void glfwPollEvents() {}
+void glfwSwapBuffers(GLFWwindow *) {}
+
+#endif /* no_glfw_h */
@@ -0,0 +1,629 @@
+//
+//  obj_loader.h
+//  Window
+//
+//  Created by William Goniprow on 2/9/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef obj_loader_h
+#define obj_loader_h
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "mapped_file.h"
+#include "job_system.h"
+
+#include <stdint.h>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Material read from an .mtl library
+struct ObjMaterial {
+    string name;
+    float shininess;
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+    string diffuseMap;
+    string specularMap;
+    string normalMap;
+};
+
+// Native Wavefront OBJ/MTL loader producing the same MeshData as the Assimp path.
+// The file is memory mapped and cut into line ranges that are parsed on the job system; faces are
+// then split into one mesh per object/group/material run, triangulated as fans, and expanded into
+// indexed vertices with identical position/uv/normal corners shared.
+class ObjLoader {
+public:
+    /* Functions */
+    ObjLoader(bool flipUVs = true) : flipUVs(flipUVs) {}
+    bool Load(const string &path, vector<MeshData> &meshes);
+    const string &GetErrorString() const { return error; }
+    const vector<ObjMaterial> &Materials() const { return materials; }
+    // Paths of the .mtl libraries the last Load referenced, filled in even if it failed after parsing
+    const vector<string> &Libraries() const { return libraries; }
+private:
+    // one face corner, 0 based indices into the global arrays (-1 when the corner has none).
+    // While parsing, indices flagged in relative are still counted from the start of their chunk
+    struct Corner {
+        int v, vt, vn;
+        unsigned int relative; // bit i for v, vt, vn
+    };
+    // a run of faces started by o/g/usemtl
+    struct Group {
+        unsigned int firstFace;
+        string material;
+        bool inheritMaterial; // o/g keep whatever material was active, which may come from an earlier chunk
+    };
+    // one line range of the file and everything parsed from it
+    struct Chunk {
+        const char *begin;
+        const char *end;
+        vector<float> positions;
+        vector<float> texcoords;
+        vector<float> normals;
+        vector<Corner> corners;
+        vector<unsigned int> faceStarts;
+        vector<Group> groups;
+        vector<string> libraries;
+        bool failed;
+    };
+    /* Loader Data */
+    bool flipUVs;
+    string error;
+    vector<ObjMaterial> materials;
+    vector<string> libraries;
+    /* Functions */
+    static void parseChunk(Chunk &chunk);
+    static void resolveCorner(Corner &corner, const Chunk &chunk);
+    bool loadMaterials(const string &path);
+    void buildMesh(const vector<float> &positions, const vector<float> &texcoords, const vector<float> &normals,
+                   const vector<Corner> &corners, const vector<unsigned int> &faceStarts,
+                   unsigned int firstFace, unsigned int lastFace, const string &material, MeshData &mesh, bool &failed) const;
+};
+
+/* Number parsing */
+
+// Powers of ten that are exact in a double, so mantissa * 10^e is correctly rounded for up to 15 digits
+static const double OBJ_POW10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static inline bool objIsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline const char *objSkipSpace(const char *p, const char *end) {
+    while(p < end && objIsSpace(*p))
+        p++;
+    return p;
+}
+
+// Parses a float at p, returns the position after it or NULL if there is no number.
+// Plain decimal numbers take a fast path; anything unusual (long mantissas, big exponents, inf/nan) goes to strtod.
+static const char *objParseFloat(const char *p, const char *end, float &out) {
+    p = objSkipSpace(p, end);
+    const char *start = p;
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool sawDigit = false;
+    for(; p < end && (unsigned)(*p - '0') < 10; p++) {
+        sawDigit = true;
+        if(digits < 19) {
+            mantissa = mantissa * 10 + (unsigned)(*p - '0');
+            if(mantissa)
+                digits++;
+        }
+        else {
+            exponent++;
+        }
+    }
+    if(p < end && *p == '.') {
+        p++;
+        for(; p < end && (unsigned)(*p - '0') < 10; p++) {
+            sawDigit = true;
+            if(digits < 19) {
+                mantissa = mantissa * 10 + (unsigned)(*p - '0');
+                if(mantissa)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+    if(sawDigit && p < end && (*p == 'e' || *p == 'E')) {
+        const char *e = p + 1;
+        bool negativeExponent = false;
+        if(e < end && (*e == '-' || *e == '+')) {
+            negativeExponent = *e == '-';
+            e++;
+        }
+        if(e < end && (unsigned)(*e - '0') < 10) {
+            int value = 0;
+            for(; e < end && (unsigned)(*e - '0') < 10; e++) {
+                if(value < 10000)
+                    value = value * 10 + (*e - '0');
+            }
+            exponent += negativeExponent ? -value : value;
+            p = e;
+        }
+    }
+    if(sawDigit && digits <= 15 && exponent >= -22 && exponent <= 22) {
+        double value = exponent < 0 ? (double)mantissa / OBJ_POW10[-exponent] : (double)mantissa * OBJ_POW10[exponent];
+        out = (float)(negative ? -value : value);
+        return p;
+    }
+
+    // slow path, strtod needs a terminated copy since the mapping isn't
+    const char *tokenEnd = start;
+    while(tokenEnd < end && !objIsSpace(*tokenEnd) && *tokenEnd != '\n' && *tokenEnd != '/')
+        tokenEnd++;
+    char buffer[64];
+    size_t length = (size_t)(tokenEnd - start);
+    if(length == 0 || length >= sizeof(buffer))
+        return NULL;
+    memcpy(buffer, start, length);
+    buffer[length] = '\0';
+    char *parsed;
+    double value = strtod(buffer, &parsed);
+    if(parsed == buffer)
+        return NULL;
+    out = (float)value;
+    return start + (parsed - buffer);
+}
+
+// Parses a (possibly negative) integer, returns NULL if there is none or it doesn't fit in an int
+static inline const char *objParseInt(const char *p, const char *end, int &out) {
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if(p >= end || (unsigned)(*p - '0') >= 10)
+        return NULL;
+    int64_t value = 0;
+    for(; p < end && (unsigned)(*p - '0') < 10; p++) {
+        value = value * 10 + (*p - '0');
+        if(value > INT32_MAX)
+            return NULL;
+    }
+    out = negative ? -(int)value : (int)value;
+    return p;
+}
+
+// Name following a keyword, trimmed
+static inline string objRestOfLine(const char *p, const char *end) {
+    p = objSkipSpace(p, end);
+    while(end > p && objIsSpace(end[-1]))
+        end--;
+    return string(p, end);
+}
+
+static inline bool objKeyword(const char *p, const char *end, const char *keyword, size_t length) {
+    return (size_t)(end - p) > length && memcmp(p, keyword, length) == 0 && objIsSpace(p[length]);
+}
+
+/* Parsing */
+
+void ObjLoader::parseChunk(Chunk &chunk) {
+    chunk.failed = false;
+    const char *p = chunk.begin;
+    const char *end = chunk.end;
+    while(p < end) {
+        const char *lineEnd = (const char *)memchr(p, '\n', (size_t)(end - p));
+        if(!lineEnd)
+            lineEnd = end;
+        const char *line = objSkipSpace(p, lineEnd);
+        p = lineEnd + 1;
+        if(line >= lineEnd)
+            continue;
+
+        if(line[0] == 'v') {
+            float values[3] = { 0.0f, 0.0f, 0.0f };
+            if(line + 1 < lineEnd && objIsSpace(line[1])) {
+                const char *q = line + 1;
+                for(int i = 0; i < 3 && q; i++)
+                    q = objParseFloat(q, lineEnd, values[i]);
+                if(!q)
+                    chunk.failed = true;
+                chunk.positions.insert(chunk.positions.end(), values, values + 3);
+            }
+            else if(line + 2 < lineEnd && line[1] == 't' && objIsSpace(line[2])) {
+                const char *q = line + 2;
+                for(int i = 0; i < 2 && q; i++)
+                    q = objParseFloat(q, lineEnd, values[i]);
+                if(!q)
+                    chunk.failed = true;
+                chunk.texcoords.insert(chunk.texcoords.end(), values, values + 2);
+            }
+            else if(line + 2 < lineEnd && line[1] == 'n' && objIsSpace(line[2])) {
+                const char *q = line + 2;
+                for(int i = 0; i < 3 && q; i++)
+                    q = objParseFloat(q, lineEnd, values[i]);
+                if(!q)
+                    chunk.failed = true;
+                chunk.normals.insert(chunk.normals.end(), values, values + 3);
+            }
+        }
+        else if(line[0] == 'f' && line + 1 < lineEnd && objIsSpace(line[1])) {
+            chunk.faceStarts.push_back((unsigned int)chunk.corners.size());
+            const char *q = objSkipSpace(line + 1, lineEnd);
+            while(q < lineEnd) {
+                Corner corner;
+                corner.vt = 0;
+                corner.vn = 0;
+                corner.relative = 0;
+                q = objParseInt(q, lineEnd, corner.v);
+                if(!q) {
+                    chunk.failed = true;
+                    break;
+                }
+                if(q < lineEnd && *q == '/') {
+                    q++;
+                    if(q < lineEnd && *q != '/') {
+                        q = objParseInt(q, lineEnd, corner.vt);
+                        if(!q) {
+                            chunk.failed = true;
+                            break;
+                        }
+                    }
+                    if(q < lineEnd && *q == '/') {
+                        q = objParseInt(q + 1, lineEnd, corner.vn);
+                        if(!q) {
+                            chunk.failed = true;
+                            break;
+                        }
+                    }
+                }
+                resolveCorner(corner, chunk);
+                chunk.corners.push_back(corner);
+                q = objSkipSpace(q, lineEnd);
+            }
+        }
+        else if((line[0] == 'o' || line[0] == 'g') && (line + 1 == lineEnd || objIsSpace(line[1]))) {
+            Group group;
+            group.firstFace = (unsigned int)chunk.faceStarts.size();
+            group.inheritMaterial = true;
+            chunk.groups.push_back(group);
+        }
+        else if(objKeyword(line, lineEnd, "usemtl", 6)) {
+            Group group;
+            group.firstFace = (unsigned int)chunk.faceStarts.size();
+            group.material = objRestOfLine(line + 6, lineEnd);
+            group.inheritMaterial = false;
+            chunk.groups.push_back(group);
+        }
+        else if(objKeyword(line, lineEnd, "mtllib", 6)) {
+            chunk.libraries.push_back(objRestOfLine(line + 6, lineEnd));
+        }
+        // everything else (comments, smoothing groups, lines, ...) is ignored
+    }
+}
+
+// OBJ indices are 1 based, or negative relative to the elements read so far. Absolute ones are final now,
+// relative ones become chunk local count + index, which is negative when they reach back into earlier chunks,
+// and are moved to global indices in the merge once the chunk offsets are known.
+void ObjLoader::resolveCorner(Corner &corner, const Chunk &chunk) {
+    int counts[3] = {
+        (int)(chunk.positions.size() / 3),
+        (int)(chunk.texcoords.size() / 2),
+        (int)(chunk.normals.size() / 3)
+    };
+    int *indices[3] = { &corner.v, &corner.vt, &corner.vn };
+    for(int i = 0; i < 3; i++) {
+        int &index = *indices[i];
+        if(index > 0) {
+            index = index - 1;
+        }
+        else if(index < 0) {
+            index = counts[i] + index;
+            corner.relative |= 1u << i;
+        }
+        else {
+            index = INT32_MIN; // not present
+        }
+    }
+}
+
+bool ObjLoader::loadMaterials(const string &path) {
+    ifstream file(path.c_str());
+    if(!file) {
+        return false;
+    }
+    string line;
+    ObjMaterial *material = NULL;
+    while(getline(file, line)) {
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        istringstream stream(line);
+        string keyword;
+        stream >> keyword;
+        if(keyword == "newmtl") {
+            ObjMaterial m;
+            m.name = objRestOfLine(line.c_str() + line.find("newmtl") + 6, line.c_str() + line.size());
+            // whatever the library leaves out keeps the Material default
+            MaterialParams defaults;
+            m.shininess = defaults.shininess;
+            m.diffuse = defaults.diffuse;
+            m.specular = defaults.specular;
+            materials.push_back(m);
+            material = &materials.back();
+        }
+        else if(!material) {
+            continue;
+        }
+        else if(keyword == "Ns") {
+            stream >> material->shininess;
+        }
+        else if(keyword == "Kd") {
+            stream >> material->diffuse.x >> material->diffuse.y >> material->diffuse.z;
+        }
+        else if(keyword == "Ks") {
+            stream >> material->specular.x >> material->specular.y >> material->specular.z;
+        }
+        else if(keyword == "map_Kd" || keyword == "map_Ks" || keyword == "map_Bump" || keyword == "map_bump" || keyword == "bump") {
+            // map statements may carry options (-bm 1 ...), the file name is always last
+            string token, name;
+            while(stream >> token)
+                name = token;
+            if(keyword == "map_Kd")
+                material->diffuseMap = name;
+            else if(keyword == "map_Ks")
+                material->specularMap = name;
+            else
+                material->normalMap = name;
+        }
+    }
+    return true;
+}
+
+/* Mesh building */
+
+struct ObjCornerKey {
+    int v, vt, vn;
+    bool operator==(const ObjCornerKey &other) const {
+        return v == other.v && vt == other.vt && vn == other.vn;
+    }
+};
+
+struct ObjCornerHash {
+    size_t operator()(const ObjCornerKey &key) const {
+        uint64_t h = (uint64_t)(uint32_t)key.v * 0x9E3779B97F4A7C15ull;
+        h ^= (uint64_t)(uint32_t)key.vt * 0xC2B2AE3D27D4EB4Full + (h >> 31);
+        h ^= (uint64_t)(uint32_t)key.vn * 0x165667B19E3779F9ull + (h >> 29);
+        return (size_t)h;
+    }
+};
+
+void ObjLoader::buildMesh(const vector<float> &positions, const vector<float> &texcoords, const vector<float> &normals,
+                          const vector<Corner> &corners, const vector<unsigned int> &faceStarts,
+                          unsigned int firstFace, unsigned int lastFace, const string &material, MeshData &mesh, bool &failed) const {
+    const int numPositions = (int)(positions.size() / 3);
+    const int numTexcoords = (int)(texcoords.size() / 2);
+    const int numNormals   = (int)(normals.size() / 3);
+
+    // corners that reference the same position/uv/normal become one vertex
+    unordered_map<ObjCornerKey, unsigned int, ObjCornerHash> unique;
+    unique.reserve((faceStarts[lastFace] - faceStarts[firstFace]) / 2 + 16);
+    mesh.vertices.reserve((faceStarts[lastFace] - faceStarts[firstFace]) / 2 + 16);
+    mesh.indices.reserve((lastFace - firstFace) * 3);
+
+    unsigned int triangle[3];
+    for(unsigned int f = firstFace; f < lastFace; f++) {
+        unsigned int begin = faceStarts[f];
+        unsigned int count = faceStarts[f + 1] - begin;
+        for(unsigned int c = 0; c < count; c++) {
+            const Corner &corner = corners[begin + c];
+            if(corner.v < 0 || corner.v >= numPositions || corner.vt >= numTexcoords || corner.vn >= numNormals) {
+                failed = true;
+                return;
+            }
+            ObjCornerKey key = { corner.v, corner.vt, corner.vn };
+            unordered_map<ObjCornerKey, unsigned int, ObjCornerHash>::iterator found = unique.find(key);
+            unsigned int index;
+            if(found != unique.end()) {
+                index = found->second;
+            }
+            else {
+                Vertex vertex;
+                vertex.Position = glm::vec3(positions[corner.v * 3], positions[corner.v * 3 + 1], positions[corner.v * 3 + 2]);
+                if(corner.vn >= 0)
+                    vertex.Normal = glm::vec3(normals[corner.vn * 3], normals[corner.vn * 3 + 1], normals[corner.vn * 3 + 2]);
+                else
+                    vertex.Normal = glm::vec3(0.0f, 0.0f, 0.0f);
+                if(corner.vt >= 0) {
+                    float v = texcoords[corner.vt * 2 + 1];
+                    vertex.TexCoords = glm::vec2(texcoords[corner.vt * 2], flipUVs ? 1.0f - v : v);
+                }
+                else {
+                    vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                }
+                index = (unsigned int)mesh.vertices.size();
+                mesh.vertices.push_back(vertex);
+                unique[key] = index;
+            }
+            // triangulate as a fan around the first corner
+            if(c < 2) {
+                triangle[c] = index;
+            }
+            else {
+                triangle[2] = index;
+                mesh.indices.insert(mesh.indices.end(), triangle, triangle + 3);
+                triangle[1] = index;
+            }
+        }
+    }
+
+    // same material order as the Assimp path: diffuse first, then specular
+    for(unsigned int i = 0; i < materials.size(); i++) {
+        if(materials[i].name != material)
+            continue;
+        if(!materials[i].diffuseMap.empty()) {
+            TextureRef texture = { TEXTURE_DIFFUSE, materials[i].diffuseMap };
+            mesh.textures.push_back(texture);
+        }
+        if(!materials[i].specularMap.empty()) {
+            TextureRef texture = { TEXTURE_SPECULAR, materials[i].specularMap };
+            mesh.textures.push_back(texture);
+        }
+        mesh.material.shininess = materials[i].shininess;
+        mesh.material.diffuse   = materials[i].diffuse;
+        mesh.material.specular  = materials[i].specular;
+        break;
+    }
+}
+
+bool ObjLoader::Load(const string &path, vector<MeshData> &meshes) {
+    error.clear();
+    materials.clear();
+    libraries.clear();
+    MappedFile file;
+    if(!file.Open(path)) {
+        error = "Unable to open file \"" + path + "\"";
+        return false;
+    }
+    const char *data = file.Data();
+    const size_t size = file.Size();
+
+    // cut the file into line ranges, a few per worker so uneven chunks even out
+    JobSystem &jobs = Jobs();
+    size_t numChunks = (size_t)(jobs.NumWorkers() + 1) * 4;
+    const size_t minChunkSize = 64 * 1024;
+    if(size / numChunks < minChunkSize)
+        numChunks = size / minChunkSize + 1;
+    vector<Chunk> chunks(numChunks);
+    const char *cursor = data;
+    for(size_t i = 0; i < numChunks; i++) {
+        chunks[i].begin = cursor;
+        const char *target = data + size * (i + 1) / numChunks;
+        if(target < cursor)
+            target = cursor;
+        const char *newline = target < data + size ? (const char *)memchr(target, '\n', (size_t)(data + size - target)) : NULL;
+        cursor = newline ? newline + 1 : data + size;
+        chunks[i].end = cursor;
+    }
+
+    jobs.ParallelFor((unsigned int)chunks.size(), [&](unsigned int i) {
+        parseChunk(chunks[i]);
+    });
+    string directory = path.substr(0, path.find_last_of('/') + 1);
+    for(size_t i = 0; i < numChunks; i++) {
+        for(size_t j = 0; j < chunks[i].libraries.size(); j++) {
+            libraries.push_back(directory + chunks[i].libraries[j]);
+        }
+    }
+
+    // prefix sums give every chunk its place in the global arrays
+    vector<size_t> positionOffset(numChunks + 1, 0), texcoordOffset(numChunks + 1, 0), normalOffset(numChunks + 1, 0);
+    vector<size_t> cornerOffset(numChunks + 1, 0), faceOffset(numChunks + 1, 0);
+    for(size_t i = 0; i < numChunks; i++) {
+        if(chunks[i].failed) {
+            error = "Malformed statement in \"" + path + "\"";
+            return false;
+        }
+        positionOffset[i + 1] = positionOffset[i] + chunks[i].positions.size();
+        texcoordOffset[i + 1] = texcoordOffset[i] + chunks[i].texcoords.size();
+        normalOffset[i + 1]   = normalOffset[i] + chunks[i].normals.size();
+        cornerOffset[i + 1]   = cornerOffset[i] + chunks[i].corners.size();
+        faceOffset[i + 1]     = faceOffset[i] + chunks[i].faceStarts.size();
+    }
+    vector<float> positions(positionOffset[numChunks]);
+    vector<float> texcoords(texcoordOffset[numChunks]);
+    vector<float> normals(normalOffset[numChunks]);
+    vector<Corner> corners(cornerOffset[numChunks]);
+    vector<unsigned int> faceStarts(faceOffset[numChunks] + 1);
+    faceStarts[faceOffset[numChunks]] = (unsigned int)cornerOffset[numChunks];
+
+    // merge the chunks and finish the relative indices now that the offsets are known
+    jobs.ParallelFor((unsigned int)numChunks, [&](unsigned int i) {
+        const Chunk &chunk = chunks[i];
+        if(!chunk.positions.empty())
+            memcpy(&positions[positionOffset[i]], &chunk.positions[0], chunk.positions.size() * sizeof(float));
+        if(!chunk.texcoords.empty())
+            memcpy(&texcoords[texcoordOffset[i]], &chunk.texcoords[0], chunk.texcoords.size() * sizeof(float));
+        if(!chunk.normals.empty())
+            memcpy(&normals[normalOffset[i]], &chunk.normals[0], chunk.normals.size() * sizeof(float));
+        const int bases[3] = { (int)(positionOffset[i] / 3), (int)(texcoordOffset[i] / 2), (int)(normalOffset[i] / 3) };
+        for(size_t c = 0; c < chunk.corners.size(); c++) {
+            Corner corner = chunk.corners[c];
+            int *indices[3] = { &corner.v, &corner.vt, &corner.vn };
+            for(int k = 0; k < 3; k++) {
+                int &index = *indices[k];
+                if(corner.relative & (1u << k)) {
+                    // relative indices may reach back into any earlier chunk, or before the start of the file
+                    const int64_t global = (int64_t)bases[k] + index;
+                    index = global >= 0 && global < INT32_MAX ? (int)global : INT32_MAX; // rejected when the mesh is built
+                }
+                else if(index == INT32_MIN) {
+                    index = -1;
+                }
+            }
+            corners[cornerOffset[i] + c] = corner;
+        }
+        for(size_t f = 0; f < chunk.faceStarts.size(); f++) {
+            faceStarts[faceOffset[i] + f] = (unsigned int)(cornerOffset[i] + chunk.faceStarts[f]);
+        }
+    });
+
+    // material libraries are tiny, read them serially
+    for(size_t i = 0; i < libraries.size(); i++) {
+        if(!loadMaterials(libraries[i])) {
+            cout << "WARNING::OBJ::MATERIAL_LIBRARY_NOT_FOUND " << libraries[i] << endl;
+        }
+    }
+
+    // one mesh per run of faces between o/g/usemtl statements
+    vector<Group> groups;
+    Group first = { 0, "", false };
+    groups.push_back(first);
+    for(size_t i = 0; i < numChunks; i++) {
+        for(size_t j = 0; j < chunks[i].groups.size(); j++) {
+            Group group = chunks[i].groups[j];
+            group.firstFace += (unsigned int)faceOffset[i];
+            if(group.inheritMaterial)
+                group.material = groups.back().material;
+            groups.push_back(group);
+        }
+    }
+    vector<unsigned int> meshGroups;
+    for(size_t g = 0; g < groups.size(); g++) {
+        unsigned int lastFace = g + 1 < groups.size() ? groups[g + 1].firstFace : (unsigned int)faceOffset[numChunks];
+        if(lastFace > groups[g].firstFace)
+            meshGroups.push_back((unsigned int)g);
+    }
+
+    size_t firstMesh = meshes.size();
+    meshes.resize(firstMesh + meshGroups.size());
+    vector<char> failed(meshGroups.size(), 0);
+    jobs.ParallelFor((unsigned int)meshGroups.size(), [&](unsigned int i) {
+        unsigned int g = meshGroups[i];
+        unsigned int lastFace = g + 1 < groups.size() ? groups[g + 1].firstFace : (unsigned int)faceOffset[numChunks];
+        bool meshFailed = false;
+        buildMesh(positions, texcoords, normals, corners, faceStarts, groups[g].firstFace, lastFace, groups[g].material, meshes[firstMesh + i], meshFailed);
+        failed[i] = meshFailed;
+    });
+    for(size_t i = 0; i < failed.size(); i++) {
+        if(failed[i]) {
+            meshes.resize(firstMesh);
+            error = "Face index out of range in \"" + path + "\"";
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif /* obj_loader_h */
@@ -0,0 +1,313 @@
+//
+//  profiler.h
+//  Window
+//
+//  Created by William Goniprow on 2/18/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef profiler_h
+#define profiler_h
+
+#include <glad/glad.h>
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+const unsigned int PROFILER_GPU_FRAMES   = 3;   // GPU results are read this many frames later, so never waited on
+const unsigned int PROFILER_WINDOW       = 240; // frames kept per scope for min/avg/p95/p99
+const unsigned int PROFILER_TRACE_FRAMES = 300; // frames kept for the Chrome trace export
+
+struct ProfileStats {
+    unsigned int samples;
+    double minMs;
+    double avgMs;
+    double p95Ms;
+    double p99Ms;
+    double maxMs;
+};
+
+// One timed interval, in microseconds on the CPU clock (GPU intervals are shifted onto it)
+struct ProfileEvent {
+    string name;
+    double start;
+    double duration;
+    int thread;  // -1 for the GPU
+};
+
+// Named CPU and GPU timings, totalled per frame and kept for the last PROFILER_WINDOW frames.
+// CPU scopes may be opened on any thread, GPU scopes only on the GL thread. Frames are delimited
+// by BeginFrame/EndFrame on the GL thread.
+class Profiler {
+public:
+    /* Functions */
+    Profiler();
+    void BeginFrame();
+    void EndFrame();
+    // Microseconds since the profiler was created
+    double Now() const { return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count(); }
+    void AddCpuSample(const char *name, double start, double end);
+    // GPU scopes are GL_TIMESTAMP pairs rather than GL_TIME_ELAPSED so they can nest
+    void BeginGpu(const char *name);
+    void EndGpu();
+    ProfileStats CpuStats(const string &name) const { lock_guard<mutex> guard(lock); return stats(cpuHistory, name); }
+    ProfileStats GpuStats(const string &name) const { lock_guard<mutex> guard(lock); return stats(gpuHistory, name); }
+    unsigned long long DroppedGpuFrames() const { return droppedGpuFrames; }
+    // scope,kind,samples,min_ms,avg_ms,p95_ms,p99_ms,max_ms
+    bool WriteCSV(const string &path) const;
+    // Trace Event Format, open in chrome://tracing or Perfetto
+    bool WriteChromeTrace(const string &path) const;
+private:
+    /* Profiler Data */
+    typedef map<string, deque<double> > History;
+    struct GpuQuery {
+        const char *name;
+        unsigned int begin;
+        unsigned int end;
+    };
+    struct GpuFrame {
+        vector<GpuQuery> queries;
+        size_t used;
+        bool pending;
+    };
+    chrono::steady_clock::time_point epoch;
+    mutable mutex lock;
+    History cpuHistory;
+    History gpuHistory;
+    map<string, double> cpuFrameTotals;
+    vector<ProfileEvent> frameEvents;
+    deque<vector<ProfileEvent> > traceFrames;
+    map<thread::id, int> threadIndices;
+    GpuFrame gpuFrames[PROFILER_GPU_FRAMES];
+    unsigned int gpuFrame;
+    vector<size_t> gpuStack;
+    double gpuClockOffset; // CPU microseconds minus GPU microseconds
+    bool gpuTimers;
+    unsigned long long droppedGpuFrames;
+    /* Functions */
+    void collectGpuFrame(GpuFrame &frame);
+    static void addSample(History &history, const string &name, double milliseconds);
+    static ProfileStats stats(const History &history, const string &name);
+    int threadIndex();
+};
+
+Profiler &Profile() {
+    static Profiler profiler;
+    return profiler;
+}
+
+// Times the enclosing block on the calling thread
+class ProfileScope {
+public:
+    ProfileScope(const char *name) : name(name), start(Profile().Now()) {}
+    ~ProfileScope() { Profile().AddCpuSample(name, start, Profile().Now()); }
+private:
+    const char *name;
+    double start;
+};
+
+// Times the GL commands issued in the enclosing block, GL thread only
+class GpuProfileScope {
+public:
+    GpuProfileScope(const char *name) { Profile().BeginGpu(name); }
+    ~GpuProfileScope() { Profile().EndGpu(); }
+};
+
+Profiler::Profiler() : epoch(chrono::steady_clock::now()), gpuFrame(0), gpuClockOffset(0.0), gpuTimers(false), droppedGpuFrames(0) {
+    for(unsigned int i = 0; i < PROFILER_GPU_FRAMES; i++) {
+        gpuFrames[i].used = 0;
+        gpuFrames[i].pending = false;
+    }
+}
+
+int Profiler::threadIndex() {
+    map<thread::id, int>::iterator it = threadIndices.find(this_thread::get_id());
+    if(it != threadIndices.end())
+        return it->second;
+    int index = (int)threadIndices.size();
+    threadIndices[this_thread::get_id()] = index;
+    return index;
+}
+
+void Profiler::AddCpuSample(const char *name, double start, double end) {
+    lock_guard<mutex> guard(lock);
+    cpuFrameTotals[name] += (end - start) / 1000.0;
+    ProfileEvent event;
+    event.name = name;
+    event.start = start;
+    event.duration = end - start;
+    event.thread = threadIndex();
+    frameEvents.push_back(event);
+}
+
+void Profiler::BeginFrame() {
+    if(!gpuTimers) {
+        // timer queries are core in 3.3, but line the GPU clock up with ours once for the trace
+        GLint64 gpuTime = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+        gpuClockOffset = Now() - gpuTime / 1000.0;
+        gpuTimers = true;
+    }
+    // this slot was last used PROFILER_GPU_FRAMES frames ago, its results should long be in
+    gpuFrame = (gpuFrame + 1) % PROFILER_GPU_FRAMES;
+    collectGpuFrame(gpuFrames[gpuFrame]);
+    gpuFrames[gpuFrame].used = 0;
+    gpuStack.clear();
+}
+
+void Profiler::EndFrame() {
+    gpuFrames[gpuFrame].pending = gpuFrames[gpuFrame].used > 0;
+    lock_guard<mutex> guard(lock);
+    for(map<string, double>::iterator it = cpuFrameTotals.begin(); it != cpuFrameTotals.end(); ++it) {
+        addSample(cpuHistory, it->first, it->second);
+    }
+    cpuFrameTotals.clear();
+    traceFrames.push_back(vector<ProfileEvent>());
+    traceFrames.back().swap(frameEvents);
+    while(traceFrames.size() > PROFILER_TRACE_FRAMES)
+        traceFrames.pop_front();
+}
+
+void Profiler::BeginGpu(const char *name) {
+    GpuFrame &frame = gpuFrames[gpuFrame];
+    if(frame.used == frame.queries.size()) {
+        GpuQuery query;
+        unsigned int ids[2];
+        glGenQueries(2, ids);
+        query.begin = ids[0];
+        query.end = ids[1];
+        frame.queries.push_back(query);
+    }
+    GpuQuery &query = frame.queries[frame.used];
+    query.name = name;
+    glQueryCounter(query.begin, GL_TIMESTAMP);
+    gpuStack.push_back(frame.used);
+    frame.used++;
+}
+
+void Profiler::EndGpu() {
+    if(gpuStack.empty()) {
+        cout << "ERROR::PROFILER::GPU_SCOPE_MISMATCH" << endl;
+        return;
+    }
+    glQueryCounter(gpuFrames[gpuFrame].queries[gpuStack.back()].end, GL_TIMESTAMP);
+    gpuStack.pop_back();
+}
+
+void Profiler::collectGpuFrame(GpuFrame &frame) {
+    if(!frame.pending)
+        return;
+    frame.pending = false;
+    // a frame with any result still outstanding is dropped rather than waited on
+    for(size_t i = 0; i < frame.used; i++) {
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[i].end, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(!available) {
+            droppedGpuFrames++;
+            return;
+        }
+    }
+    map<string, double> totals;
+    vector<ProfileEvent> events;
+    for(size_t i = 0; i < frame.used; i++) {
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(frame.queries[i].begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(frame.queries[i].end, GL_QUERY_RESULT, &end);
+        double duration = (end - begin) / 1000.0;
+        totals[frame.queries[i].name] += duration / 1000.0;
+        ProfileEvent event;
+        event.name = frame.queries[i].name;
+        event.start = begin / 1000.0 + gpuClockOffset;
+        event.duration = duration;
+        event.thread = -1;
+        events.push_back(event);
+    }
+    lock_guard<mutex> guard(lock);
+    for(map<string, double>::iterator it = totals.begin(); it != totals.end(); ++it) {
+        addSample(gpuHistory, it->first, it->second);
+    }
+    frameEvents.insert(frameEvents.end(), events.begin(), events.end());
+}
+
+void Profiler::addSample(History &history, const string &name, double milliseconds) {
+    deque<double> &samples = history[name];
+    samples.push_back(milliseconds);
+    if(samples.size() > PROFILER_WINDOW)
+        samples.pop_front();
+}
+
+ProfileStats Profiler::stats(const History &history, const string &name) {
+    ProfileStats result = ProfileStats();
+    History::const_iterator it = history.find(name);
+    if(it == history.end() || it->second.empty())
+        return result;
+    vector<double> sorted(it->second.begin(), it->second.end());
+    sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for(size_t i = 0; i < sorted.size(); i++)
+        sum += sorted[i];
+    // nearest rank
+    size_t n = sorted.size();
+    result.samples = (unsigned int)n;
+    result.minMs = sorted.front();
+    result.maxMs = sorted.back();
+    result.avgMs = sum / n;
+    result.p95Ms = sorted[min(n - 1, (size_t)(0.95 * n))];
+    result.p99Ms = sorted[min(n - 1, (size_t)(0.99 * n))];
+    return result;
+}
+
+bool Profiler::WriteCSV(const string &path) const {
+    ofstream out(path.c_str());
+    if(!out) {
+        cout << "ERROR::PROFILER::FILE_NOT_WRITTEN " << path << endl;
+        return false;
+    }
+    lock_guard<mutex> guard(lock);
+    out << "scope,kind,samples,min_ms,avg_ms,p95_ms,p99_ms,max_ms\n";
+    const History *histories[2] = {&cpuHistory, &gpuHistory};
+    const char *kinds[2] = {"cpu", "gpu"};
+    for(int h = 0; h < 2; h++) {
+        for(History::const_iterator it = histories[h]->begin(); it != histories[h]->end(); ++it) {
+            ProfileStats s = stats(*histories[h], it->first);
+            out << it->first << ',' << kinds[h] << ',' << s.samples << ',' << s.minMs << ',' << s.avgMs << ','
+                << s.p95Ms << ',' << s.p99Ms << ',' << s.maxMs << '\n';
+        }
+    }
+    return (bool)out;
+}
+
+bool Profiler::WriteChromeTrace(const string &path) const {
+    ofstream out(path.c_str());
+    if(!out) {
+        cout << "ERROR::PROFILER::FILE_NOT_WRITTEN " << path << endl;
+        return false;
+    }
+    lock_guard<mutex> guard(lock);
+    out << "{\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1000,\"args\":{\"name\":\"GPU\"}}";
+    out.precision(3);
+    out << fixed;
+    for(size_t f = 0; f < traceFrames.size(); f++) {
+        for(size_t i = 0; i < traceFrames[f].size(); i++) {
+            const ProfileEvent &event = traceFrames[f][i];
+            out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.thread < 0 ? "gpu" : "cpu")
+                << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.thread < 0 ? 1000 : event.thread)
+                << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+        }
+    }
+    out << "\n]}\n";
+    return (bool)out;
+}
+
+#endif /* profiler_h */
@@ -0,0 +1,335 @@
+//
+//  render_queue.h
+//  Window
+//
+//  Created by William Goniprow on 2/13/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef render_queue_h
+#define render_queue_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "job_system.h"
+#include "material.h"
+#include "shader.h"
+#include "texture_cache.h"
+
+#include <stdint.h>
+#include <cstring>
+#include <functional>
+#include <vector>
+using namespace std;
+
+const unsigned int RENDER_MAX_TEXTURES = 4;
+
+enum Render_Pass {
+    RENDER_OPAQUE      = 0, // front to back inside each state group
+    RENDER_TRANSLUCENT = 1  // always after opaque, back to front
+};
+
+// Sort key layout, most significant bits first:
+//   opaque:      pass:2 | program:10 | textures:14 | vao:14 | depth:24
+//   translucent: pass:2 | ~depth:24  | program:10  | textures:14 | vao:14
+// program/vao are the GL names and textures the material ID (a hash of the texture names without a material)
+// folded into their fields. Two different
+// states can share a field value, that only costs a bind, the payload is what gets executed.
+const int RENDER_KEY_PASS_SHIFT  = 62;
+const int RENDER_KEY_DEPTH_BITS  = 24;
+const uint64_t RENDER_KEY_PROGRAM_MASK  = (1u << 10) - 1;
+const uint64_t RENDER_KEY_TEXTURES_MASK = (1u << 14) - 1;
+const uint64_t RENDER_KEY_VAO_MASK      = (1u << 14) - 1;
+const uint64_t RENDER_KEY_DEPTH_MASK    = (1u << RENDER_KEY_DEPTH_BITS) - 1;
+
+// Everything needed to issue one draw
+struct DrawCommand {
+    Shader *shader;
+    unsigned int vao;
+    GLenum mode;
+    GLenum indexType;           // 0 draws arrays
+    unsigned int first;         // first vertex, or first index
+    unsigned int count;
+    int baseVertex;             // added to every index
+    unsigned int instances;     // more than 1 needs an InstanceBuffer attached to vao
+    const Material *material;   // optional, its parameters are set and it is what the draws are grouped by
+    unsigned int numTextures;   // bound to units 0..numTextures-1
+    unsigned int textures[RENDER_MAX_TEXTURES];
+    Uniform<int> samplers[RENDER_MAX_TEXTURES]; // optional, set to the unit of the texture
+    Uniform<glm::mat4> modelUniform;
+    glm::mat4 model;
+    // dequantization for the packed vertex formats, only set if the handles are valid
+    Uniform<glm::vec3> positionOffsetUniform;
+    Uniform<glm::vec3> positionScaleUniform;
+    glm::vec3 positionOffset;
+    glm::vec3 positionScale;
+
+    DrawCommand() : shader(NULL), vao(0), mode(GL_TRIANGLES), indexType(0), first(0), count(0), baseVertex(0), instances(1), material(NULL), numTextures(0),
+                    model(1.0f), positionOffset(0.0f), positionScale(1.0f) {
+        memset(textures, 0, sizeof(textures));
+    }
+};
+
+struct RenderQueueStats {
+    unsigned int draws;
+    unsigned int programBinds;
+    unsigned int vaoBinds;
+    unsigned int textureBinds;
+    unsigned int buffers;   // command buffers merged, the queue's own included
+};
+
+// Draws recorded by one thread: plain structs with their sort keys, no GL calls. Each thread records into
+// its own buffer, RenderQueue::Execute merges them all into one sorted pass.
+class CommandBuffer {
+public:
+    /* Functions */
+    CommandBuffer() : viewPosition(0.0f), farPlane(100.0f) {}
+    // Records a draw, center is the world space point used for depth sorting
+    void Submit(const DrawCommand &command, const glm::vec3 &center, Render_Pass pass = RENDER_OPAQUE);
+    size_t Size() const { return commands.size(); }
+private:
+    /* Buffer Data */
+    vector<DrawCommand> commands;
+    vector<uint64_t> keys;
+    glm::vec3 viewPosition;
+    float farPlane;
+    /* Functions */
+    void reset(const glm::vec3 &viewPosition, float farPlane);
+    friend class RenderQueue;
+};
+
+// Collects a frame's draws, sorts them by state and depth and issues them with redundant binds skipped.
+// Submit() and Record() only record, GL is touched in Execute().
+class RenderQueue : public CommandBuffer {
+public:
+    /* Functions */
+    RenderQueue() : usedBuffers(0) { memset(&stats, 0, sizeof(stats)); }
+    // Starts a frame, depth is the distance from viewPosition scaled to [0, farPlane]
+    void Begin(const glm::vec3 &viewPosition, float farPlane);
+    // Calls record(buffer, begin, end) over [0, count) in ranges of grain items on the job system, every range
+    // into a buffer of its own, and returns once all are recorded. record must not touch GL. Ranges are merged
+    // in order, so the frame comes out the same as recording serially, whatever the thread count.
+    void Record(unsigned int count, unsigned int grain, const function<void(CommandBuffer &, unsigned int, unsigned int)> &record);
+    // Merges, sorts and issues everything recorded since Begin, leaves no VAO bound
+    void Execute();
+    size_t Size() const;
+    const RenderQueueStats &Stats() const { return stats; }
+
+    static uint64_t MakeKey(Render_Pass pass, const DrawCommand &command, float depth);
+private:
+    /* Queue Data */
+    struct SortItem {
+        uint64_t key;
+        uint32_t buffer;   // 0 is the queue itself, n is recordBuffers[n - 1]
+        uint32_t index;
+    };
+    vector<CommandBuffer> recordBuffers;   // kept across frames so their vectors keep their capacity
+    unsigned int usedBuffers;
+    vector<SortItem> items;
+    vector<SortItem> scratch;
+    RenderQueueStats stats;
+    /* Functions */
+    void merge();
+    void sortItems();
+    const CommandBuffer &buffer(uint32_t index) const { return index == 0 ? *this : recordBuffers[index - 1]; }
+};
+
+void CommandBuffer::reset(const glm::vec3 &viewPosition, float farPlane) {
+    this->viewPosition = viewPosition;
+    this->farPlane = farPlane;
+    commands.clear();
+    keys.clear();
+}
+
+void CommandBuffer::Submit(const DrawCommand &command, const glm::vec3 &center, Render_Pass pass) {
+    float depth = glm::length(center - viewPosition) / farPlane;
+    keys.push_back(RenderQueue::MakeKey(pass, command, depth));
+    commands.push_back(command);
+}
+
+uint64_t RenderQueue::MakeKey(Render_Pass pass, const DrawCommand &command, float depth) {
+    uint64_t textureHash = 0;
+    if(command.material) {
+        // IDs are handed out densely, so they only collide past 16k materials
+        textureHash = command.material->ID();
+    }
+    else {
+        for(unsigned int i = 0; i < command.numTextures; i++) {
+            textureHash = textureHash * 31 + command.textures[i];
+        }
+        textureHash ^= textureHash >> 14;
+    }
+    uint64_t program  = (command.shader ? command.shader->ID : 0) & RENDER_KEY_PROGRAM_MASK;
+    uint64_t textures = textureHash & RENDER_KEY_TEXTURES_MASK;
+    uint64_t vao      = command.vao & RENDER_KEY_VAO_MASK;
+    uint64_t state    = (program << 28) | (textures << 14) | vao;
+
+    depth = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+    uint64_t quantized = (uint64_t)(depth * (float)RENDER_KEY_DEPTH_MASK);
+    if(quantized > RENDER_KEY_DEPTH_MASK)
+        quantized = RENDER_KEY_DEPTH_MASK;
+
+    if(pass == RENDER_OPAQUE)
+        return ((uint64_t)pass << RENDER_KEY_PASS_SHIFT) | (state << RENDER_KEY_DEPTH_BITS) | quantized;
+    return ((uint64_t)pass << RENDER_KEY_PASS_SHIFT) | ((RENDER_KEY_DEPTH_MASK - quantized) << 38) | state;
+}
+
+void RenderQueue::Begin(const glm::vec3 &viewPosition, float farPlane) {
+    reset(viewPosition, farPlane);
+    usedBuffers = 0;
+    items.clear();
+}
+
+void RenderQueue::Record(unsigned int count, unsigned int grain, const function<void(CommandBuffer &, unsigned int, unsigned int)> &record) {
+    if(count == 0)
+        return;
+    if(grain == 0)
+        grain = 1;
+    // every buffer is handed out before the jobs start, so recordBuffers doesn't move under them
+    unsigned int first = usedBuffers;
+    usedBuffers += (count + grain - 1) / grain;
+    if(recordBuffers.size() < usedBuffers)
+        recordBuffers.resize(usedBuffers);
+    for(unsigned int i = first; i < usedBuffers; i++) {
+        recordBuffers[i].reset(viewPosition, farPlane);
+    }
+    Jobs().ParallelFor(count, grain, [this, &record, first, grain](unsigned int begin, unsigned int end) {
+        record(recordBuffers[first + begin / grain], begin, end);
+    });
+}
+
+size_t RenderQueue::Size() const {
+    size_t size = commands.size();
+    for(unsigned int i = 0; i < usedBuffers; i++) {
+        size += recordBuffers[i].commands.size();
+    }
+    return size;
+}
+
+void RenderQueue::merge() {
+    items.clear();
+    items.reserve(Size());
+    for(uint32_t b = 0; b <= usedBuffers; b++) {
+        const CommandBuffer &source = buffer(b);
+        for(size_t i = 0; i < source.keys.size(); i++) {
+            SortItem item;
+            item.key = source.keys[i];
+            item.buffer = b;
+            item.index = (uint32_t)i;
+            items.push_back(item);
+        }
+    }
+}
+
+// LSD radix sort on the keys, 8 bits per pass. Passes where every key has the same digit are skipped,
+// which with few shaders/VAOs is most of the state bits.
+void RenderQueue::sortItems() {
+    const size_t count = items.size();
+    if(count < 2)
+        return;
+    size_t histograms[8][256];
+    memset(histograms, 0, sizeof(histograms));
+    for(size_t i = 0; i < count; i++) {
+        uint64_t key = items[i].key;
+        for(int pass = 0; pass < 8; pass++) {
+            histograms[pass][(key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    scratch.resize(count);
+    SortItem *source = &items[0];
+    SortItem *destination = &scratch[0];
+    for(int pass = 0; pass < 8; pass++) {
+        size_t *histogram = histograms[pass];
+        if(histogram[(source[0].key >> (pass * 8)) & 0xFF] == count)
+            continue;
+        // counts to starting offsets
+        size_t offset = 0;
+        for(int digit = 0; digit < 256; digit++) {
+            size_t digitCount = histogram[digit];
+            histogram[digit] = offset;
+            offset += digitCount;
+        }
+        for(size_t i = 0; i < count; i++) {
+            destination[histogram[(source[i].key >> (pass * 8)) & 0xFF]++] = source[i];
+        }
+        SortItem *swap = source;
+        source = destination;
+        destination = swap;
+    }
+    if(source != &items[0])
+        memcpy(&items[0], source, count * sizeof(SortItem));
+}
+
+void RenderQueue::Execute() {
+    memset(&stats, 0, sizeof(stats));
+    stats.buffers = usedBuffers + 1;
+    merge();
+    sortItems();
+
+    Shader *currentShader = NULL;
+    const Material *currentMaterial = NULL;
+    unsigned int currentVAO = 0;
+    unsigned int boundTextures[RENDER_MAX_TEXTURES] = {0};
+    unsigned int activeUnit = 0;
+    glActiveTexture(GL_TEXTURE0);
+    for(size_t i = 0; i < items.size(); i++) {
+        const DrawCommand &command = buffer(items[i].buffer).commands[items[i].index];
+        if(command.shader != currentShader) {
+            command.shader->use();
+            currentShader = command.shader;
+            currentMaterial = NULL;
+            stats.programBinds++;
+        }
+        if(command.material != currentMaterial) {
+            if(command.material)
+                command.material->SetParameters(*currentShader);
+            currentMaterial = command.material;
+        }
+        if(command.vao != currentVAO || i == 0) {
+            glBindVertexArray(command.vao);
+            currentVAO = command.vao;
+            stats.vaoBinds++;
+        }
+        for(unsigned int unit = 0; unit < command.numTextures; unit++) {
+            if(boundTextures[unit] != command.textures[unit] || i == 0) {
+                if(activeUnit != unit) {
+                    glActiveTexture(GL_TEXTURE0 + unit);
+                    activeUnit = unit;
+                }
+                glBindTexture(GL_TEXTURE_2D, command.textures[unit]);
+                // keeps it resident, or brings it back if the cache evicted it
+                SharedTextures().Touch(command.textures[unit]);
+                boundTextures[unit] = command.textures[unit];
+                stats.textureBinds++;
+            }
+            // the shader drops these when the unit is already what the sampler holds
+            currentShader->Set(command.samplers[unit], (int)unit);
+        }
+        currentShader->Set(command.modelUniform, command.model);
+        currentShader->Set(command.positionOffsetUniform, command.positionOffset);
+        currentShader->Set(command.positionScaleUniform, command.positionScale);
+
+        if(command.indexType == 0) {
+            if(command.instances == 1)
+                glDrawArrays(command.mode, command.first, command.count);
+            else
+                glDrawArraysInstanced(command.mode, command.first, command.count, command.instances);
+        }
+        else {
+            size_t indexSize = command.indexType == GL_UNSIGNED_SHORT ? 2 : (command.indexType == GL_UNSIGNED_BYTE ? 1 : 4);
+            void *offset = (void *)(command.first * indexSize);
+            if(command.instances == 1)
+                glDrawElementsBaseVertex(command.mode, command.count, command.indexType, offset, command.baseVertex);
+            else
+                glDrawElementsInstancedBaseVertex(command.mode, command.count, command.indexType, offset, command.instances, command.baseVertex);
+        }
+        stats.draws++;
+    }
+    if(activeUnit != 0)
+        glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(0);
+}
+
+#endif /* render_queue_h */
@@ -0,0 +1,175 @@
+//
+//  render_thread.h
+//  Window
+//
+//  Created by William Goniprow on 2/22/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef render_thread_h
+#define render_thread_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "camera.h"
+#include "frame_uniforms.h"
+#include "shader.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+class Model;
+
+// Packets in flight, the simulation runs at most FRAME_PACKET_DEPTH - 1 frames ahead of what is on screen
+const unsigned int FRAME_PACKET_DEPTH = 3;
+
+// An object the render side knows how to draw by id (VAO, shader, textures stay there), placed for this frame
+struct PacketObject {
+    unsigned int object;
+    glm::mat4 model;
+};
+
+// A Model drawn with Model::Submit, both owned by the render side and only referenced from here
+struct PacketModel {
+    Model *model;
+    Shader *shader;
+    glm::mat4 transform;
+};
+
+// Everything one frame needs, written by the simulation thread and read only by the render thread
+struct FramePacket {
+    unsigned long long frame;
+    CameraSnapshot camera;
+    LightsBlock lights;
+    GLenum polygonMode;
+    int viewportWidth;
+    int viewportHeight;
+    vector<PacketObject> objects;  // visible ones only, the simulation culls
+    vector<PacketModel> models;
+};
+
+struct RenderThreadStats {
+    unsigned long long frames;
+    double simulationWaitMilliseconds; // simulation blocked because every packet was in flight
+    double renderWaitMilliseconds;     // render thread idle waiting for the next packet
+};
+
+// Runs the GL side of the program on its own thread. The simulation fills a packet per frame with
+// BeginFrame/SubmitFrame, the render function passed to Start takes them in order with AcquireFrame/ReleaseFrame.
+// Packets are recycled in a ring of FRAME_PACKET_DEPTH, so their vectors keep their capacity.
+class RenderThread {
+public:
+    /* Functions */
+    RenderThread();
+    ~RenderThread() { Stop(); }
+    // Runs render on the new thread, it should loop until AcquireFrame returns NULL
+    void Start(function<void(RenderThread &)> render);
+    // Simulation side: next packet to fill, waits while every packet is in flight. NULL once stopped
+    FramePacket *BeginFrame();
+    void SubmitFrame();
+    // Render side: oldest submitted packet, waits for one. NULL once stopped and drained
+    const FramePacket *AcquireFrame();
+    void ReleaseFrame();
+    // Lets the render thread finish the submitted packets and joins it
+    void Stop();
+    RenderThreadStats Stats() const;
+private:
+    /* Ring Data */
+    FramePacket packets[FRAME_PACKET_DEPTH];
+    unsigned int writeIndex;
+    unsigned int readIndex;
+    unsigned int submitted;   // packets submitted and not yet released
+    unsigned long long nextFrame;
+    bool stopping;
+    mutable mutex lock;
+    condition_variable packetFree;
+    condition_variable packetReady;
+    thread renderer;
+    RenderThreadStats stats;
+    // not copyable, the thread is owned
+    RenderThread(const RenderThread &);
+    RenderThread &operator=(const RenderThread &);
+};
+
+RenderThread::RenderThread() : writeIndex(0), readIndex(0), submitted(0), nextFrame(0), stopping(false) {
+    stats.frames = 0;
+    stats.simulationWaitMilliseconds = 0.0;
+    stats.renderWaitMilliseconds = 0.0;
+}
+
+void RenderThread::Start(function<void(RenderThread &)> render) {
+    renderer = thread([this, render]() { render(*this); });
+}
+
+FramePacket *RenderThread::BeginFrame() {
+    unique_lock<mutex> guard(lock);
+    if(submitted == FRAME_PACKET_DEPTH) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        packetFree.wait(guard, [this] { return stopping || submitted < FRAME_PACKET_DEPTH; });
+        stats.simulationWaitMilliseconds += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    if(stopping)
+        return NULL;
+    FramePacket &packet = packets[writeIndex];
+    packet.frame = nextFrame;
+    packet.objects.clear();
+    packet.models.clear();
+    return &packet;
+}
+
+void RenderThread::SubmitFrame() {
+    {
+        lock_guard<mutex> guard(lock);
+        writeIndex = (writeIndex + 1) % FRAME_PACKET_DEPTH;
+        submitted++;
+        nextFrame++;
+    }
+    packetReady.notify_one();
+}
+
+const FramePacket *RenderThread::AcquireFrame() {
+    unique_lock<mutex> guard(lock);
+    if(submitted == 0) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        packetReady.wait(guard, [this] { return stopping || submitted > 0; });
+        stats.renderWaitMilliseconds += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    }
+    // whatever was submitted before Stop still gets drawn
+    if(submitted == 0)
+        return NULL;
+    return &packets[readIndex];
+}
+
+void RenderThread::ReleaseFrame() {
+    {
+        lock_guard<mutex> guard(lock);
+        readIndex = (readIndex + 1) % FRAME_PACKET_DEPTH;
+        submitted--;
+        stats.frames++;
+    }
+    packetFree.notify_one();
+}
+
+void RenderThread::Stop() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    packetReady.notify_all();
+    packetFree.notify_all();
+    if(renderer.joinable())
+        renderer.join();
+}
+
+RenderThreadStats RenderThread::Stats() const {
+    lock_guard<mutex> guard(lock);
+    return stats;
+}
+
+#endif /* render_thread_h */
@@ -10,11 +10,48 @@
 #define shader_h
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
 
+#include "gl_ext.h"
+#include "mapped_file.h"
+
+#include <sys/stat.h>
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// Linked program binaries are kept here, one file per source/define/driver combination
+const char *const SHADER_CACHE_DIR = "shader_cache";
+const uint32_t SHADER_BINARY_MAGIC = 0x4E494253; // "SBIN"
+
+// Binding points of the uniform blocks shared by every program (filled in by FrameUniforms)
+enum Uniform_Block_Binding {
+    CAMERA_BLOCK_BINDING = 0, // "Camera"
+    LIGHTS_BLOCK_BINDING = 1  // "Lights"
+};
+
+struct ShaderBinaryHeader {
+    uint32_t magic;
+    uint32_t format;  // driver specific binary format from glGetProgramBinary
+    uint32_t length;
+    uint32_t reserved;
+    uint64_t key;     // same hash as the file name, catches renamed or truncated files
+};
+
+// Uniform resolved once through Shader::GetUniform, the type picks the matching Shader::Set overload.
+// A name the program doesn't use resolves to an invalid handle and setting it does nothing.
+template <typename T>
+struct Uniform {
+    int slot;
+    Uniform() : slot(-1) {}
+    bool IsValid() const { return slot >= 0; }
+};
 
 class Shader {
 public:
@@ -22,7 +59,9 @@ public:
     unsigned int ID;
     
     // constructor reads and builds the shader
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath) {
+    // each define ("NAME" or "NAME VALUE") is injected right after the #version line of both stages
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const std::vector<std::string> &defines = std::vector<std::string>()) {
+        cacheKey = 0;
         // 1. retrive the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
@@ -51,9 +90,92 @@ public:
         catch(std::ifstream::failure e) {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ" << std::endl;
         }
+        vertexCode   = injectDefines(vertexCode, defines);
+        fragmentCode = injectDefines(fragmentCode, defines);
+        
+        // 2. reuse the driver's binary from a previous run if the sources and driver haven't changed
+        std::string cachePath = binaryCachePath(vertexCode, fragmentCode);
+        if(!cachePath.empty() && loadBinary(cachePath)) {
+            reflectUniforms();
+            bindUniformBlocks();
+            return;
+        }
+        
+        // 3. compile shaders
+        ID = compileProgram(vertexCode, fragmentCode);
+        if(!cachePath.empty())
+            saveBinary(cachePath);
+        reflectUniforms();
+        bindUniformBlocks();
+    }
+    // use/activate the shader
+    void use() {
+        glUseProgram(ID);
+    }
+    // typed handles, resolve once and keep them around for per frame uniforms
+    template <typename T>
+    Uniform<T> GetUniform(const std::string &name) const {
+        Uniform<T> uniform;
+        std::unordered_map<std::string, int>::const_iterator it = uniformSlots.find(name);
+        if(it != uniformSlots.end())
+            uniform.slot = it->second;
+        return uniform;
+    }
+    // uploads are skipped when the value matches what this program last received
+    void Set(Uniform<int> uniform, int value) const {
+        if(changed(uniform.slot, &value, sizeof(value)))
+            glUniform1i(slots[uniform.slot].location, value);
+    }
+    void Set(Uniform<float> uniform, float value) const {
+        if(changed(uniform.slot, &value, sizeof(value)))
+            glUniform1f(slots[uniform.slot].location, value);
+    }
+    void Set(Uniform<glm::vec3> uniform, const glm::vec3 &value) const {
+        if(changed(uniform.slot, &value[0], sizeof(float) * 3))
+            glUniform3fv(slots[uniform.slot].location, 1, &value[0]);
+    }
+    void Set(Uniform<glm::mat4> uniform, const glm::mat4 &mat) const {
+        if(changed(uniform.slot, &mat[0][0], sizeof(float) * 16))
+            glUniformMatrix4fv(slots[uniform.slot].location, 1, GL_FALSE, &mat[0][0]);
+    }
+    // utility uniform functions
+    void setBool(const std::string &name, bool value) const {
+        Set(GetUniform<int>(name), (int)value);
+    }
+    void setInt(const std::string &name, int value) const {
+        Set(GetUniform<int>(name), value);
+    }
+    void setFloat(const std::string &name, float value) const {
+        Set(GetUniform<float>(name), value);
+    }
+    void setVec3(const std::string &name, const glm::vec3 &value) const {
+        Set(GetUniform<glm::vec3>(name), value);
+    }
+    void setVec3(const std::string &name, float x, float y, float z) const {
+        Set(GetUniform<glm::vec3>(name), glm::vec3(x, y, z));
+    }
+    void setMat4(const std::string &name, const glm::mat4 &mat) const {
+        Set(GetUniform<glm::mat4>(name), mat);
+    }
+private:
+    /* Uniform Data */
+    struct UniformSlot {
+        GLint location;
+        bool uploaded;     // false until the first Set, the program's own defaults aren't shadowed
+        float value[16];   // last uploaded value, large enough for a mat4
+    };
+    std::unordered_map<std::string, int> uniformSlots;
+    mutable std::vector<UniformSlot> slots;
+    // the shadow values describe this program object, a copy would go stale as soon as either one uploads
+    Shader(const Shader &);
+    Shader &operator=(const Shader &);
+    
+    /* Program Cache Data */
+    uint64_t cacheKey;
+    
+    unsigned int compileProgram(const std::string &vertexCode, const std::string &fragmentCode) {
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
         unsigned int vertex, fragment;
         int success;
         char infoLog[512];
@@ -81,43 +203,200 @@ public:
         }
         
         // shader program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
+        unsigned int program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        // has to be requested before linking or the driver may not keep the binary around
+        if(GLExt().programBinary)
+            GLExt().ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
         // print linking errors if any
-        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
         if(!success) {
-            glGetProgramInfoLog(ID, 512, NULL, infoLog);
+            glGetProgramInfoLog(program, 512, NULL, infoLog);
             std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
         }
         
         // delete the shaders as they're linked into our program now and no longer necessary
         glDeleteShader(vertex);
         glDeleteShader(fragment);
+        return program;
     }
-    // use/activate the shader
-    void use() {
-        glUseProgram(ID);
+    
+    static std::string injectDefines(const std::string &code, const std::vector<std::string> &defines) {
+        if(defines.empty())
+            return code;
+        std::string block;
+        for(unsigned int i = 0; i < defines.size(); i++) {
+            std::string define = defines[i];
+            size_t space = define.find(' ');
+            if(space == std::string::npos)
+                define += " 1";
+            block += "#define " + define + "\n";
+        }
+        // #version has to stay the first statement
+        size_t version = code.find("#version");
+        size_t insertAt = 0;
+        if(version != std::string::npos) {
+            size_t lineEnd = code.find('\n', version);
+            insertAt = lineEnd == std::string::npos ? code.size() : lineEnd + 1;
+        }
+        std::string result = code;
+        result.insert(insertAt, block);
+        return result;
     }
-    // utility uniform functions
-    void setBool(const std::string &name, bool value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    
+    static void hashBytes(uint64_t &hash, const void *data, size_t size) {
+        // FNV-1a
+        const unsigned char *bytes = (const unsigned char *)data;
+        for(size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
     }
-    void setInt(const std::string &name, int value) const {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    static void hashString(uint64_t &hash, const char *text) {
+        if(text)
+            hashBytes(hash, text, strlen(text) + 1);
+        else
+            hashBytes(hash, "", 1);
     }
-    void setFloat(const std::string &name, float value) const {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    
+    // Empty when the driver can't hand out program binaries
+    std::string binaryCachePath(const std::string &vertexCode, const std::string &fragmentCode) {
+        if(!GLExt().programBinary)
+            return std::string();
+        // a binary is only good for the exact sources and the exact driver that produced it
+        uint64_t hash = 14695981039346656037ull;
+        hashBytes(hash, vertexCode.data(), vertexCode.size());
+        hashBytes(hash, fragmentCode.data(), fragmentCode.size());
+        hashString(hash, (const char *)glGetString(GL_VENDOR));
+        hashString(hash, (const char *)glGetString(GL_RENDERER));
+        hashString(hash, (const char *)glGetString(GL_VERSION));
+        cacheKey = hash;
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)hash);
+        return std::string(SHADER_CACHE_DIR) + "/" + name;
     }
-    void setVec3(const std::string &name, glm::vec3 &value) const {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    
+    bool loadBinary(const std::string &path) {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if(!in)
+            return false;
+        ShaderBinaryHeader header;
+        std::vector<char> binary;
+        bool valid = (bool)in.read((char *)&header, sizeof(header)) &&
+                     header.magic == SHADER_BINARY_MAGIC && header.key == cacheKey && header.length > 0;
+        if(valid) {
+            binary.resize(header.length);
+            valid = (bool)in.read(&binary[0], header.length);
+        }
+        in.close();
+        if(!valid) {
+            remove(path.c_str());
+            return false;
+        }
+        
+        ID = glCreateProgram();
+        GLExt().ProgramBinary(ID, header.format, &binary[0], (GLsizei)header.length);
+        int success;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if(!success) {
+            // rejected, usually a driver update that kept the version string, so rebuild from source
+            glDeleteProgram(ID);
+            ID = 0;
+            remove(path.c_str());
+            return false;
+        }
+        return true;
     }
-    void setVec3(const std::string &name, float x, float y, float z) const {
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+    
+    void saveBinary(const std::string &path) const {
+        int success;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        GLint length = 0;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(!success || length <= 0)
+            return;
+        ShaderBinaryHeader header;
+        memset(&header, 0, sizeof(header));
+        std::vector<char> binary(length);
+        GLsizei written = 0;
+        GLenum format = 0;
+        GLExt().GetProgramBinary(ID, length, &written, &format, &binary[0]);
+        if(written <= 0)
+            return;
+        header.magic  = SHADER_BINARY_MAGIC;
+        header.format = format;
+        header.length = (uint32_t)written;
+        header.key    = cacheKey;
+        
+        mkdir(SHADER_CACHE_DIR, 0755);
+        // a second instance never reads a half written binary
+        WriteFileAtomically(path, [&](std::ostream &out) {
+            out.write((const char *)&header, sizeof(header));
+            out.write(&binary[0], written);
+        });
+    }
+    
+    // Points the shared blocks at their fixed binding points, which a loaded binary doesn't carry, so it runs after either path.
+    void bindUniformBlocks() {
+        static const char *const names[] = {"Camera", "Lights"};
+        static const Uniform_Block_Binding bindings[] = {CAMERA_BLOCK_BINDING, LIGHTS_BLOCK_BINDING};
+        for(int i = 0; i < 2; i++) {
+            GLuint index = glGetUniformBlockIndex(ID, names[i]);
+            if(index != GL_INVALID_INDEX)
+                glUniformBlockBinding(ID, index, bindings[i]);
+        }
+    }
+    
+    // Builds the name -> slot table from every active uniform of the linked program.
+    // Arrays are reported once as "name[0]", each element gets its own slot and "name" is an alias for the first.
+    void reflectUniforms() {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> nameBuffer(maxLength > 0 ? maxLength : 1);
+        for(GLint i = 0; i < count; i++) {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, &nameBuffer[0]);
+            std::string name(&nameBuffer[0], length);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            if(location < 0)
+                continue; // uniform block member, set through its buffer instead
+            
+            bool isArray = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0;
+            if(!isArray) {
+                addSlot(name, location);
+                continue;
+            }
+            std::string base = name.substr(0, name.size() - 3);
+            uniformSlots[base] = addSlot(name, location);
+            for(GLint element = 1; element < size; element++) {
+                std::string elementName = base + "[" + std::to_string(element) + "]";
+                addSlot(elementName, glGetUniformLocation(ID, elementName.c_str()));
+            }
+        }
+    }
+    int addSlot(const std::string &name, GLint location) {
+        UniformSlot slot;
+        slot.location = location;
+        slot.uploaded = false;
+        slots.push_back(slot);
+        uniformSlots[name] = (int)slots.size() - 1;
+        return (int)slots.size() - 1;
     }
-    void setMat4(const std::string &name, glm::mat4 &mat) const {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    // true when the value needs uploading, the shadow copy is updated to match
+    bool changed(int slot, const void *value, size_t size) const {
+        if(slot < 0)
+            return false;
+        UniformSlot &shadow = slots[slot];
+        if(shadow.uploaded && memcmp(shadow.value, value, size) == 0)
+            return false;
+        memcpy(shadow.value, value, size);
+        shadow.uploaded = true;
+        return true;
     }
 };
 
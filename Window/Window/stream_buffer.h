@@ -0,0 +1,205 @@
+//
+//  stream_buffer.h
+//  Window
+//
+//  Created by William Goniprow on 2/16/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef stream_buffer_h
+#define stream_buffer_h
+
+#include <glad/glad.h>
+
+#include "gl_ext.h"
+
+#include <stdint.h>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+using namespace std;
+
+const unsigned int STREAM_MAX_FRAMES = 4;
+
+// Piece of a StreamBuffer handed out for this frame, data is where to write, offset where the GPU reads it
+struct StreamSlice {
+    void *data;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+struct StreamBufferStats {
+    unsigned long long frames;
+    unsigned long long stalls;        // frames where the GPU still had the region in use
+    double stallMilliseconds;         // total time spent waiting for those
+    size_t lastFrameBytes;
+    size_t peakFrameBytes;
+};
+
+// Ring buffer for data that is rewritten every frame (uniform blocks, instance data, dynamic vertices).
+// With GL 4.4 the whole ring is mapped once, persistent and coherent, and split into one region per frame
+// in flight. A fence per region keeps the CPU from overwriting what the GPU hasn't read yet.
+// Without buffer storage each frame orphans the buffer and maps it fresh instead.
+//
+// Per frame: BeginFrame, Allocate and write slices, Flush before the draws that read them, EndFrame after.
+class StreamBuffer {
+public:
+    /* Functions */
+    StreamBuffer(GLenum target, size_t frameSize, unsigned int framesInFlight = 3);
+    ~StreamBuffer();
+    // Waits for the next region to be free and starts handing out slices from it
+    void BeginFrame();
+    // Aligned slice of the current region, data is NULL if the region is full
+    StreamSlice Allocate(size_t size, size_t alignment = 16);
+    // Makes this frame's writes visible to GL, only does work on the orphaning path
+    void Flush();
+    // Fences the region once every draw that reads it has been issued
+    void EndFrame();
+    // glBindBufferRange for indexed targets (uniform/shader storage blocks)
+    void BindRange(const StreamSlice &slice, unsigned int index) const {
+        glBindBufferRange(target, index, buffer, slice.offset, slice.size);
+    }
+    unsigned int ID() const { return buffer; }
+    bool Persistent() const { return persistent; }
+    const StreamBufferStats &Stats() const { return stats; }
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, the alignment slices bound as uniform blocks need
+    static size_t UniformAlignment();
+private:
+    /* Ring Data */
+    GLenum target;
+    unsigned int buffer;
+    size_t frameSize;
+    unsigned int framesInFlight;
+    bool persistent;
+    char *mapped;       // whole ring when persistent, the current frame when orphaning
+    unsigned int region;
+    size_t head;        // bytes used in the current region
+    bool inFrame;
+    GLsync fences[STREAM_MAX_FRAMES];
+    StreamBufferStats stats;
+    // not copyable, the mapping is owned
+    StreamBuffer(const StreamBuffer &);
+    StreamBuffer &operator=(const StreamBuffer &);
+};
+
+StreamBuffer::StreamBuffer(GLenum target, size_t frameSize, unsigned int framesInFlight) : target(target), buffer(0), mapped(NULL), region(0), head(0), inFrame(false) {
+    // regions start on a 256 byte boundary, enough for any uniform buffer offset alignment
+    this->frameSize = (frameSize + 255) & ~(size_t)255;
+    this->framesInFlight = framesInFlight < 1 ? 1 : (framesInFlight > STREAM_MAX_FRAMES ? STREAM_MAX_FRAMES : framesInFlight);
+    for(unsigned int i = 0; i < STREAM_MAX_FRAMES; i++)
+        fences[i] = 0;
+    memset(&stats, 0, sizeof(stats));
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    persistent = GLExt().bufferStorage;
+    if(persistent) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = (GLsizeiptr)(this->frameSize * this->framesInFlight);
+        GLExt().BufferStorage(target, size, NULL, flags);
+        mapped = (char *)glMapBufferRange(target, 0, size, flags);
+        if(!mapped) {
+            cout << "ERROR::STREAM_BUFFER::PERSISTENT_MAP_FAILED" << endl;
+            // storage is immutable now, start over with a buffer the orphaning path can use
+            glBindBuffer(target, 0);
+            glDeleteBuffers(1, &buffer);
+            glGenBuffers(1, &buffer);
+            glBindBuffer(target, buffer);
+            persistent = false;
+        }
+    }
+    if(!persistent) {
+        // one region is enough, orphaning gives the driver a fresh one every frame
+        this->framesInFlight = 1;
+        glBufferData(target, this->frameSize, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(target, 0);
+}
+
+StreamBuffer::~StreamBuffer() {
+    for(unsigned int i = 0; i < STREAM_MAX_FRAMES; i++) {
+        if(fences[i])
+            glDeleteSync(fences[i]);
+    }
+    if(mapped) {
+        glBindBuffer(target, buffer);
+        glUnmapBuffer(target);
+        glBindBuffer(target, 0);
+    }
+    glDeleteBuffers(1, &buffer);
+}
+
+void StreamBuffer::BeginFrame() {
+    region = (region + 1) % framesInFlight;
+    head = 0;
+    inFrame = true;
+    stats.frames++;
+
+    if(persistent) {
+        GLsync fence = fences[region];
+        if(fence) {
+            // the fence is almost always signaled already, only count it as a stall when we actually wait
+            GLenum result = glClientWaitSync(fence, 0, 0);
+            if(result == GL_TIMEOUT_EXPIRED) {
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                do {
+                    result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000); // 1ms
+                } while(result == GL_TIMEOUT_EXPIRED);
+                stats.stalls++;
+                stats.stallMilliseconds += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+            }
+            glDeleteSync(fence);
+            fences[region] = 0;
+        }
+        return;
+    }
+
+    glBindBuffer(target, buffer);
+    glBufferData(target, frameSize, NULL, GL_STREAM_DRAW);
+    mapped = (char *)glMapBufferRange(target, 0, frameSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(target, 0);
+}
+
+StreamSlice StreamBuffer::Allocate(size_t size, size_t alignment) {
+    StreamSlice slice;
+    slice.data = NULL;
+    slice.offset = 0;
+    slice.size = (GLsizeiptr)size;
+    size_t start = (head + alignment - 1) / alignment * alignment;
+    if(!inFrame || !mapped || start + size > frameSize) {
+        cout << "ERROR::STREAM_BUFFER::OUT_OF_SPACE" << endl;
+        return slice;
+    }
+    size_t regionStart = persistent ? region * frameSize : 0;
+    slice.data = mapped + regionStart + start;
+    slice.offset = (GLintptr)(regionStart + start);
+    head = start + size;
+    return slice;
+}
+
+void StreamBuffer::Flush() {
+    if(persistent || !mapped)
+        return;
+    glBindBuffer(target, buffer);
+    glUnmapBuffer(target);
+    glBindBuffer(target, 0);
+    mapped = NULL;
+}
+
+void StreamBuffer::EndFrame() {
+    Flush();
+    if(persistent)
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    inFrame = false;
+    stats.lastFrameBytes = head;
+    if(head > stats.peakFrameBytes)
+        stats.peakFrameBytes = head;
+}
+
+size_t StreamBuffer::UniformAlignment() {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    return alignment > 0 ? (size_t)alignment : 256;
+}
+
+#endif /* stream_buffer_h */
@@ -0,0 +1,253 @@
+//
+//  texture_cache.h
+//  Window
+//
+//  Created by William Goniprow on 2/24/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef texture_cache_h
+#define texture_cache_h
+
+#include <glad/glad.h>
+
+#include "texture_loader.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+// Video memory the cache keeps textures in before it starts evicting, --texture-budget MB overrides it
+const size_t TEXTURE_CACHE_DEFAULT_BUDGET = (size_t)512 << 20;
+
+enum Texture_Cache_State {
+    TEXTURE_CACHE_LOADING,  // decoding, the placeholder is bound meanwhile
+    TEXTURE_CACHE_RESIDENT,
+    TEXTURE_CACHE_EVICTED   // back to the placeholder, reloaded the next time it is used
+};
+
+struct TextureCacheStats {
+    unsigned int textures;
+    unsigned int referenced;
+    size_t residentBytes;
+    unsigned long long evictions;
+    unsigned long long reloads;
+};
+
+struct TextureCacheEntry {
+    string key;
+    string path;
+    unsigned int options;
+    unsigned int textureID;
+    unsigned int references;
+    size_t bytes;                  // in video memory while resident
+    Texture_Cache_State state;
+    unsigned long long lastUsed;   // frame
+    list<TextureCacheEntry *>::iterator recent;
+};
+
+// Counted reference to a cached texture, the texture stays loaded (or reloadable) while any handle to it lives.
+// GL thread only, like the cache.
+class TextureHandle {
+public:
+    /* Functions */
+    TextureHandle() : entry(NULL) {}
+    TextureHandle(const TextureHandle &other) : entry(other.entry) { retain(); }
+    TextureHandle &operator=(const TextureHandle &other);
+    ~TextureHandle() { release(); }
+    bool IsValid() const { return entry != NULL; }
+    // The GL name, the same for as long as the texture is cached even across evictions
+    unsigned int ID() const { return entry ? entry->textureID : 0; }
+private:
+    /* Handle Data */
+    TextureCacheEntry *entry;
+    /* Functions */
+    explicit TextureHandle(TextureCacheEntry *entry) : entry(entry) { retain(); }
+    void retain() { if(entry) entry->references++; }
+    void release();
+    friend class TextureCache;
+};
+
+// Every texture file loaded once for the whole process. Lookups go by canonical path and load options, so
+// two models naming the same file share one texture. Resident textures are kept in least recently used order;
+// once their total passes the budget the oldest ones not used since the last Update go: unreferenced textures are deleted,
+// referenced ones fall back to the placeholder under the same GL name and are reloaded when next used.
+class TextureCache {
+public:
+    /* Functions */
+    TextureCache() : budget(TEXTURE_CACHE_DEFAULT_BUDGET), residentBytes(0), frame(0), evictions(0), reloads(0) {}
+    // The cached texture for path, decoded in the background the first time. options are Texture_Load_Option flags
+    TextureHandle Load(const string &path, unsigned int options = 0);
+    // Marks a texture as used this frame and reloads it if it was evicted, ignores names the cache doesn't own
+    void Touch(unsigned int textureID);
+    // Once per frame after Textures().Update(), evicts down to the budget. What was touched since the last call stays
+    void Update();
+    void SetBudget(size_t bytes) { budget = bytes; }
+    size_t Budget() const { return budget; }
+    TextureCacheStats Stats() const;
+private:
+    /* Cache Data */
+    unordered_map<string, TextureCacheEntry> entries;
+    unordered_map<unsigned int, TextureCacheEntry *> byID;
+    list<TextureCacheEntry *> recent;  // resident textures, most recently used first
+    size_t budget;
+    size_t residentBytes;
+    unsigned long long frame;
+    unsigned long long evictions;
+    unsigned long long reloads;
+    /* Functions */
+    static string canonicalPath(const string &path);
+    void request(TextureCacheEntry &entry);
+    void uploaded(unsigned int textureID, size_t bytes);
+    void evict(TextureCacheEntry &entry);
+    void released(TextureCacheEntry &entry);
+    friend class TextureHandle;
+    // not copyable, the textures are owned
+    TextureCache(const TextureCache &);
+    TextureCache &operator=(const TextureCache &);
+};
+
+// The process wide cache, used by Model and main
+TextureCache &SharedTextures() {
+    static TextureCache cache;
+    return cache;
+}
+
+// --texture-budget MB, 0 if not given
+size_t ParseTextureBudget(int argc, char **argv) {
+    for(int i = 1; i + 1 < argc; i++) {
+        if(strcmp(argv[i], "--texture-budget") == 0)
+            return (size_t)strtoul(argv[i + 1], NULL, 10) << 20;
+    }
+    return 0;
+}
+
+TextureHandle &TextureHandle::operator=(const TextureHandle &other) {
+    if(entry != other.entry) {
+        release();
+        entry = other.entry;
+        retain();
+    }
+    return *this;
+}
+
+void TextureHandle::release() {
+    if(entry && --entry->references == 0)
+        SharedTextures().released(*entry);
+    entry = NULL;
+}
+
+string TextureCache::canonicalPath(const string &path) {
+    // "a/../b.png" and "./b.png" are the same file
+    char *resolved = realpath(path.c_str(), NULL);
+    if(!resolved)
+        return path;
+    string canonical(resolved);
+    free(resolved);
+    return canonical;
+}
+
+TextureHandle TextureCache::Load(const string &path, unsigned int options) {
+    string key = canonicalPath(path) + '|' + std::to_string(options);
+    unordered_map<string, TextureCacheEntry>::iterator it = entries.find(key);
+    if(it != entries.end())
+        return TextureHandle(&it->second);
+
+    TextureCacheEntry &entry = entries[key];
+    entry.key = key;
+    entry.path = path;
+    entry.options = options;
+    entry.references = 0;
+    entry.bytes = 0;
+    entry.lastUsed = frame;
+    entry.recent = recent.end();
+    entry.textureID = Textures().Load(path, options, [this](unsigned int textureID, size_t bytes) { uploaded(textureID, bytes); });
+    entry.state = TEXTURE_CACHE_LOADING;
+    byID[entry.textureID] = &entry;
+    return TextureHandle(&entry);
+}
+
+void TextureCache::request(TextureCacheEntry &entry) {
+    entry.state = TEXTURE_CACHE_LOADING;
+    reloads++;
+    Textures().Reload(entry.textureID, entry.path, entry.options, [this](unsigned int textureID, size_t bytes) { uploaded(textureID, bytes); });
+}
+
+void TextureCache::uploaded(unsigned int textureID, size_t bytes) {
+    unordered_map<unsigned int, TextureCacheEntry *>::iterator it = byID.find(textureID);
+    if(it == byID.end())
+        return;
+    TextureCacheEntry &entry = *it->second;
+    entry.state = TEXTURE_CACHE_RESIDENT;
+    entry.bytes = bytes;
+    residentBytes += bytes;
+    recent.push_front(&entry);
+    entry.recent = recent.begin();
+}
+
+void TextureCache::Touch(unsigned int textureID) {
+    unordered_map<unsigned int, TextureCacheEntry *>::iterator it = byID.find(textureID);
+    if(it == byID.end())
+        return;
+    TextureCacheEntry &entry = *it->second;
+    entry.lastUsed = frame;
+    if(entry.state == TEXTURE_CACHE_RESIDENT)
+        recent.splice(recent.begin(), recent, entry.recent);
+    else if(entry.state == TEXTURE_CACHE_EVICTED)
+        request(entry);
+}
+
+void TextureCache::evict(TextureCacheEntry &entry) {
+    recent.erase(entry.recent);
+    entry.recent = recent.end();
+    residentBytes -= entry.bytes;
+    entry.bytes = 0;
+    evictions++;
+    if(entry.references == 0) {
+        // no handle holds it, drop it for good rather than keep a placeholder around
+        string key = entry.key;
+        glDeleteTextures(1, &entry.textureID);
+        byID.erase(entry.textureID);
+        entries.erase(key);
+        return;
+    }
+    TextureLoader::SetPlaceholder(entry.textureID);
+    entry.state = TEXTURE_CACHE_EVICTED;
+}
+
+void TextureCache::released(TextureCacheEntry &entry) {
+    // stays cached for whoever loads it next, Update deletes it once the budget needs the room
+    if(entry.state == TEXTURE_CACHE_EVICTED) {
+        string key = entry.key;
+        glDeleteTextures(1, &entry.textureID);
+        byID.erase(entry.textureID);
+        entries.erase(key);
+    }
+}
+
+void TextureCache::Update() {
+    // oldest first, what the last frame drew has to stay
+    while(residentBytes > budget && !recent.empty() && recent.back()->lastUsed < frame) {
+        evict(*recent.back());
+    }
+    frame++;
+}
+
+TextureCacheStats TextureCache::Stats() const {
+    TextureCacheStats stats;
+    stats.textures = (unsigned int)entries.size();
+    stats.referenced = 0;
+    for(unordered_map<string, TextureCacheEntry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        if(it->second.references > 0)
+            stats.referenced++;
+    }
+    stats.residentBytes = residentBytes;
+    stats.evictions = evictions;
+    stats.reloads = reloads;
+    return stats;
+}
+
+#endif /* texture_cache_h */
@@ -0,0 +1,313 @@
+//
+//  texture_loader.h
+//  Window
+//
+//  Created by William Goniprow on 2/8/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef texture_loader_h
+#define texture_loader_h
+
+#include <glad/glad.h>
+#include "stb_image.h"
+
+#include "job_system.h"
+#include "mipmap.h"
+#include "bc_encoder.h"
+#include "ktx2.h"
+
+#include <string>
+#include <iostream>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+using namespace std;
+
+enum Texture_Load_Option {
+    TEXTURE_LOAD_CLAMP      = 1 << 0, // clamp to edge instead of repeating
+    TEXTURE_LOAD_NO_MIPMAPS = 1 << 1,
+    TEXTURE_LOAD_LINEAR     = 1 << 2, // data rather than color (normals, masks), mips are filtered without sRGB decoding
+    TEXTURE_LOAD_MIP_KAISER  = 1 << 3, // sharper mips than the default box filter
+    TEXTURE_LOAD_MIP_LANCZOS = 1 << 4,
+    // with --compress-textures color textures become BC1/BC3 (BC7 with --bc7), these pick another format
+    TEXTURE_LOAD_MASK         = 1 << 5, // one channel (specular, roughness), BC4 sampled as grey
+    TEXTURE_LOAD_NORMAL_MAP   = 1 << 6, // tangent space x and y, BC5, the shader rebuilds z. Implies linear
+    TEXTURE_LOAD_UNCOMPRESSED = 1 << 7
+};
+
+// How the mip chain for a texture loaded with these Texture_Load_Option flags is filtered
+MipOptions TextureMipOptions(unsigned int options) {
+    MipOptions mipOptions;
+    if(options & TEXTURE_LOAD_MIP_LANCZOS)
+        mipOptions.filter = MIP_FILTER_LANCZOS;
+    else if(options & TEXTURE_LOAD_MIP_KAISER)
+        mipOptions.filter = MIP_FILTER_KAISER;
+    mipOptions.srgb = !(options & (TEXTURE_LOAD_LINEAR | TEXTURE_LOAD_NORMAL_MAP));
+    return mipOptions;
+}
+
+// The block format a texture loaded with these options is compressed to, BC_FORMAT_NONE when compression is
+// off or the driver can't sample the format. Called from the decode jobs, LoadGLExtensions has run by then
+Bc_Format TextureBcFormat(unsigned int options, const MipChain &mips) {
+    const TextureCompressionSettings &compression = TextureCompression();
+    if(!compression.enabled || (options & TEXTURE_LOAD_UNCOMPRESSED) || mips.levels.empty())
+        return BC_FORMAT_NONE;
+    Bc_Format format;
+    if(options & TEXTURE_LOAD_NORMAL_MAP)
+        format = BC_FORMAT_BC5;
+    else if(options & TEXTURE_LOAD_MASK)
+        format = BC_FORMAT_BC4;
+    else if(compression.bc7 && BcSupported(BC_FORMAT_BC7))
+        format = BC_FORMAT_BC7;
+    else
+        format = BcHasAlpha(mips.levels[0], mips.channels) ? BC_FORMAT_BC3 : BC_FORMAT_BC1;
+    return BcSupported(format) ? format : BC_FORMAT_NONE;
+}
+
+// What a .bc cache has to have been written with to stand in for this load
+uint32_t TextureBcSettings(unsigned int options) {
+    const TextureCompressionSettings &compression = TextureCompression();
+    return options | (uint32_t)compression.quality << 16 | (uint32_t)(compression.bc7 && BcSupported(BC_FORMAT_BC7)) << 20;
+}
+
+// Called on the GL thread once a texture's pixels are in, with roughly what it takes in video memory (0 if it failed)
+typedef function<void(unsigned int textureID, size_t bytes)> TextureUploaded;
+
+// Decodes image files on the job system and finishes the GL upload on the render thread.
+// Load() hands back a texture name immediately with a 1x1 white placeholder in it, the real
+// pixels replace it in the same texture object once Update() sees the decode has finished.
+// Mip levels are filtered on the CPU in the decode job and uploaded one by one, with MipCacheSetting()
+// they are kept in a .mips file next to the image and later loads read them instead of decoding.
+// With TextureCompression() enabled the levels are block compressed there too and cached as a .bc file.
+// .ktx2 files skip all of that, they are mapped and their levels go to GL straight from the mapping.
+class TextureLoader {
+public:
+    /* Functions */
+    TextureLoader();
+    ~TextureLoader();
+    // Returns the texture name right away, the decode runs in the background. options are Texture_Load_Option flags
+    unsigned int Load(const string &path, unsigned int options = 0, const TextureUploaded &uploaded = TextureUploaded());
+    // Decodes path again into an existing texture, which keeps what it holds until the upload
+    void Reload(unsigned int textureID, const string &path, unsigned int options = 0, const TextureUploaded &uploaded = TextureUploaded());
+    // Swaps a texture's storage for the 1x1 white placeholder Load starts it with
+    static void SetPlaceholder(unsigned int textureID);
+    // Uploads finished decodes, call once per frame on the GL thread. Returns how many were uploaded
+    unsigned int Update(unsigned int maxUploads = ~0u);
+    // Blocks until every queued texture has been decoded and uploaded
+    void Finish();
+    // Number of textures that are still decoding or waiting for upload
+    unsigned int Pending() const { return pending; }
+private:
+    struct DecodedImage {
+        unsigned int textureID;
+        string path;
+        unsigned int options;
+        TextureUploaded uploaded;
+        MipChain mips;       // just level 0 without mipmaps, no levels if decoding failed or it was compressed
+        BcImage compressed;  // BC_FORMAT_NONE unless compressed
+        shared_ptr<Ktx2File> ktx2; // set instead of either for .ktx2 files
+    };
+    /* Loader Data */
+    mutex readyMutex;
+    vector<DecodedImage> ready;
+    atomic<unsigned int> pending;
+    JobCounter decoding;
+    /* Functions */
+    void decode(unsigned int textureID, const string &path, unsigned int options, const TextureUploaded &uploaded);
+    static bool decodeLevels(const string &path, unsigned int options, MipChain &mips, BcImage &compressed);
+    static shared_ptr<Ktx2File> openKtx2(const string &path);
+    size_t upload(const DecodedImage &image);
+    size_t uploadKtx2(const DecodedImage &image);
+};
+
+// The process wide loader, used by Model and main
+TextureLoader &Textures() {
+    static TextureLoader loader;
+    return loader;
+}
+
+TextureLoader::TextureLoader() : pending(0) {
+    // make sure the job system outlives us, it may still be running our decode jobs at exit
+    Jobs();
+}
+
+TextureLoader::~TextureLoader() {
+    // decodes still running at exit would push into ready after it is gone
+    Jobs().Wait(decoding);
+}
+
+unsigned int TextureLoader::Load(const string &path, unsigned int options, const TextureUploaded &uploaded) {
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+    // placeholder so the texture is complete and can be sampled while the real one decodes
+    SetPlaceholder(textureID);
+    decode(textureID, path, options, uploaded);
+    return textureID;
+}
+
+void TextureLoader::Reload(unsigned int textureID, const string &path, unsigned int options, const TextureUploaded &uploaded) {
+    decode(textureID, path, options, uploaded);
+}
+
+void TextureLoader::SetPlaceholder(unsigned int textureID) {
+    const unsigned char white[4] = { 255, 255, 255, 255 };
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+    // empty mip levels free whatever an earlier upload left there
+    static GLint maxSize = 0;
+    if(maxSize == 0)
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    for(GLint level = 1; (1 << level) <= maxSize; level++) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+void TextureLoader::decode(unsigned int textureID, const string &path, unsigned int options, const TextureUploaded &uploaded) {
+    pending++;
+    Jobs().Run([this, textureID, path, options, uploaded]() {
+        DecodedImage image;
+        image.textureID = textureID;
+        image.path = path;
+        image.options = options;
+        image.uploaded = uploaded;
+        if(path.size() > 5 && path.compare(path.size() - 5, 5, ".ktx2") == 0)
+            image.ktx2 = openKtx2(path);
+        else
+            decodeLevels(path, options, image.mips, image.compressed);
+        lock_guard<mutex> lock(readyMutex);
+        ready.push_back(image);
+    }, &decoding);
+}
+
+bool TextureLoader::decodeLevels(const string &path, unsigned int options, MipChain &mips, BcImage &compressed) {
+    const bool compress = TextureCompression().enabled && !(options & TEXTURE_LOAD_UNCOMPRESSED);
+    if(compress && ReadBcCache(path, TextureBcSettings(options), compressed))
+        return true;
+
+    const bool mipmaps = !(options & TEXTURE_LOAD_NO_MIPMAPS);
+    const bool cached = mipmaps && MipCacheSetting();
+    const MipOptions mipOptions = TextureMipOptions(options);
+    if(!cached || !ReadMipCache(path, mipOptions, mips)) {
+        int width, height, nrComponents;
+        unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
+        if(!data)
+            return false;
+        if(mipmaps) {
+            GenerateMipChain(data, width, height, nrComponents, mipOptions, mips);
+            if(cached && !WriteMipCache(path, mipOptions, mips))
+                cout << "ERROR::TEXTURE_LOADER::MIP_CACHE_WRITE_FAILED " << path << endl;
+        }
+        else {
+            mips.channels = nrComponents;
+            mips.levels.resize(1);
+            mips.levels[0].width = width;
+            mips.levels[0].height = height;
+            mips.levels[0].pixels.assign(data, data + (size_t)width * height * nrComponents);
+        }
+        stbi_image_free(data);
+    }
+
+    Bc_Format format = compress ? TextureBcFormat(options, mips) : BC_FORMAT_NONE;
+    if(format != BC_FORMAT_NONE) {
+        EncodeBc(mips, format, TextureCompression().quality, compressed);
+        if(!WriteBcCache(path, TextureBcSettings(options), compressed))
+            cout << "ERROR::TEXTURE_LOADER::BC_CACHE_WRITE_FAILED " << path << endl;
+        mips.levels.clear();
+    }
+    return true;
+}
+
+shared_ptr<Ktx2File> TextureLoader::openKtx2(const string &path) {
+    // the levels are already filtered and in their GPU format, the job only has to get the pages off the disk
+    shared_ptr<Ktx2File> file = make_shared<Ktx2File>();
+    if(!file->Open(path) || !file->Prepare())
+        return shared_ptr<Ktx2File>();
+    return file;
+}
+
+unsigned int TextureLoader::Update(unsigned int maxUploads) {
+    vector<DecodedImage> batch;
+    {
+        lock_guard<mutex> lock(readyMutex);
+        if(ready.empty())
+            return 0;
+        if(ready.size() <= maxUploads) {
+            batch.swap(ready);
+        }
+        else {
+            batch.assign(ready.begin(), ready.begin() + maxUploads);
+            ready.erase(ready.begin(), ready.begin() + maxUploads);
+        }
+    }
+    for(unsigned int i = 0; i < batch.size(); i++) {
+        size_t bytes = upload(batch[i]);
+        pending--;
+        if(batch[i].uploaded)
+            batch[i].uploaded(batch[i].textureID, bytes);
+    }
+    return (unsigned int)batch.size();
+}
+
+void TextureLoader::Finish() {
+    while(pending > 0) {
+        if(Update() == 0)
+            this_thread::yield();
+    }
+}
+
+size_t TextureLoader::upload(const DecodedImage &image) {
+    if(image.ktx2)
+        return uploadKtx2(image);
+    const bool compressed = image.compressed.format != BC_FORMAT_NONE;
+    if(!compressed && image.mips.levels.empty()) {
+        std::cout << "Texture failed to load at path: " << image.path << std::endl;
+        return 0;
+    }
+    const bool mipmaps = (compressed ? image.compressed.levels.size() : image.mips.levels.size()) > 1;
+    const GLint wrap = image.options & TEXTURE_LOAD_CLAMP ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+    glBindTexture(GL_TEXTURE_2D, image.textureID);
+    // the levels were filtered (and compressed) in the decode job, no glGenerateMipmap stall here
+    if(compressed)
+        UploadBcImage(image.compressed);
+    else
+        UploadMipChain(image.mips);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if(!compressed)
+        return MipChainBytes(image.mips);
+    const size_t bytes = BcImageBytes(image.compressed);
+    if(TextureCompression().report) {
+        const BcLevel &top = image.compressed.levels[0];
+        cout << "Texture " << image.path << ": " << BcFormatName(image.compressed.format) << " " << top.width << "x" << top.height << ", "
+             << image.compressed.levels.size() << " levels, " << (bytes >> 10) << " KB, PSNR " << image.compressed.psnr << " dB" << endl;
+    }
+    return bytes;
+}
+
+size_t TextureLoader::uploadKtx2(const DecodedImage &image) {
+    const Ktx2File &file = *image.ktx2;
+    const unsigned int levels = image.options & TEXTURE_LOAD_NO_MIPMAPS ? 1 : file.NumLevels();
+    const GLint wrap = image.options & TEXTURE_LOAD_CLAMP ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+    glBindTexture(GL_TEXTURE_2D, image.textureID);
+    const size_t bytes = file.Upload(levels);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if(TextureCompression().report) {
+        const char *format = file.Format().bc != BC_FORMAT_NONE ? BcFormatName(file.Format().bc) : "uncompressed";
+        cout << "Texture " << image.path << ": KTX2 " << format << " " << file.Width() << "x" << file.Height() << ", "
+             << levels << " levels, " << (bytes >> 10) << " KB" << endl;
+    }
+    return bytes;
+}
+
+#endif /* texture_loader_h */
@@ -0,0 +1,147 @@
+//
+//  vertex_format.h
+//  Window
+//
+//  Created by William Goniprow on 2/15/20.
+//  Copyright © 2020 William Goniprow. All rights reserved.
+//
+
+#ifndef vertex_format_h
+#define vertex_format_h
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <stdint.h>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <vector>
+using namespace std;
+
+struct Vertex {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
+// Layouts a Mesh can use on the GPU, the CPU side always keeps full Vertex data
+enum Vertex_Format {
+    VERTEX_FLOAT,     // Vertex as is, 32 bytes
+    VERTEX_PACKED,    // float position, octahedral normal, half float uvs: 20 bytes
+    VERTEX_QUANTIZED  // 16 bit positions relative to the mesh bounds, octahedral normal, half float uvs: 16 bytes
+};
+
+struct PackedVertex {
+    glm::vec3 Position;
+    uint32_t Normal;    // octahedral, 2 x snorm16
+    uint32_t TexCoords; // 2 x half
+};
+
+struct QuantizedVertex {
+    uint16_t Position[4]; // unorm16 in the mesh bounds, w is padding
+    uint32_t Normal;
+    uint32_t TexCoords;
+};
+
+// Maps a unit vector onto the octahedron and unfolds it into [-1, 1]^2. A zero normal (faces without vn)
+// encodes as (0, 0, 1) rather than NaN.
+glm::vec2 OctahedralEncode(glm::vec3 n) {
+    const float length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if(length == 0.0f)
+        return glm::vec2(0.0f);
+    n = n / length;
+    glm::vec2 p(n.x, n.y);
+    if(n.z < 0.0f) {
+        p = glm::vec2((1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f));
+    }
+    return p;
+}
+
+size_t VertexStride(Vertex_Format format) {
+    switch(format) {
+        case VERTEX_PACKED:    return sizeof(PackedVertex);
+        case VERTEX_QUANTIZED: return sizeof(QuantizedVertex);
+        default:               return sizeof(Vertex);
+    }
+}
+
+// Converts vertices into the GPU layout of format. positionOffset/positionScale take the stored positions
+// back into model space (aPos * positionScale + positionOffset), they are identity unless VERTEX_QUANTIZED.
+void EncodeVertices(Vertex_Format format, const vector<Vertex> &vertices, vector<char> &encoded, glm::vec3 &positionOffset, glm::vec3 &positionScale) {
+    positionOffset = glm::vec3(0.0f);
+    positionScale  = glm::vec3(1.0f);
+    encoded.resize(vertices.size() * VertexStride(format));
+    if(vertices.empty())
+        return;
+    
+    if(format == VERTEX_FLOAT) {
+        memcpy(&encoded[0], &vertices[0], encoded.size());
+    }
+    else if(format == VERTEX_PACKED) {
+        PackedVertex *packed = (PackedVertex *)&encoded[0];
+        for(unsigned int i = 0; i < vertices.size(); i++) {
+            packed[i].Position  = vertices[i].Position;
+            packed[i].Normal    = glm::packSnorm2x16(OctahedralEncode(vertices[i].Normal));
+            packed[i].TexCoords = glm::packHalf2x16(vertices[i].TexCoords);
+        }
+    }
+    else {
+        // positions are stored relative to the bounds, the vertex shader scales them back
+        glm::vec3 boundsMin = vertices[0].Position, boundsMax = vertices[0].Position;
+        for(unsigned int i = 1; i < vertices.size(); i++) {
+            boundsMin = glm::min(boundsMin, vertices[i].Position);
+            boundsMax = glm::max(boundsMax, vertices[i].Position);
+        }
+        positionOffset = boundsMin;
+        positionScale  = boundsMax - boundsMin;
+        for(int c = 0; c < 3; c++) {
+            if(positionScale[c] <= 0.0f)
+                positionScale[c] = 1.0f;
+        }
+        QuantizedVertex *quantized = (QuantizedVertex *)&encoded[0];
+        for(unsigned int i = 0; i < vertices.size(); i++) {
+            glm::vec3 p = (vertices[i].Position - positionOffset) / positionScale;
+            for(int c = 0; c < 3; c++)
+                quantized[i].Position[c] = glm::packUnorm1x16(p[c]);
+            quantized[i].Position[3] = 0;
+            quantized[i].Normal    = glm::packSnorm2x16(OctahedralEncode(vertices[i].Normal));
+            quantized[i].TexCoords = glm::packHalf2x16(vertices[i].TexCoords);
+        }
+    }
+}
+
+// Points attributes 0-2 of the bound VAO at the bound GL_ARRAY_BUFFER, laid out as format
+void SetupVertexAttributes(Vertex_Format format) {
+    if(format == VERTEX_FLOAT) {
+        // Vertex positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+        // Vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // Vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+    }
+    else if(format == VERTEX_PACKED) {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PackedVertex), (void *)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void*)offsetof(PackedVertex, TexCoords));
+    }
+    else {
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(QuantizedVertex), (void *)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(QuantizedVertex), (void*)offsetof(QuantizedVertex, TexCoords));
+    }
+}
+
+#endif /* vertex_format_h */